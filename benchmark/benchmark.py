@@ -9,11 +9,8 @@ run_config = {
     "port": "12345",
     "total_packets": 400000,
     "window_size": 1000,
-    "perror": 0
-}
-
-compile_config = {
-    "payload_size": 2500
+    "perror": 0,
+    "payload_size": 2500    # Streamer -payload, the receiver agrees to anything up to MAX_PAYLOAD_SIZE
 }
 
 
@@ -21,7 +18,7 @@ WINDOW_CSV_PATH = os.path.join(os.getcwd(), "window.csv")
 FULL_TEST_CSV_PATH = os.path.join(os.getcwd(), "full_test.csv")
 ERROR_CSV_PATH = os.path.join(os.getcwd(), "error.csv")
 
-def append_to_csv(csvname, run_config, compile_config, throughput):
+def append_to_csv(csvname, run_config, throughput):
     newfile = not os.path.exists(csvname)
 
     with open(csvname, mode="a", newline="") as file:
@@ -32,10 +29,6 @@ def append_to_csv(csvname, run_config, compile_config, throughput):
             csvkey.append(key)
             row.append(run_config[key])
 
-        for key in compile_config:
-            csvkey.append(key)
-            row.append(compile_config[key])
-        
         csvkey.append("mbps")
         row.append(throughput)
         
@@ -45,7 +38,7 @@ def append_to_csv(csvname, run_config, compile_config, throughput):
 
 
 def run_test(csvname, config: dict):
-    sender_args = ["./Streamer", config["ip"], config["port"], "-num", config["total_packets"], "-window", config["window_size"], "--csv"]
+    sender_args = ["./Streamer", config["ip"], config["port"], "-num", config["total_packets"], "-window", config["window_size"], "-payload", config["payload_size"], "--csv"]
     sender_args = [str(a) for a in sender_args]
     sender = subprocess.Popen(
         sender_args, stdout=subprocess.PIPE
@@ -77,7 +70,7 @@ def run_test(csvname, config: dict):
     mean = statistics.mean(values)
     print(f"Mean Throughput {mean}")
 
-    append_to_csv(csvname, config, compile_config, mean)
+    append_to_csv(csvname, config, mean)
 
 
 if __name__ == "__main__":
@@ -0,0 +1,80 @@
+import os
+import subprocess
+import csv
+import time
+import argparse
+
+# Measures CPU seconds (user + sys) spent per Gbit of payload by Streamer and Receiver,
+# plus wall-clock throughput and peak resident set size of each process.
+
+run_config = {
+    "ip": "127.0.0.1",
+    "port": "12345",
+    "total_packets": 200000,
+    "window_size": 1000,
+    "perror": 0,
+    "payload_size": 2500    # Streamer -payload
+}
+
+CPU_CSV_PATH = os.path.join(os.getcwd(), "cpu.csv")
+
+
+def append_to_csv(csvname, label, run_config, results):
+    newfile = not os.path.exists(csvname)
+    with open(csvname, mode="a", newline="") as file:
+        writer = csv.writer(file)
+        if newfile:
+            writer.writerow(["label"] + list(run_config.keys()) + list(results.keys()))
+        writer.writerow([label] + list(run_config.values()) + list(results.values()))
+
+
+def run_test(config: dict, extra_sender_args, extra_receiver_args, receiver_prefix=[]):
+    # receiver_prefix wraps the Receiver command, e.g. ["ip", "netns", "exec", "ns"] to run it across a veth pair
+    receiver_args = ["./Receiver", config["port"], "-perror", config["perror"], "-window", config["window_size"], "--csv"]
+    receiver_args = receiver_prefix + [str(a) for a in receiver_args + extra_receiver_args]
+    receiver = subprocess.Popen(receiver_args, stdout=subprocess.DEVNULL)
+    time.sleep(0.2)
+
+    start = time.time()
+    sender_args = ["./Streamer", config["ip"], config["port"], "-num", config["total_packets"], "-window", config["window_size"], "-payload", config["payload_size"], "--csv", "--superdumb"]
+    sender_args = [str(a) for a in sender_args + extra_sender_args]
+    sender = subprocess.Popen(sender_args, stdout=subprocess.DEVNULL)
+
+    # wait4 gives us the rusage of each child individually
+    _, _, sender_usage = os.wait4(sender.pid, 0)
+    elapsed = time.time() - start
+    _, _, receiver_usage = os.wait4(receiver.pid, 0)
+
+    gbit = config["total_packets"] * config["payload_size"] * 8 / 1e9
+    results = {
+        "seconds": round(elapsed, 3),
+        "mbps": round(gbit * 1000 / elapsed, 1),
+        "sender_cpu_s_per_gbit": round((sender_usage.ru_utime + sender_usage.ru_stime) / gbit, 4),
+        "receiver_cpu_s_per_gbit": round((receiver_usage.ru_utime + receiver_usage.ru_stime) / gbit, 4),
+        "sender_maxrss_kb": sender_usage.ru_maxrss,
+        "receiver_maxrss_kb": receiver_usage.ru_maxrss,
+    }
+    print(results)
+    return results
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="CPU cost per Gbit benchmark")
+    parser.add_argument("--bindir", type=str, default="../x86-64/src/", help="directory holding Streamer and Receiver")
+    parser.add_argument("--label", type=str, default="current")
+    parser.add_argument("--window_size", type=int, default=run_config["window_size"])
+    parser.add_argument("--total_packets", type=int, default=run_config["total_packets"])
+    parser.add_argument("--perror", type=float, default=run_config["perror"])
+    parser.add_argument("--payload_size", type=int, default=run_config["payload_size"])
+    parser.add_argument("--sender_args", type=str, default="", help="extra Streamer arguments")
+    parser.add_argument("--receiver_args", type=str, default="", help="extra Receiver arguments")
+    args = parser.parse_args()
+
+    run_config["window_size"] = args.window_size
+    run_config["total_packets"] = args.total_packets
+    run_config["perror"] = args.perror
+    run_config["payload_size"] = args.payload_size
+
+    os.chdir(args.bindir)
+    results = run_test(run_config, args.sender_args.split(), args.receiver_args.split())
+    append_to_csv(CPU_CSV_PATH, args.label, run_config, results)
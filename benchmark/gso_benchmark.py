@@ -0,0 +1,44 @@
+import os
+import argparse
+
+from cpu_benchmark import run_config, run_test, append_to_csv
+
+# Compares sending and receiving DATA packets one by one (--nogso/--nogro) with UDP GSO/GRO super-datagrams.
+# Runs on loopback by default. For a veth pair, put the receiving end in a network namespace so traffic
+# doesn't short-circuit through lo, and pass its address and name:
+#
+#   ip netns add gso && ip link add veth0 type veth peer name veth1 && ip link set veth1 netns gso
+#   ip addr add 10.99.0.1/24 dev veth0 && ip link set veth0 up
+#   ip netns exec gso ip addr add 10.99.0.2/24 dev veth1 && ip netns exec gso ip link set veth1 up
+#   python3 gso_benchmark.py --ip 10.99.0.2 --netns gso
+
+GSO_CSV_PATH = os.path.join(os.getcwd(), "gso.csv")
+
+modes = {
+    "plain": (["--nogso"], ["--nogro"]),
+    "gso": ([], ["--nogro"]),
+    "gso+gro": ([], []),
+}
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="UDP GSO/GRO benchmark")
+    parser.add_argument("--bindir", type=str, default="../x86-64/src/", help="directory holding Streamer and Receiver")
+    parser.add_argument("--ip", type=str, default=run_config["ip"], help="receiver address")
+    parser.add_argument("--netns", type=str, default="", help="network namespace to run the Receiver in")
+    parser.add_argument("--window_size", type=int, default=run_config["window_size"])
+    parser.add_argument("--total_packets", type=int, default=run_config["total_packets"])
+    parser.add_argument("--repeat", type=int, default=3)
+    args = parser.parse_args()
+
+    run_config["ip"] = args.ip
+    run_config["window_size"] = args.window_size
+    run_config["total_packets"] = args.total_packets
+    prefix = ["ip", "netns", "exec", args.netns] if args.netns else []
+
+    os.chdir(args.bindir)
+    for _ in range(args.repeat):
+        for label, (sender_args, receiver_args) in modes.items():
+            print("Mode", label)
+            results = run_test(run_config, sender_args, receiver_args, prefix)
+            append_to_csv(GSO_CSV_PATH, label, run_config, results)
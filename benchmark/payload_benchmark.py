@@ -0,0 +1,34 @@
+import os
+import argparse
+
+from cpu_benchmark import run_config, run_test, append_to_csv
+
+# Sweeps the DATA payload size (Streamer -payload), from what fits a 1500 byte MTU to what fits a 9000 byte
+# jumbo frame, sending the same number of bytes each time. Per-packet costs (syscalls, headers, ACK and window
+# work) shrink with fewer, larger packets, so CPU per Gbit should fall as the payload grows. Every size runs
+# `repeat` times. Streamer --pmtu picks the largest size the path carries instead.
+
+PAYLOAD_CSV_PATH = os.path.join(os.getcwd(), "payload.csv")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="DATA payload size benchmark")
+    parser.add_argument("--bindir", type=str, default="../x86-64/src/", help="directory holding Streamer and Receiver")
+    parser.add_argument("--payloads", type=int, nargs="+", default=[1459, 2500, 4000, 6000, 8959])
+    parser.add_argument("--window_size", type=int, default=run_config["window_size"])
+    parser.add_argument("--total_bytes", type=int, default=run_config["total_packets"] * run_config["payload_size"])
+    parser.add_argument("--perror", type=float, default=run_config["perror"])
+    parser.add_argument("--repeat", type=int, default=3)
+    args = parser.parse_args()
+
+    run_config["window_size"] = args.window_size
+    run_config["perror"] = args.perror
+
+    os.chdir(args.bindir)
+    for _ in range(args.repeat):
+        for payload in args.payloads:
+            print("Payload", payload)
+            run_config["payload_size"] = payload
+            run_config["total_packets"] = args.total_bytes // payload
+            results = run_test(run_config, [], [])
+            append_to_csv(PAYLOAD_CSV_PATH, "payload=%d" % payload, run_config, results)
@@ -0,0 +1,94 @@
+import os
+import subprocess
+import statistics
+import csv
+import time
+import argparse
+
+# Compares the per-datagram receive loop (-batch 1) with recvmmsg batching.
+# Reports received packets/s and the kernel's socket drop counter for the receiver port.
+
+run_config = {
+    "ip": "127.0.0.1",
+    "port": "12345",
+    "total_packets": 200000,
+    "window_size": 1000,
+    "batch": 1
+}
+
+RECVBATCH_CSV_PATH = os.path.join(os.getcwd(), "recvbatch.csv")
+
+
+def kernel_drops(port):
+    # Last column of /proc/net/udp is the per-socket drop counter (Linux only)
+    try:
+        with open("/proc/net/udp") as f:
+            lines = f.readlines()[1:]
+    except OSError:
+        return 0
+    for line in lines:
+        fields = line.split()
+        local_port = int(fields[1].split(":")[1], 16)
+        if local_port == int(port):
+            return int(fields[-1])
+    return 0
+
+
+def append_to_csv(csvname, run_config, pps, drops):
+    newfile = not os.path.exists(csvname)
+    with open(csvname, mode="a", newline="") as file:
+        writer = csv.writer(file)
+        if newfile:
+            writer.writerow(list(run_config.keys()) + ["packets_per_s", "kernel_drops"])
+        writer.writerow(list(run_config.values()) + [pps, drops])
+
+
+def run_test(csvname, config: dict):
+    receiver_args = ["./Receiver", config["port"], "-window", config["window_size"], "-batch", config["batch"], "--csv"]
+    receiver_args = [str(a) for a in receiver_args]
+    receiver = subprocess.Popen(receiver_args, stdout=subprocess.PIPE)
+    time.sleep(0.2)
+
+    sender_args = ["./Streamer", config["ip"], config["port"], "-num", config["total_packets"], "-window", config["window_size"], "--csv", "--superdumb"]
+    sender_args = [str(a) for a in sender_args]
+    sender = subprocess.Popen(sender_args, stdout=subprocess.DEVNULL)
+    print("Spawned Sender and Receiver, batch", config["batch"])
+
+    # The drop counter disappears with the socket, so sample it while the receiver runs
+    drops = 0
+    deadline = time.time() + 60
+    while receiver.poll() is None and time.time() < deadline:
+        drops = max(drops, kernel_drops(config["port"]))
+        time.sleep(0.05)
+    if receiver.poll() is None:
+        print("Timed out, terminating")
+        receiver.terminate()
+    sender.wait()
+
+    stdout, _ = receiver.communicate()
+    rates = []
+    for line in stdout.decode().strip().split("\n"):
+        if line.startswith("STATS"):
+            fields = line.split(",")
+            elapsed_ms, packets = float(fields[2]), float(fields[3])
+            rates.append(packets / elapsed_ms * 1000)
+    pps = statistics.mean(rates) if rates else 0
+    print(f"Mean packets/s {pps:.0f}, kernel drops {drops}")
+
+    append_to_csv(csvname, config, pps, drops)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="recvmmsg batch size benchmark")
+    parser.add_argument("--batches", type=int, nargs="+", default=[1, 8, 64])
+    parser.add_argument("--window_size", type=int, default=run_config["window_size"])
+    parser.add_argument("--total_packets", type=int, default=run_config["total_packets"])
+    args = parser.parse_args()
+
+    run_config["window_size"] = args.window_size
+    run_config["total_packets"] = args.total_packets
+
+    os.chdir("../x86-64/src/")
+    for batch in args.batches:
+        run_config["batch"] = batch
+        run_test(RECVBATCH_CSV_PATH, run_config)
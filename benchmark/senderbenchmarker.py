@@ -9,14 +9,11 @@ run_config = {
     "ip": "10.0.0.40",      # Default receiver IP address.
     "port": "12345",        # Default receiver port.
     "total_packets": None,  # To be provided as an argument.
-    "window_size": None     # To be provided as an argument.
+    "window_size": None,    # To be provided as an argument.
+    "payload_size": 2500    # DATA payload bytes to ask the receiver for.
 }
 
-compile_config = {
-    "payload_size": 2500
-}
-
-def append_to_csv(csvname, run_config, compile_config, throughput):
+def append_to_csv(csvname, run_config, throughput):
     newfile = not os.path.exists(csvname)
     with open(csvname, mode="a", newline="") as file:
         writer = csv.writer(file)
@@ -25,9 +22,6 @@ def append_to_csv(csvname, run_config, compile_config, throughput):
         for key in run_config:
             header.append(key)
             row.append(run_config[key])
-        for key in compile_config:
-            header.append(key)
-            row.append(compile_config[key])
         header.append("mbps")
         row.append(throughput)
         if newfile:
@@ -41,6 +35,7 @@ def run_test(csvname, config: dict):
         config["port"],
         "-num", str(config["total_packets"]),
         "-window", str(config["window_size"]),
+        "-payload", str(config["payload_size"]),
         "--csv"
     ]
     print("Spawning Sender with command:", " ".join(sender_args))
@@ -62,7 +57,7 @@ def run_test(csvname, config: dict):
         mean = 0
     print(f"Mean Throughput: {mean}")
 
-    append_to_csv(csvname, config, compile_config, mean)
+    append_to_csv(csvname, config, mean)
 
 if __name__ == "__main__":
     parser = argparse.ArgumentParser(description="Sender Benchmark Script")
@@ -76,6 +71,8 @@ if __name__ == "__main__":
                         help="Receiver IP address")
     parser.add_argument("--port", type=str, default="12345",
                         help="Receiver port")
+    parser.add_argument("--payload_size", type=int, default=2500,
+                        help="DATA payload bytes, up to 8959")
     args = parser.parse_args()
 
     # Update run configuration based on command-line arguments.
@@ -83,6 +80,7 @@ if __name__ == "__main__":
     run_config["total_packets"] = args.total_packets
     run_config["ip"] = args.ip
     run_config["port"] = args.port
+    run_config["payload_size"] = args.payload_size
 
     # Change directory to where the Streamer binary is located.
     os.chdir("../x86-64/src/")
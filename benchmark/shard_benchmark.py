@@ -0,0 +1,38 @@
+import os
+import argparse
+
+from cpu_benchmark import run_config, run_test, append_to_csv
+
+# Stripes the stream over 1, 2, 4 and 8 shards (-shards on both ends) to see how throughput scales with cores.
+# Each shard gets the window as its own, at 1000 and at the Streamer's default of 10000, with and without
+# loss. Every combination runs `repeat` times.
+# The Streamer and Receiver each want shards + 1 cores (the shards plus the splitter or merge), so on a
+# machine with fewer, the extra shards only add context switches. Each row records os.cpu_count().
+
+SHARD_CSV_PATH = os.path.join(os.getcwd(), "shard.csv")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Sharded stream core scaling benchmark")
+    parser.add_argument("--bindir", type=str, default="../x86-64/src/", help="directory holding Streamer and Receiver")
+    parser.add_argument("--shards", type=int, nargs="+", default=[1, 2, 4, 8])
+    parser.add_argument("--window_sizes", type=int, nargs="+", default=[1000, 10000])
+    parser.add_argument("--total_packets", type=int, default=run_config["total_packets"])
+    parser.add_argument("--perrors", type=float, nargs="+", default=[0, 0.01])
+    parser.add_argument("--repeat", type=int, default=3)
+    args = parser.parse_args()
+
+    run_config["total_packets"] = args.total_packets
+
+    os.chdir(args.bindir)
+    for _ in range(args.repeat):
+        for window_size in args.window_sizes:
+            for perror in args.perrors:
+                run_config["window_size"] = window_size
+                run_config["perror"] = perror
+                for shards in args.shards:
+                    print("Shards", shards, "window", window_size, "perror", perror)
+                    extra = ["-shards", str(shards)]
+                    results = run_test(run_config, extra, extra)
+                    results["cores"] = os.cpu_count()
+                    append_to_csv(SHARD_CSV_PATH, "shards=%d" % shards, run_config, results)
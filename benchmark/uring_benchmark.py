@@ -0,0 +1,36 @@
+import os
+import argparse
+
+from cpu_benchmark import run_config, run_test, append_to_csv
+
+# Compares the sendmmsg()/recvmmsg() UDP connections with the io_uring ones (--uring on both ends).
+# Each backend runs `repeat` times. The CPU columns are the ones to look at: io_uring mostly saves syscalls,
+# so on loopback it shows up as CPU per Gbit more than as throughput.
+
+URING_CSV_PATH = os.path.join(os.getcwd(), "uring.csv")
+
+backends = {
+    "udp": [],
+    "uring": ["--uring"],
+}
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="UDP vs io_uring backend benchmark")
+    parser.add_argument("--bindir", type=str, default="../x86-64/src/", help="directory holding Streamer and Receiver")
+    parser.add_argument("--window_size", type=int, default=run_config["window_size"])
+    parser.add_argument("--total_packets", type=int, default=run_config["total_packets"])
+    parser.add_argument("--perror", type=float, default=run_config["perror"])
+    parser.add_argument("--repeat", type=int, default=3)
+    args = parser.parse_args()
+
+    run_config["window_size"] = args.window_size
+    run_config["total_packets"] = args.total_packets
+    run_config["perror"] = args.perror
+
+    os.chdir(args.bindir)
+    for _ in range(args.repeat):
+        for label, extra in backends.items():
+            print("Backend", label)
+            results = run_test(run_config, extra, extra)
+            append_to_csv(URING_CSV_PATH, label, run_config, results)
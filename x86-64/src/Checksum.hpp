@@ -0,0 +1,219 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <cstring>
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHECKSUM_X86 1
+#endif
+
+// The Internet checksum's one's complement sum (RFC 1071), the part of compute_checksum() before folding.
+//
+// Every version adds the data as native order 16 bit words, the last odd byte as the low byte of a word, as
+// the original scalar loop does. One's complement addition is associative, so the SIMD versions keep
+// partial sums in 32 bit lanes, one lane per half of each 32 bit word, and only fold at the end. They return
+// a different uint32_t than the scalar loop, but one that folds to the same checksum: zero only for all zero
+// data, and the same remainder modulo 0xFFFF.
+//
+// The widest version the CPU supports is picked once at runtime, like gf256::dispatch().
+namespace csum {
+
+inline uint32_t sumScalar(const void* data, size_t len) {
+    uint32_t sum = 0;
+    const uint16_t* ptr = reinterpret_cast<const uint16_t*>(data);
+    while(len > 1) {
+        sum += *ptr++;
+        len -= 2;
+    }
+    if(len > 0)
+        sum += *(const uint8_t*)ptr;
+    return sum;
+}
+
+
+// 64 bit total of the vector lanes plus the tail, folded back into a checksum_partial() value
+inline uint32_t foldTotal(uint64_t total) {
+    while (total >> 32)
+        total = (total & 0xFFFFFFFF) + (total >> 32);
+    return (uint32_t) total;
+}
+
+inline uint32_t copySumScalar(void* dst, const void* src, size_t len) {
+    std::memcpy(dst, src, len);
+    return sumScalar(dst, len);
+}
+
+#ifdef CHECKSUM_X86
+// A lane gains at most 2 * 0xFFFF per block, so flush them to the 64 bit total before 2^32 / (2 * 0xFFFF)
+const size_t LANE_FLUSH_BLOCKS = 32768;
+
+// SSE2 is part of x86-64, so this is the baseline
+inline uint32_t sumSSE2(const void* data, size_t len) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    const __m128i low = _mm_set1_epi32(0xFFFF);
+    uint64_t total = 0;
+    while (len >= 16) {
+        __m128i acc = _mm_setzero_si128();
+        size_t blocks = std::min(len / 16, LANE_FLUSH_BLOCKS);
+        for (size_t i = 0; i < blocks; i++, p += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*) p);
+            acc = _mm_add_epi32(acc, _mm_and_si128(v, low));
+            acc = _mm_add_epi32(acc, _mm_srli_epi32(v, 16));
+        }
+        len -= blocks * 16;
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i*) lanes, acc);
+        total += (uint64_t) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+    return foldTotal(total + sumScalar(p, len));
+}
+
+inline uint32_t copySumSSE2(void* dst, const void* src, size_t len) {
+    uint8_t* d = static_cast<uint8_t*>(dst);
+    const uint8_t* s = static_cast<const uint8_t*>(src);
+    const __m128i low = _mm_set1_epi32(0xFFFF);
+    uint64_t total = 0;
+    while (len >= 16) {
+        __m128i acc = _mm_setzero_si128();
+        size_t blocks = std::min(len / 16, LANE_FLUSH_BLOCKS);
+        for (size_t i = 0; i < blocks; i++, s += 16, d += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*) s);
+            _mm_storeu_si128((__m128i*) d, v);
+            acc = _mm_add_epi32(acc, _mm_and_si128(v, low));
+            acc = _mm_add_epi32(acc, _mm_srli_epi32(v, 16));
+        }
+        len -= blocks * 16;
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i*) lanes, acc);
+        total += (uint64_t) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+    std::memcpy(d, s, len);
+    return foldTotal(total + sumScalar(d, len));
+}
+
+__attribute__((target("avx2")))
+inline uint32_t sumAVX2(const void* data, size_t len) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    const __m256i low = _mm256_set1_epi32(0xFFFF);
+    uint64_t total = 0;
+    while (len >= 32) {
+        __m256i acc = _mm256_setzero_si256();
+        size_t blocks = std::min(len / 32, LANE_FLUSH_BLOCKS);
+        for (size_t i = 0; i < blocks; i++, p += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i*) p);
+            acc = _mm256_add_epi32(acc, _mm256_and_si256(v, low));
+            acc = _mm256_add_epi32(acc, _mm256_srli_epi32(v, 16));
+        }
+        len -= blocks * 32;
+        uint32_t lanes[8];
+        _mm256_storeu_si256((__m256i*) lanes, acc);
+        for (int i = 0; i < 8; i++) total += lanes[i];
+    }
+    return foldTotal(total + sumScalar(p, len));
+}
+
+__attribute__((target("avx2")))
+inline uint32_t copySumAVX2(void* dst, const void* src, size_t len) {
+    uint8_t* d = static_cast<uint8_t*>(dst);
+    const uint8_t* s = static_cast<const uint8_t*>(src);
+    const __m256i low = _mm256_set1_epi32(0xFFFF);
+    uint64_t total = 0;
+    while (len >= 32) {
+        __m256i acc = _mm256_setzero_si256();
+        size_t blocks = std::min(len / 32, LANE_FLUSH_BLOCKS);
+        for (size_t i = 0; i < blocks; i++, s += 32, d += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i*) s);
+            _mm256_storeu_si256((__m256i*) d, v);
+            acc = _mm256_add_epi32(acc, _mm256_and_si256(v, low));
+            acc = _mm256_add_epi32(acc, _mm256_srli_epi32(v, 16));
+        }
+        len -= blocks * 32;
+        uint32_t lanes[8];
+        _mm256_storeu_si256((__m256i*) lanes, acc);
+        for (int i = 0; i < 8; i++) total += lanes[i];
+    }
+    std::memcpy(d, s, len);
+    return foldTotal(total + sumScalar(d, len));
+}
+
+__attribute__((target("avx512f")))
+inline uint32_t sumAVX512(const void* data, size_t len) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    const __m512i low = _mm512_set1_epi32(0xFFFF);
+    uint64_t total = 0;
+    while (len >= 64) {
+        __m512i acc = _mm512_setzero_si512();
+        size_t blocks = std::min(len / 64, LANE_FLUSH_BLOCKS);
+        for (size_t i = 0; i < blocks; i++, p += 64) {
+            __m512i v = _mm512_loadu_si512((const void*) p);
+            acc = _mm512_add_epi32(acc, _mm512_and_si512(v, low));
+            acc = _mm512_add_epi32(acc, _mm512_srli_epi32(v, 16));
+        }
+        len -= blocks * 64;
+        uint32_t lanes[16];
+        _mm512_storeu_si512((void*) lanes, acc);
+        for (int i = 0; i < 16; i++) total += lanes[i];
+    }
+    return foldTotal(total + sumScalar(p, len));
+}
+
+__attribute__((target("avx512f")))
+inline uint32_t copySumAVX512(void* dst, const void* src, size_t len) {
+    uint8_t* d = static_cast<uint8_t*>(dst);
+    const uint8_t* s = static_cast<const uint8_t*>(src);
+    const __m512i low = _mm512_set1_epi32(0xFFFF);
+    uint64_t total = 0;
+    while (len >= 64) {
+        __m512i acc = _mm512_setzero_si512();
+        size_t blocks = std::min(len / 64, LANE_FLUSH_BLOCKS);
+        for (size_t i = 0; i < blocks; i++, s += 64, d += 64) {
+            __m512i v = _mm512_loadu_si512((const void*) s);
+            _mm512_storeu_si512((void*) d, v);
+            acc = _mm512_add_epi32(acc, _mm512_and_si512(v, low));
+            acc = _mm512_add_epi32(acc, _mm512_srli_epi32(v, 16));
+        }
+        len -= blocks * 64;
+        uint32_t lanes[16];
+        _mm512_storeu_si512((void*) lanes, acc);
+        for (int i = 0; i < 16; i++) total += lanes[i];
+    }
+    std::memcpy(d, s, len);
+    return foldTotal(total + sumScalar(d, len));
+}
+#endif
+
+typedef uint32_t (*SumFn)(const void*, size_t);
+typedef uint32_t (*CopySumFn)(void*, const void*, size_t);
+
+struct Dispatch {
+    SumFn sum = sumScalar;
+    CopySumFn copy_sum = copySumScalar;
+    const char* name = "scalar";
+
+    Dispatch() {
+#ifdef CHECKSUM_X86
+        __builtin_cpu_init();
+        sum = sumSSE2;
+        copy_sum = copySumSSE2;
+        name = "sse2";
+        if (__builtin_cpu_supports("avx2")) {
+            sum = sumAVX2;
+            copy_sum = copySumAVX2;
+            name = "avx2";
+        }
+        if (__builtin_cpu_supports("avx512f")) {
+            sum = sumAVX512;
+            copy_sum = copySumAVX512;
+            name = "avx512";
+        }
+#endif
+    }
+};
+
+inline const Dispatch& dispatch() {
+    static const Dispatch d;
+    return d;
+}
+
+}  // namespace csum
@@ -0,0 +1,176 @@
+#pragma once
+#include <chrono>
+#include <memory>
+#include <string>
+#include <stdint.h>
+#include <algorithm>
+#include "Protocol.hpp"
+
+// Decides how much of the SlidingWindow StreamSender may have in flight (the congestion window, cwnd).
+// StreamSender reports ACK progress, NACKs and timeouts; the controller never exceeds the window capacity.
+//
+// Losses are counted once per episode: after a back-off, further NACKs and timeouts for packets that were
+// already in flight at the time belong to the same episode and are ignored.
+
+enum CongestionMode {
+    CC_FIXED = 0,   // always use the full window (-window), the original behaviour
+    CC_AIMD  = 1,   // slow start, then +1 per window of ACKs, halve on loss
+    CC_DELAY = 2    // Vegas-style: size the window from RTT growth over the minimum RTT
+};
+
+const uint32_t MIN_CWND = 4;                    // smallest congestion window, in packets
+const uint32_t INITIAL_CWND = SEND_BATCH_SIZE;  // first window, one send batch
+const uint32_t DELAY_ALPHA = SEND_BATCH_SIZE / 2;   // delay controller: grow below this many queued packets
+const uint32_t DELAY_BETA = 2 * SEND_BATCH_SIZE;    // delay controller: shrink above this many
+
+class CongestionController {
+public:
+    CongestionController(uint32_t max_window) : max_window(max_window), window(max_window) {}
+    virtual ~CongestionController() {}
+
+    // A cumulative ACK covered `acked` new packets. rtt is zero if the ACK gave no valid sample.
+    virtual void onAck(uint32_t acked, std::chrono::microseconds rtt) {
+        (void) acked;
+        (void) rtt;
+    }
+    // The receiver NACK'd seq_num. next_seq is the first sequence number not sent yet.
+    virtual void onLoss(uint32_t seq_num, uint32_t next_seq) {
+        (void) seq_num;
+        (void) next_seq;
+    }
+    // seq_num was retransmitted after a retransmission timeout (RTO) without an ACK or NACK.
+    virtual void onTimeout(uint32_t seq_num, uint32_t next_seq) {
+        (void) seq_num;
+        (void) next_seq;
+    }
+
+    // The stream starts at initial_seq, no loss before it can belong to an episode
+    void start(uint32_t initial_seq) {
+        recovery_seq = initial_seq;
+    }
+
+    uint32_t cwnd() {
+        return std::min(max_window, std::max(MIN_CWND, (uint32_t) window));
+    }
+
+protected:
+    uint32_t max_window;
+    double window;              // fractional, so congestion avoidance can grow by 1/cwnd per ACK
+    uint32_t recovery_seq = 0;  // losses below this belong to the last episode
+
+    // True if this loss starts a new episode, in which case it ends once next_seq is ACK'd
+    bool newEpisode(uint32_t seq_num, uint32_t next_seq) {
+        if (seqBefore(seq_num, recovery_seq)) return false;
+        recovery_seq = next_seq;
+        return true;
+    }
+    void clampWindow() {
+        window = std::min((double) max_window, std::max((double) MIN_CWND, window));
+    }
+};
+
+
+class AIMDController : public CongestionController {
+public:
+    AIMDController(uint32_t max_window) : CongestionController(max_window), ssthresh(max_window) {
+        window = INITIAL_CWND;
+        clampWindow();
+    }
+
+    void onAck(uint32_t acked, std::chrono::microseconds) override {
+        if (window < ssthresh) {
+            window += acked;            // slow start, doubles every round trip
+        } else {
+            window += (double) acked / window;
+        }
+        clampWindow();
+    }
+    void onLoss(uint32_t seq_num, uint32_t next_seq) override {
+        if (!newEpisode(seq_num, next_seq)) return;
+        ssthresh = std::max((double) MIN_CWND, window / 2);
+        window = ssthresh;
+    }
+    void onTimeout(uint32_t seq_num, uint32_t next_seq) override {
+        if (!newEpisode(seq_num, next_seq)) return;
+        ssthresh = std::max((double) MIN_CWND, window / 2);
+        window = MIN_CWND;
+    }
+
+private:
+    double ssthresh;
+};
+
+
+// TCP Vegas-like controller. Once per window of ACKs it estimates how many packets are sitting in queues:
+//   queued = cwnd * (rtt - base_rtt) / rtt
+// using the smallest RTT of that window against the smallest ever seen, and grows or shrinks by one packet
+// to keep that between DELAY_ALPHA and DELAY_BETA. NACKs are ignored, since on this link they are as likely
+// to come from corruption as from queue overflow; timeouts still halve the window.
+class DelayController : public CongestionController {
+public:
+    DelayController(uint32_t max_window) : CongestionController(max_window) {
+        window = INITIAL_CWND;
+        clampWindow();
+    }
+
+    void onAck(uint32_t acked, std::chrono::microseconds rtt) override {
+        if (rtt.count() > 0) {
+            base_rtt = (base_rtt.count() == 0) ? rtt : std::min(base_rtt, rtt);
+            epoch_rtt = (epoch_rtt.count() == 0) ? rtt : std::min(epoch_rtt, rtt);
+        }
+        if (slow_start) {
+            window += acked;
+        }
+        epoch_acked += acked;
+        if (epoch_acked >= window && epoch_rtt.count() > 0) {
+            double queued = window * (epoch_rtt - base_rtt).count() / epoch_rtt.count();
+            if (slow_start) {
+                if (queued > DELAY_BETA) {
+                    slow_start = false;
+                    window -= queued - DELAY_BETA;
+                }
+            } else if (queued < DELAY_ALPHA) {
+                window += 1;
+            } else if (queued > DELAY_BETA) {
+                window -= 1;
+            }
+            epoch_acked = 0;
+            epoch_rtt = std::chrono::microseconds(0);
+        }
+        clampWindow();
+    }
+    // A NACK on its own is not treated as congestion: if queues are filling, the RTT already shows it.
+    void onTimeout(uint32_t seq_num, uint32_t next_seq) override {
+        if (!newEpisode(seq_num, next_seq)) return;
+        slow_start = false;
+        window = window / 2;
+        clampWindow();
+    }
+
+private:
+    bool slow_start = true;
+    uint32_t epoch_acked = 0;
+    std::chrono::microseconds base_rtt{0};
+    std::chrono::microseconds epoch_rtt{0};
+};
+
+
+inline std::unique_ptr<CongestionController> makeCongestionController(CongestionMode mode, uint32_t max_window) {
+    switch (mode) {
+        case CC_AIMD:
+            return std::unique_ptr<CongestionController>(new AIMDController(max_window));
+        case CC_DELAY:
+            return std::unique_ptr<CongestionController>(new DelayController(max_window));
+        default:
+            return std::unique_ptr<CongestionController>(new CongestionController(max_window));
+    }
+}
+
+// Parses the -cc command line value, returns false for an unknown name.
+inline bool parseCongestionMode(const std::string& name, CongestionMode& mode) {
+    if (name == "fixed") mode = CC_FIXED;
+    else if (name == "aimd") mode = CC_AIMD;
+    else if (name == "delay") mode = CC_DELAY;
+    else return false;
+    return true;
+}
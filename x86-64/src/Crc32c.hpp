@@ -0,0 +1,128 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <cstring>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CRC32C_X86 1
+#endif
+
+// CRC32C (Castagnoli), the CAP_CRC32C packet trailer.
+//
+// extend() runs the bit-reflected CRC register over more data, without the initial and final inversion:
+// crc32c(data) is ~extend(~0, data). SSE4.2 has an instruction for it, one 8 byte step every cycle but
+// with a 3 cycle latency, so the fastest version runs three stripes side by side and merges them with
+// carry-less multiplies (PCLMULQDQ). The widest version the CPU supports is picked once at runtime.
+namespace crc32c {
+
+const uint32_t POLY = 0x82F63B78;   // reflected
+
+inline uint32_t extendScalar(uint32_t crc, const void* data, size_t len) {
+    struct Table {
+        uint32_t t[256];
+        Table() {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                    c = (c & 1) ? (c >> 1) ^ POLY : c >> 1;
+                t[i] = c;
+            }
+        }
+    };
+    static const Table table;
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    while (len--)
+        crc = table.t[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+#ifdef CRC32C_X86
+__attribute__((target("sse4.2")))
+inline uint32_t extendSSE42(uint32_t crc, const void* data, size_t len) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    uint64_t c = crc;
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t v;
+        std::memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+    }
+    uint32_t c32 = c;
+    while (len--)
+        c32 = _mm_crc32_u8(c32, *p++);
+    return c32;
+}
+
+// Three stripes of `stripe` bytes at once, as long as there is data for all three, merged by
+// crc = c0 * x^(16 * stripe) + c1 * x^(8 * stripe) + c2 (mod POLY). A 32 bit reflected c times
+// k = x^(n - 33) in PCLMULQDQ, reduced by a crc32 of the 64 bit product, is c * x^n.
+__attribute__((target("sse4.2,pclmul")))
+inline uint32_t extendStripes(uint32_t crc, const uint8_t*& p, size_t& len, size_t stripe, uint32_t k1, uint32_t k2) {
+    while (len >= 3 * stripe) {
+        uint64_t c0 = crc, c1 = 0, c2 = 0;
+        for (size_t i = 0; i < stripe; i += 8) {
+            uint64_t v0, v1, v2;
+            std::memcpy(&v0, p + i, 8);
+            std::memcpy(&v1, p + stripe + i, 8);
+            std::memcpy(&v2, p + 2 * stripe + i, 8);
+            c0 = _mm_crc32_u64(c0, v0);
+            c1 = _mm_crc32_u64(c1, v1);
+            c2 = _mm_crc32_u64(c2, v2);
+        }
+        __m128i c = _mm_set_epi64x(c1, c0);
+        __m128i k = _mm_set_epi64x(k1, k2);
+        __m128i t = _mm_xor_si128(_mm_clmulepi64_si128(c, k, 0x00), _mm_clmulepi64_si128(c, k, 0x11));
+        crc = _mm_crc32_u64(0, _mm_cvtsi128_si64(t)) ^ c2;
+        p += 3 * stripe;
+        len -= 3 * stripe;
+    }
+    return crc;
+}
+
+// Long stripes for the bulk of a packet, short ones for most of what is left
+const size_t LONG_STRIPE = 512;
+const uint32_t LONG_K1 = 0xDD7E3B0C;    // x^(8 * 512 - 33)
+const uint32_t LONG_K2 = 0x170076FA;    // x^(16 * 512 - 33)
+const size_t SHORT_STRIPE = 128;
+const uint32_t SHORT_K1 = 0x0D3B6092;   // x^(8 * 128 - 33)
+const uint32_t SHORT_K2 = 0xB9E02B86;   // x^(16 * 128 - 33)
+
+__attribute__((target("sse4.2,pclmul")))
+inline uint32_t extendSSE42Clmul(uint32_t crc, const void* data, size_t len) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    crc = extendStripes(crc, p, len, LONG_STRIPE, LONG_K1, LONG_K2);
+    crc = extendStripes(crc, p, len, SHORT_STRIPE, SHORT_K1, SHORT_K2);
+    return extendSSE42(crc, p, len);
+}
+#endif
+
+typedef uint32_t (*ExtendFn)(uint32_t, const void*, size_t);
+
+struct Dispatch {
+    ExtendFn extend = extendScalar;
+    const char* name = "scalar";
+
+    Dispatch() {
+#ifdef CRC32C_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse4.2")) {
+            extend = extendSSE42;
+            name = "sse4.2";
+            if (__builtin_cpu_supports("pclmul")) {
+                extend = extendSSE42Clmul;
+                name = "sse4.2+pclmul";
+            }
+        }
+#endif
+    }
+};
+
+inline const Dispatch& dispatch() {
+    static const Dispatch d;
+    return d;
+}
+
+inline uint32_t extend(uint32_t crc, const void* data, size_t len) {
+    return dispatch().extend(crc, data, len);
+}
+
+}  // namespace crc32c
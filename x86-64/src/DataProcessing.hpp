@@ -15,6 +15,12 @@ class DataProcessor {
 //  Interface for sequentially processing data
 public:
     virtual int processData(size_t size, char* buffer) = 0;
+
+    // Bytes processData() copied to hand the data on since the last call, for the receiver's Copied/B.
+    // Writing the data out is what processing is for, and doesn't count.
+    virtual size_t takeCopied() {
+        return 0;
+    }
 };
 
 
@@ -1,19 +1,30 @@
 #pragma once
+#include <stdio.h>
 #include <vector>
 #include <map>
+#include <algorithm>
+#include <new>
+#include <sys/mman.h>
 #include "Protocol.hpp"
 #include "DataProcessing.hpp"
+#include "GapTracker.hpp"
+
+// DataWindow implementations, for code that wants the interface rather than SlidingWindow's ring.
+// PacketMap is the original; PacketHashMap and PacketRing keep their elements in a SlotPool instead,
+// so nothing is allocated or copied per reserve().
 
 template <typename PacketType>
 class PacketMap: public DataWindow<PacketType> {
 protected:
     std::map<uint32_t, PacketType> packetmap;
     typename std::map<uint32_t, PacketType>::iterator iter;
+    size_t capacity;
 public:
-    PacketMap() {};
+    PacketMap(size_t capacity=WINDOW_SIZE) : capacity(capacity) {};
     ~PacketMap() {};
-    
+
     PacketType* reserve(uint32_t seq_num) override {
+        if (isFull() && !contains(seq_num)) return nullptr;
         PacketType info;
         auto it = packetmap.insert(std::make_pair(seq_num, info)).first;
         return &(*it).second;
@@ -27,7 +38,7 @@ public:
         auto it = packetmap.find(seq_num);
         if (it == packetmap.end()) {
             return nullptr;
-        } 
+        }
         return &(*it).second;
     };
 
@@ -35,8 +46,7 @@ public:
         return packetmap.erase(seq_num);
     };
     bool isFull() override {
-        return false;   // TODO
-        return packetmap.size() >= WINDOW_SIZE;
+        return packetmap.size() >= capacity;
     };
     size_t size() override {
         return packetmap.size();
@@ -66,3 +76,250 @@ public:
     };
 };
 
+
+// capacity elements in one anonymous mapping, handed out by index from a free list. Pages are only
+// faulted in when an element on them is first used, and the most recently freed element goes out
+// first, while it is still in cache. Elements are default-initialized, so a Packet isn't zeroed.
+template <typename PacketType>
+class SlotPool {
+public:
+    static const uint32_t NONE = UINT32_MAX;
+
+    SlotPool(uint32_t capacity) : capacity(capacity) {
+        void* mem = mmap(nullptr, bytes(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+            perror("mmap slot pool");
+            this->capacity = 0;
+            return;
+        }
+        base = static_cast<PacketType*>(mem);
+        free_slots.reserve(capacity);
+        release();
+    }
+    SlotPool(const SlotPool&) = delete;
+    SlotPool& operator=(const SlotPool&) = delete;
+    ~SlotPool() {
+        release();
+        if (base) munmap(base, bytes());
+    }
+
+    // Index of a new element, NONE if the pool is used up
+    uint32_t allocate() {
+        if (free_slots.empty()) return NONE;
+        uint32_t i = free_slots.back();
+        free_slots.pop_back();
+        new (&base[i]) PacketType;
+        live[i] = true;
+        return i;
+    }
+
+    void free(uint32_t i) {
+        base[i].~PacketType();
+        live[i] = false;
+        free_slots.push_back(i);
+    }
+
+    // Destroys every element
+    void release() {
+        for (uint32_t i = 0; i < live.size(); i++) {
+            if (live[i]) base[i].~PacketType();
+        }
+        live.assign(capacity, false);
+        free_slots.clear();
+        for (uint32_t i = capacity; i > 0; i--) free_slots.push_back(i - 1);
+    }
+
+    inline PacketType* operator[](uint32_t i) { return &base[i]; }
+    inline uint32_t used() { return capacity - free_slots.size(); }
+    inline uint32_t size() { return capacity; }
+
+private:
+    size_t bytes() { return std::max<size_t>(capacity, 1) * sizeof(PacketType); }
+
+    PacketType* base = nullptr;
+    uint32_t capacity;
+    std::vector<uint32_t> free_slots;
+    std::vector<bool> live;
+};
+
+
+// Open addressing with linear probing over a power of two table of at least twice capacity entries,
+// each a sequence number and the index of its element in the pool. Fibonacci hashing spreads any set of
+// sequence numbers, in the window or not; erase() shifts the rest of the probe run back instead of leaving
+// tombstones, so lookups never get slower as the window slides. Iterates in table order.
+template <typename PacketType>
+class PacketHashMap: public DataWindow<PacketType> {
+public:
+    PacketHashMap(size_t capacity=WINDOW_SIZE) : pool(capacity), entries(tableSize(capacity)),
+            mask(entries.size() - 1), shift(32 - __builtin_ctz(entries.size())) {}
+
+    PacketType* reserve(uint32_t seq_num) override {
+        size_t i = find(seq_num);
+        if (entries[i].index != SlotPool<PacketType>::NONE) return pool[entries[i].index];
+        uint32_t index = pool.allocate();
+        if (index == SlotPool<PacketType>::NONE) return nullptr;
+        entries[i].seq_num = seq_num;
+        entries[i].index = index;
+        return pool[index];
+    }
+
+    bool contains(uint32_t seq_num) override {
+        return entries[find(seq_num)].index != SlotPool<PacketType>::NONE;
+    }
+
+    PacketType* get(uint32_t seq_num) override {
+        uint32_t index = entries[find(seq_num)].index;
+        return index == SlotPool<PacketType>::NONE ? nullptr : pool[index];
+    }
+
+    bool erase(uint32_t seq_num) override {
+        size_t i = find(seq_num);
+        if (entries[i].index == SlotPool<PacketType>::NONE) return false;
+        pool.free(entries[i].index);
+        // Move back any entry after the hole that can't be reached past it anymore
+        size_t j = i;
+        while (true) {
+            j = (j + 1) & mask;
+            if (entries[j].index == SlotPool<PacketType>::NONE) break;
+            size_t home = hash(entries[j].seq_num);
+            if (((j - home) & mask) >= ((j - i) & mask)) {
+                entries[i] = entries[j];
+                i = j;
+            }
+        }
+        entries[i].index = SlotPool<PacketType>::NONE;
+        return true;
+    }
+
+    void resetIter() override {
+        iter = 0;
+        skipEmpty();
+    }
+    PacketType* getIter() override {
+        return pool[entries[iter].index];
+    }
+    bool nextIter() override {
+        iter++;
+        skipEmpty();
+        return !isIterDone();
+    }
+    bool isIterDone() override {
+        return iter == entries.size();
+    }
+
+    bool isFull() override { return pool.used() == pool.size(); }
+    bool isEmpty() override { return pool.used() == 0; }
+    size_t size() override { return pool.used(); }
+    void clear() override {
+        pool.release();
+        for (Entry& entry : entries) entry.index = SlotPool<PacketType>::NONE;
+    }
+
+private:
+    struct Entry {
+        uint32_t seq_num = 0;
+        uint32_t index = SlotPool<PacketType>::NONE;
+    };
+
+    static size_t tableSize(size_t capacity) {
+        size_t size = 2;
+        while (size < 2 * capacity) size <<= 1;
+        return size;
+    }
+
+    inline size_t hash(uint32_t seq_num) { return (uint32_t) (seq_num * 2654435769u) >> shift; }
+
+    // seq_num's entry, or the empty one where it would go
+    inline size_t find(uint32_t seq_num) {
+        size_t i = hash(seq_num);
+        while (entries[i].index != SlotPool<PacketType>::NONE && entries[i].seq_num != seq_num) {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+
+    void skipEmpty() {
+        while (iter < entries.size() && entries[iter].index == SlotPool<PacketType>::NONE) iter++;
+    }
+
+    SlotPool<PacketType> pool;
+    std::vector<Entry> entries;
+    size_t mask;
+    int shift;
+    size_t iter = 0;
+};
+
+
+// seq_num lives in element seq_num & mask of the pool, like SlidingWindow, but without a base: reserve()
+// fails while the element holds another sequence number, so the caller erases what leaves its window.
+// Which elements are live is a GapTracker bitmap, so iteration, in ring order, skips empty runs 64 at a time.
+template <typename PacketType>
+class PacketRing: public DataWindow<PacketType> {
+public:
+    PacketRing(size_t capacity=WINDOW_SIZE) : pool(ringSize(capacity)), capacity(capacity),
+            tags(pool.size()), live(pool.size()) {
+        for (uint32_t i = 0; i < pool.size(); i++) pool.allocate();
+    }
+
+    PacketType* reserve(uint32_t seq_num) override {
+        uint32_t i = seq_num & (pool.size() - 1);
+        if (live.test(i)) return tags[i] == seq_num ? pool[i] : nullptr;
+        if (count == capacity) return nullptr;
+        tags[i] = seq_num;
+        live.set(i);
+        count++;
+        return pool[i];
+    }
+
+    bool contains(uint32_t seq_num) override {
+        uint32_t i = seq_num & (pool.size() - 1);
+        return tags[i] == seq_num && live.test(i);
+    }
+
+    PacketType* get(uint32_t seq_num) override {
+        return contains(seq_num) ? pool[seq_num & (pool.size() - 1)] : nullptr;
+    }
+
+    bool erase(uint32_t seq_num) override {
+        if (!contains(seq_num)) return false;
+        live.clear(seq_num & (pool.size() - 1));
+        count--;
+        return true;
+    }
+
+    void resetIter() override {
+        iter = live.nextArrived(0, pool.size());
+    }
+    PacketType* getIter() override {
+        return pool[iter];
+    }
+    bool nextIter() override {
+        iter = live.nextArrived(iter + 1, pool.size());
+        return !isIterDone();
+    }
+    bool isIterDone() override {
+        return iter == pool.size();
+    }
+
+    bool isFull() override { return count == capacity; }
+    bool isEmpty() override { return count == 0; }
+    size_t size() override { return count; }
+    void clear() override {
+        live.reset();
+        count = 0;
+    }
+
+private:
+    static uint32_t ringSize(size_t capacity) {
+        uint32_t size = 1;
+        while (size < capacity) size <<= 1;
+        return size;
+    }
+
+    SlotPool<PacketType> pool;      // every element allocated up front, the ring owns them all
+    size_t capacity;
+    size_t count = 0;
+    std::vector<uint32_t> tags;
+    GapTracker live;
+    uint32_t iter = 0;
+};
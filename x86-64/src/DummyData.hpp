@@ -5,11 +5,12 @@
 class DummyProvider : public DataProvider {
 // Interface to read data sequentially. Can use for dummy, file, or stream
 public:
+    // num_packets 0 never runs out
     DummyProvider(uint32_t num_packets=1000, bool superdumb=false) : total_packets(num_packets), superdumb(superdumb) {}
     uint32_t count = 0;
     uint32_t total_packets;
     int getData(size_t size, char* buffer) override {
-        if (count >= total_packets) {
+        if (total_packets > 0 && count >= total_packets) {
             return 0;
         }
         count++;
@@ -0,0 +1,158 @@
+#pragma once
+#include <chrono>
+#include <algorithm>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
+
+// Readiness flags returned by EventPoller::wait() and NetworkConnection::wait()
+enum PollEvent {
+    POLL_TIMEOUT  = 0,
+    POLL_READABLE = 1,
+    POLL_WRITABLE = 2,
+    POLL_WAKEUP   = 4     // the fd passed to watch() is readable
+};
+
+// Blocks on one socket until it is readable (or writable, when asked) or a deadline passes.
+// On Linux this is an epoll set holding the socket and a timerfd armed with the absolute deadline,
+// so the loops sleep exactly until the next thing they have to do. Elsewhere it falls back to select().
+// One more fd can be watched, for another thread to wake the loop (see Wakeup in SpscRing.hpp).
+class EventPoller {
+public:
+    typedef std::chrono::steady_clock::time_point timepoint;
+
+    bool open(int sockfd) {
+        this->sockfd = sockfd;
+#ifdef __linux__
+        epollfd = epoll_create1(0);
+        timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);   // steady_clock is CLOCK_MONOTONIC
+        if (epollfd < 0 || timerfd < 0) {
+            perror("epoll/timerfd creation failed");
+            return false;
+        }
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = timerfd;
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, timerfd, &ev);
+        ev.data.fd = sockfd;
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, sockfd, &ev);
+        watching_writable = false;
+        if (wakefd >= 0) addWakeFd();
+#endif
+        return true;
+    }
+
+    // Also return from wait() with POLL_WAKEUP while fd is readable. The caller drains fd.
+    bool watch(int fd) {
+        wakefd = fd;
+#ifdef __linux__
+        if (epollfd >= 0) addWakeFd();
+#endif
+        return true;
+    }
+
+    void close() {
+#ifdef __linux__
+        if (epollfd >= 0) ::close(epollfd);
+        if (timerfd >= 0) ::close(timerfd);
+        epollfd = -1;
+        timerfd = -1;
+#endif
+        sockfd = -1;
+        wakefd = -1;
+    }
+
+    // Returns a mask of POLL_READABLE / POLL_WRITABLE, or POLL_TIMEOUT once deadline has passed.
+    int wait(timepoint deadline, bool writable=false) {
+#ifdef __linux__
+        if (writable != watching_writable) {
+            epoll_event ev = {};
+            ev.events = writable ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+            ev.data.fd = sockfd;
+            epoll_ctl(epollfd, EPOLL_CTL_MOD, sockfd, &ev);
+            watching_writable = writable;
+        }
+        arm(deadline);
+        while (true) {
+            epoll_event events[3];
+            int n = epoll_wait(epollfd, events, 3, -1);
+            int mask = POLL_TIMEOUT;
+            bool expired = false;
+            for (int i = 0; i < n; i++) {
+                if (events[i].data.fd == timerfd) {
+                    uint64_t expirations;
+                    ssize_t r = read(timerfd, &expirations, sizeof(expirations));
+                    (void) r;
+                    expired = true;
+                } else if (events[i].data.fd == wakefd) {
+                    mask |= POLL_WAKEUP;
+                } else {
+                    if (events[i].events & (EPOLLIN | EPOLLERR)) mask |= POLL_READABLE;
+                    if (events[i].events & EPOLLOUT) mask |= POLL_WRITABLE;
+                }
+            }
+            if (mask != POLL_TIMEOUT || expired) {
+                if (!expired) disarm();
+                return mask;
+            }
+            // n < 0 (EINTR) or spurious wakeup, keep waiting for the same deadline
+        }
+#else
+        auto now = std::chrono::steady_clock::now();
+        auto wait_us = (deadline > now) ? std::chrono::duration_cast<std::chrono::microseconds>(deadline - now).count() : 0;
+        timeval tv = {(time_t) (wait_us / 1000000), (suseconds_t) (wait_us % 1000000)};
+        fd_set readfds, writefds;
+        FD_ZERO(&readfds);
+        FD_ZERO(&writefds);
+        FD_SET(sockfd, &readfds);
+        if (wakefd >= 0) FD_SET(wakefd, &readfds);
+        if (writable) FD_SET(sockfd, &writefds);
+        int ret = select(std::max(sockfd, wakefd)+1, &readfds, writable ? &writefds : nullptr, nullptr, &tv);
+        if (ret <= 0) return POLL_TIMEOUT;
+        int mask = POLL_TIMEOUT;
+        if (FD_ISSET(sockfd, &readfds)) mask |= POLL_READABLE;
+        if (wakefd >= 0 && FD_ISSET(wakefd, &readfds)) mask |= POLL_WAKEUP;
+        if (writable && FD_ISSET(sockfd, &writefds)) mask |= POLL_WRITABLE;
+        return mask;
+#endif
+    }
+
+    int wait(timeval timeout, bool writable=false) {
+        auto deadline = std::chrono::steady_clock::now() +
+            std::chrono::seconds(timeout.tv_sec) + std::chrono::microseconds(timeout.tv_usec);
+        return wait(deadline, writable);
+    }
+
+private:
+    int sockfd = -1;
+    int wakefd = -1;
+#ifdef __linux__
+    int epollfd = -1;
+    int timerfd = -1;
+    bool watching_writable = false;
+
+    void arm(timepoint deadline) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+        if (ns <= 0) ns = 1;    // 0 would disarm the timer, fire immediately instead
+        itimerspec spec = {};
+        spec.it_value.tv_sec = ns / 1000000000;
+        spec.it_value.tv_nsec = ns % 1000000000;
+        timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &spec, nullptr);
+    }
+    void addWakeFd() {
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = wakefd;
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, wakefd, &ev);
+    }
+    void disarm() {
+        itimerspec spec = {};
+        timerfd_settime(timerfd, 0, &spec, nullptr);
+    }
+#endif
+};
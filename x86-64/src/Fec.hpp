@@ -0,0 +1,293 @@
+#pragma once
+#include <stdint.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <arpa/inet.h>
+#include "GF256.hpp"
+#include "Protocol.hpp"
+#include "SlidingWindow.hpp"
+#include "PacketBuffers.hpp"
+
+// Forward error correction over groups of FEC data packets.
+//
+// Sequence numbers are split into groups of `data` packets starting at multiples of `data`. After the last
+// packet of a group the sender sends up to `parity` FLAG_PARITY packets, whose payloads are combinations of
+// the group's payloads over GF(256). The receiver can rebuild any missing packets from as many parity
+// packets, so isolated losses don't cost a NACK round trip.
+//
+// The code is systematic Reed-Solomon from a Cauchy matrix, with its columns scaled so the first parity
+// packet is the plain XOR of the group. With one parity packet per group this is simple XOR parity; more
+// parity packets correct bursts. Row j of the matrix doesn't depend on how many parity packets a group has,
+// so the sender can change that per group without telling the receiver.
+//
+// Only groups of full-size packets are protected. The final short packet, and its group, rely on ARQ alone,
+// as does the group cut short where sequence numbers wrap around (unless data divides 2^32).
+
+const int FEC_MAX_DATA = 128;       // data packets per group
+const int FEC_MAX_PARITY = 16;      // parity packets per group
+const int FEC_ADAPT_GROUPS = 32;    // adaptive parity: drop a parity packet after this many groups without loss
+const size_t FEC_MAX_SUMS_BYTES = 64 << 20;    // receiver: most memory it agrees to spend on running sums
+
+// Weight of data packet i in parity packet j: (x_0 + y_i) / (x_j + y_i) with x_j = 0x80 + j and y_i = i.
+// Any square submatrix of a Cauchy matrix is invertible, which is what makes every loss pattern of up to
+// `parity` packets recoverable. Row 0 is all ones.
+inline uint8_t fecCoefficient(int j, int i) {
+    return gf256::div(0x80 ^ i, (0x80 + j) ^ i);
+}
+
+// Parses the -fec value "N:K", false if it is malformed or out of range.
+inline bool parseFecRatio(const std::string& value, uint8_t& data, uint8_t& parity) {
+    int n = 0, k = 0;
+    if (sscanf(value.c_str(), "%d:%d", &n, &k) != 2) return false;
+    if (n < 1 || n > FEC_MAX_DATA || k < 1 || k > FEC_MAX_PARITY) return false;
+    data = n;
+    parity = k;
+    return true;
+}
+
+
+// Sender side: folds each data payload into the parity of its group as it is prepared.
+class FecEncoder {
+public:
+    // data == 0 turns FEC off. With adapt, each group gets between 0 and parity parity packets,
+    // one more after groups in which the receiver reported a loss, and one fewer after FEC_ADAPT_GROUPS without.
+    // payload_size is the negotiated payload size, which is what a full-size packet has.
+    void configure(int data, int parity, bool adapt, size_t payload_size=PAYLOAD_SIZE) {
+        this->data = data;
+        max_parity = parity;
+        this->adapt = adapt;
+        this->payload_size = payload_size;
+        group_parity = adapt ? std::min(1, parity) : parity;
+        packets.resize(max_parity);
+    }
+
+    bool enabled() {
+        return data > 0;
+    }
+
+    // Add data packet seq_num. True if it completed a group, whose parity packets are then ready to send.
+    bool add(uint32_t seq_num, const char* payload, size_t size) {
+        if (!enabled()) return false;
+        int i = seq_num % data;
+        if (i == 0) startGroup();
+        if (size != payload_size) group_valid = false;
+        if (!group_valid) return false;
+        for (int j = 0; j < group_parity; j++) {
+            gf256::mulAdd((uint8_t*) packets[j].data, (const uint8_t*) payload, fecCoefficient(j, i), size);
+        }
+        if (i != data - 1 || group_parity == 0) return false;
+
+        for (int j = 0; j < group_parity; j++) {
+            PacketHeader* header = &packets[j].header;
+            header->seq_num = htonl(seq_num - i);   // first packet of the group
+            header->window_size = htons(j);         // which parity row
+            header->control_flags = FLAG_PARITY;    // the checksum or CRC is added by sealPacket() as it is sent
+        }
+        return true;
+    }
+
+    Packet* parity() {
+        return packets.data();
+    }
+    // Parity packets are as long as a full-size data packet
+    size_t paritySize() {
+        return sizeof(PacketHeader) + payload_size;
+    }
+    int parityCount() {
+        return group_parity;
+    }
+
+    // The receiver reported count more missing packets that FEC didn't recover
+    void onLoss(uint32_t count) {
+        losses += count;
+    }
+
+private:
+    int data = 0;
+    int max_parity = 0;
+    int group_parity = 0;   // parity packets for the current group
+    bool adapt = false;
+    size_t payload_size = PAYLOAD_SIZE;
+    bool group_valid = false;
+    uint32_t losses = 0;    // since the last group started
+    int clean_groups = 0;
+    std::vector<Packet> packets;
+
+    void startGroup() {
+        if (adapt) {
+            if (losses > 0) {
+                group_parity = std::min(group_parity + 1, max_parity);
+                clean_groups = 0;
+            } else if (group_parity > 0 && ++clean_groups >= FEC_ADAPT_GROUPS) {
+                group_parity--;
+                clean_groups = 0;
+            }
+            losses = 0;
+        }
+        for (int j = 0; j < group_parity; j++) {
+            memset(packets[j].data, 0, payload_size);
+        }
+        group_valid = true;
+    }
+};
+
+
+// Receiver side. Packets delivered in order are gone from the SlidingWindow by the time a later packet of
+// their group turns out to be missing, so each group keeps running sums instead: for every parity row,
+// the parity payload plus the weighted payloads of the group's delivered packets. Recovery then only needs
+// the packets still sitting out of order in the window.
+//
+// Only the rows the sender has used so far are summed. A group starts summing as many rows as the highest
+// parity row seen before it, so the first group to get a new row can't use it. The sums are mapped like
+// PacketBuffers and only faulted in for the rows in use.
+class FecDecoder {
+public:
+    // Bytes of sums configure() maps for these parameters
+    static size_t sumsBytes(int data, int max_parity, size_t window_size, size_t payload_size) {
+        return (window_size / data + 2) * max_parity * payload_size;
+    }
+
+    // False if the sums can't be mapped, and FEC is then off
+    bool configure(int data, int max_parity, size_t window_size, size_t payload_size=PAYLOAD_SIZE) {
+        this->data = data;
+        this->max_parity = max_parity;
+        this->payload_size = payload_size;
+        active_rows = 0;
+        if (!enabled()) return true;
+        // Enough slots for every group that can overlap the window, so live groups never share one
+        groups.assign(window_size / data + 2, Group());
+        if (!sums.allocate(groups.size() * max_parity, payload_size)) {
+            this->data = 0;
+            return false;
+        }
+        syndromes.resize(max_parity * payload_size);
+        return true;
+    }
+
+    bool enabled() {
+        return data > 0;
+    }
+
+    uint32_t groupStart(uint32_t seq_num) {
+        return seq_num - seq_num % data;
+    }
+
+    // seq_num was delivered in order
+    void addDelivered(uint32_t seq_num, const char* payload, size_t size) {
+        Group& group = slot(groupStart(seq_num));
+        if (size != payload_size) return;
+        int i = seq_num - group.start;
+        for (int j = 0; j < group.rows; j++) {
+            gf256::mulAdd(sum(group, j), (const uint8_t*) payload, fecCoefficient(j, i), size);
+        }
+    }
+
+    // Parity row `index` for the group starting at group_start. expected_seq is the next in-order seq.
+    void addParity(uint32_t group_start, int index, const char* payload, uint32_t expected_seq) {
+        if (index >= max_parity || group_start % data != 0) return;
+        if (!seqBefore(expected_seq, group_start + data)) return;   // nothing left to recover
+        if (seqBefore(group_start, groupStart(expected_seq))) return;
+        active_rows = std::max(active_rows, index + 1);
+        Group& group = slot(group_start);
+        if (index >= group.rows) return;                    // the group started before this row was in use
+        if (group.parity_mask & (1u << index)) return;      // duplicate
+        gf256::mulAdd(sum(group, index), (const uint8_t*) payload, 1, payload_size);
+        group.parity_mask |= 1u << index;
+    }
+
+    // Rebuild the missing packets of seq_num's group into window if it has enough parity.
+    // Returns how many packets were recovered. WindowType is a SlidingWindow<Packet> or PacketWindow.
+    template<typename WindowType>
+    int recover(uint32_t seq_num, uint32_t expected_seq, WindowType& window) {
+        uint32_t start = groupStart(seq_num);
+        if (!seqBefore(expected_seq, start + data) || seqBefore(start, groupStart(expected_seq))) return 0;
+        Group& group = slot(start);
+        if (group.parity_mask == 0) return 0;
+
+        int missing[FEC_MAX_PARITY];
+        int num_missing = 0;
+        int num_parity = __builtin_popcount(group.parity_mask);
+        for (uint32_t s = seqMax(start, expected_seq); s != start + data; s++) {
+            if (!window.contains(s)) {
+                if (num_missing == num_parity) return 0;    // too many holes for now
+                missing[num_missing++] = s - start;
+            }
+        }
+        if (num_missing == 0) return 0;
+
+        // Syndromes: each chosen parity row's sum with the known packets taken out leaves
+        // a combination of the missing ones only
+        int rows[FEC_MAX_PARITY];
+        for (int j = 0, a = 0; a < num_missing; j++) {
+            if (group.parity_mask & (1u << j)) rows[a++] = j;
+        }
+        for (int a = 0; a < num_missing; a++) {
+            uint8_t* syndrome = &syndromes[a * payload_size];
+            memcpy(syndrome, sum(group, rows[a]), payload_size);
+            for (uint32_t s = seqMax(start, expected_seq); s != start + data; s++) {
+                Packet* packet = window.get(s);
+                if (packet) {
+                    gf256::mulAdd(syndrome, (const uint8_t*) packet->data, fecCoefficient(rows[a], s - start), payload_size);
+                }
+            }
+        }
+
+        uint8_t matrix[FEC_MAX_PARITY * FEC_MAX_PARITY];
+        for (int a = 0; a < num_missing; a++) {
+            for (int b = 0; b < num_missing; b++) {
+                matrix[a * num_missing + b] = fecCoefficient(rows[a], missing[b]);
+            }
+        }
+        if (!gf256::invert(matrix, num_missing)) return 0;
+
+        for (int b = 0; b < num_missing; b++) {
+            uint32_t s = start + missing[b];
+            Packet* packet = window.reserve(s);
+            if (!packet) return b;
+            packet->header.seq_num = htonl(s);
+            packet->header.control_flags = FLAG_DATA;
+            memset(packet->data, 0, payload_size);
+            for (int a = 0; a < num_missing; a++) {
+                gf256::mulAdd((uint8_t*) packet->data, &syndromes[a * payload_size], matrix[b * num_missing + a], payload_size);
+            }
+        }
+        return num_missing;
+    }
+
+private:
+    struct Group {
+        uint32_t start = UINT32_MAX;
+        uint32_t parity_mask = 0;   // parity rows received
+        int rows = 0;               // parity rows summed
+    };
+
+    int data = 0;
+    int max_parity = 0;
+    size_t payload_size = PAYLOAD_SIZE;
+    int active_rows = 0;                // parity rows new groups sum, one past the highest seen
+    std::vector<Group> groups;
+    PacketBuffers sums;                 // room for max_parity running sums per group slot
+    std::vector<uint8_t> syndromes;     // scratch for recover()
+
+    Group& slot(uint32_t start) {
+        size_t index = (start / data) % groups.size();
+        Group& group = groups[index];
+        if (group.start != start) {
+            group.start = start;
+            group.parity_mask = 0;
+            group.rows = active_rows;
+            for (int j = 0; j < active_rows; j++) {
+                memset(sum(group, j), 0, payload_size);
+            }
+        }
+        return group;
+    }
+    uint8_t* sum(Group& group, int row) {
+        size_t index = &group - groups.data();
+        return reinterpret_cast<uint8_t*>(sums[index * max_parity + row]);
+    }
+};
@@ -0,0 +1,78 @@
+#pragma once
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include "DataProcessing.hpp"
+#include "NetworkConnection.hpp"
+
+// Hands every frame payload from a connection to a DataProcessor, in arrival order.
+//
+// Unlike StreamReceiver there is no protocol: the HLS packetizer's frames carry no sequence numbers and
+// nothing is ACKed, so a lost frame is just counted by the connection (if it can tell) and skipped.
+template<typename DataProcessorType, typename NetworkConnectionType>
+class FrameReceiver {
+public:
+    FrameReceiver(DataProcessorType&& processor, NetworkConnectionType&& conn, size_t frame_size, bool debug=false)
+            : conn(std::move(conn)), processor(std::move(processor)), debug(debug),
+              storage(FRAME_BATCH_SIZE * frame_size), iov(FRAME_BATCH_SIZE), lengths(FRAME_BATCH_SIZE) {
+        static_assert(std::is_base_of<DataProcessor, DataProcessorType>::value, "type parameter of this class must derive from DataProcessor");
+        static_assert(std::is_base_of<NetworkConnection, NetworkConnectionType>::value, "type parameter of this class must derive from NetworkConnection");
+        for (size_t i = 0; i < FRAME_BATCH_SIZE; i++) {
+            iov[i].iov_base = &storage[i * frame_size];
+            iov[i].iov_len = frame_size;
+        }
+    }
+
+    // Receives until max_frames frames (0 for no limit), or until idle_ms pass without a frame after the first
+    int receiveStream(uint64_t max_frames, int idle_ms) {
+        using namespace std::chrono;
+        if (!conn.open()) return 1;
+        auto last_frame = steady_clock::now();
+        while (max_frames == 0 || frames < max_frames) {
+            size_t n = FRAME_BATCH_SIZE;
+            if (max_frames) n = std::min(n, (size_t) (max_frames - frames));
+            int received = conn.receiveBatch(iov.data(), lengths.data(), n);
+            if (received <= 0) {
+                if (frames > 0 && steady_clock::now() - last_frame >= milliseconds(idle_ms)) break;
+                conn.wait(steady_clock::now() + milliseconds(frames > 0 ? idle_ms : 1000));
+                continue;
+            }
+            if (frames == 0) start = steady_clock::now();
+            last_frame = steady_clock::now();
+            for (int i = 0; i < received; i++) {
+                processor.processData(lengths[i], (char*) iov[i].iov_base);
+                bytes += lengths[i];
+            }
+            frames += received;
+            if (debug) std::cout << "Received " << received << " frames, " << frames << " total" << std::endl;
+        }
+        elapsed = last_frame - start;
+        return 0;
+    }
+
+    int teardown() {
+        conn.close();
+        return 0;
+    }
+
+    void report() {
+        double seconds = std::chrono::duration<double>(elapsed).count();
+        double mbps = (seconds > 0) ? bytes * 8.0 / seconds / 1e6 : 0;
+        std::cout << "[STATISTICS] Throughput: " << mbps << " Mbps, Frames received: " << frames
+                  << " Bytes: " << bytes << std::endl;
+    }
+
+    NetworkConnectionType conn;
+    DataProcessorType processor;
+    uint64_t frames = 0;
+    uint64_t bytes = 0;
+
+private:
+    static const size_t FRAME_BATCH_SIZE = 64;
+    bool debug;
+    std::vector<char> storage;
+    std::vector<iovec> iov;
+    std::vector<ssize_t> lengths;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::duration elapsed{0};
+};
@@ -0,0 +1,203 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GF256_X86 1
+#endif
+
+// Arithmetic in GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11D), as used by Reed-Solomon FEC.
+// Addition is XOR. Single products go through log/exp tables.
+//
+// The hot path is mulAdd(), dst ^= c * src over a whole payload. It splits every source byte into nibbles
+// and looks both up in 16 entry product tables, which is one PSHUFB per nibble per 16 (SSSE3) or 32 (AVX2)
+// bytes. The widest version the CPU supports is picked once at runtime, so the binary still runs on
+// machines without AVX2, and on non-x86 builds only the table version exists.
+namespace gf256 {
+
+struct Tables {
+    uint8_t exp[512];   // doubled so exp[log a + log b] needs no modulo
+    uint8_t log[256];
+
+    Tables() {
+        int x = 1;
+        for (int i = 0; i < 255; i++) {
+            exp[i] = exp[i + 255] = x;
+            log[x] = i;
+            x <<= 1;
+            if (x & 0x100) x ^= 0x11D;
+        }
+        exp[510] = exp[511] = 0;
+        log[0] = 0;
+    }
+};
+
+inline const Tables& tables() {
+    static const Tables t;
+    return t;
+}
+
+inline uint8_t mul(uint8_t a, uint8_t b) {
+    if (a == 0 || b == 0) return 0;
+    const Tables& t = tables();
+    return t.exp[t.log[a] + t.log[b]];
+}
+
+inline uint8_t inv(uint8_t a) {
+    const Tables& t = tables();
+    return t.exp[255 - t.log[a]];   // a must not be 0
+}
+
+inline uint8_t div(uint8_t a, uint8_t b) {
+    return mul(a, inv(b));
+}
+
+// Products of c with every low nibble and every high nibble, the lookup tables for the SIMD versions
+inline void nibbleTables(uint8_t c, uint8_t lo[16], uint8_t hi[16]) {
+    for (int x = 0; x < 16; x++) {
+        lo[x] = mul(c, x);
+        hi[x] = mul(c, x << 4);
+    }
+}
+
+inline void mulAddScalar(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len) {
+    uint8_t row[256];
+    for (int x = 0; x < 256; x++) row[x] = mul(c, x);
+    for (size_t i = 0; i < len; i++) dst[i] ^= row[src[i]];
+}
+
+inline void xorScalar(uint8_t* dst, const uint8_t* src, size_t len) {
+    for (size_t i = 0; i < len; i++) dst[i] ^= src[i];
+}
+
+#ifdef GF256_X86
+__attribute__((target("ssse3")))
+inline void mulAddSSSE3(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len) {
+    uint8_t lo[16], hi[16];
+    nibbleTables(c, lo, hi);
+    __m128i tlo = _mm_loadu_si128((const __m128i*) lo);
+    __m128i thi = _mm_loadu_si128((const __m128i*) hi);
+    __m128i mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i s = _mm_loadu_si128((const __m128i*) (src + i));
+        __m128i l = _mm_shuffle_epi8(tlo, _mm_and_si128(s, mask));
+        __m128i h = _mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi64(s, 4), mask));
+        __m128i d = _mm_loadu_si128((const __m128i*) (dst + i));
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_xor_si128(d, _mm_xor_si128(l, h)));
+    }
+    for (; i < len; i++) dst[i] ^= lo[src[i] & 0x0f] ^ hi[src[i] >> 4];
+}
+
+__attribute__((target("avx2")))
+inline void mulAddAVX2(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len) {
+    uint8_t lo[16], hi[16];
+    nibbleTables(c, lo, hi);
+    __m256i tlo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) lo));
+    __m256i thi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) hi));
+    __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i s = _mm256_loadu_si256((const __m256i*) (src + i));
+        __m256i l = _mm256_shuffle_epi8(tlo, _mm256_and_si256(s, mask));
+        __m256i h = _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask));
+        __m256i d = _mm256_loadu_si256((const __m256i*) (dst + i));
+        _mm256_storeu_si256((__m256i*) (dst + i), _mm256_xor_si256(d, _mm256_xor_si256(l, h)));
+    }
+    for (; i < len; i++) dst[i] ^= lo[src[i] & 0x0f] ^ hi[src[i] >> 4];
+}
+
+// SSE2 is part of x86-64, so the XOR path needs no dispatch below AVX2
+inline void xorSSE2(uint8_t* dst, const uint8_t* src, size_t len) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i d = _mm_loadu_si128((const __m128i*) (dst + i));
+        __m128i s = _mm_loadu_si128((const __m128i*) (src + i));
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_xor_si128(d, s));
+    }
+    for (; i < len; i++) dst[i] ^= src[i];
+}
+
+__attribute__((target("avx2")))
+inline void xorAVX2(uint8_t* dst, const uint8_t* src, size_t len) {
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i d = _mm256_loadu_si256((const __m256i*) (dst + i));
+        __m256i s = _mm256_loadu_si256((const __m256i*) (src + i));
+        _mm256_storeu_si256((__m256i*) (dst + i), _mm256_xor_si256(d, s));
+    }
+    for (; i < len; i++) dst[i] ^= src[i];
+}
+#endif
+
+typedef void (*MulAddFn)(uint8_t*, const uint8_t*, uint8_t, size_t);
+typedef void (*XorFn)(uint8_t*, const uint8_t*, size_t);
+
+struct Dispatch {
+    MulAddFn mul_add = mulAddScalar;
+    XorFn xor_region = xorScalar;
+    const char* name = "scalar";
+
+    Dispatch() {
+#ifdef GF256_X86
+        __builtin_cpu_init();
+        xor_region = xorSSE2;
+        if (__builtin_cpu_supports("ssse3")) {
+            mul_add = mulAddSSSE3;
+            name = "ssse3";
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            mul_add = mulAddAVX2;
+            xor_region = xorAVX2;
+            name = "avx2";
+        }
+#endif
+    }
+};
+
+inline const Dispatch& dispatch() {
+    static const Dispatch d;
+    return d;
+}
+
+// dst ^= c * src, byte by byte
+inline void mulAdd(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len) {
+    if (c == 0) return;
+    if (c == 1) {
+        dispatch().xor_region(dst, src, len);
+    } else {
+        dispatch().mul_add(dst, src, c, len);
+    }
+}
+
+// Invert the n x n matrix m (row major) in place by Gauss-Jordan elimination. False if it is singular.
+inline bool invert(uint8_t* m, int n) {
+    uint8_t id[256];
+    for (int i = 0; i < n * n; i++) id[i] = (i / n == i % n);
+    for (int col = 0; col < n; col++) {
+        int pivot = col;
+        while (pivot < n && m[pivot * n + col] == 0) pivot++;
+        if (pivot == n) return false;
+        for (int k = 0; k < n; k++) {
+            uint8_t t = m[col * n + k]; m[col * n + k] = m[pivot * n + k]; m[pivot * n + k] = t;
+            t = id[col * n + k]; id[col * n + k] = id[pivot * n + k]; id[pivot * n + k] = t;
+        }
+        uint8_t scale = inv(m[col * n + col]);
+        for (int k = 0; k < n; k++) {
+            m[col * n + k] = mul(m[col * n + k], scale);
+            id[col * n + k] = mul(id[col * n + k], scale);
+        }
+        for (int row = 0; row < n; row++) {
+            uint8_t f = m[row * n + col];
+            if (row == col || f == 0) continue;
+            for (int k = 0; k < n; k++) {
+                m[row * n + k] ^= mul(f, m[col * n + k]);
+                id[row * n + k] ^= mul(f, id[col * n + k]);
+            }
+        }
+    }
+    for (int i = 0; i < n * n; i++) m[i] = id[i];
+    return true;
+}
+
+}  // namespace gf256
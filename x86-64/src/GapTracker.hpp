@@ -0,0 +1,119 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include "Protocol.hpp"
+
+// Which sequence numbers of a window have arrived: one bit per slot of the window's power of two ring
+// (bit seq_num & mask), and above that, one bit per 64-bit word for "all ones" and one for "any ones".
+//
+// nextMissing() and nextArrived() skip a whole word per summary bit and 4096 sequence numbers per summary
+// word, so walking the holes of a window costs about one step per hole instead of one per sequence number.
+// Marking an arrival is O(1). The caller clears what the window leaves behind, see PacketWindow.
+class GapTracker {
+public:
+    GapTracker(uint32_t capacity) :
+            capacity(capacity), bits(wordsFor(capacity)), full(wordsFor(bits.size())), any(wordsFor(bits.size())) {}
+
+    void set(uint32_t seq_num) {
+        size_t i = seq_num & (capacity - 1);
+        size_t w = i >> 6;
+        bits[w] |= 1ULL << (i & 63);
+        any[w >> 6] |= 1ULL << (w & 63);
+        if (bits[w] == ~0ULL) full[w >> 6] |= 1ULL << (w & 63);
+    }
+
+    inline bool test(uint32_t seq_num) {
+        size_t i = seq_num & (capacity - 1);
+        return (bits[i >> 6] >> (i & 63)) & 1;
+    }
+
+    void clear(uint32_t seq_num) {
+        size_t i = seq_num & (capacity - 1);
+        clearIndices(i, i + 1);
+    }
+
+    // Clears [from, to), of which only the last capacity can still be set
+    void clear(uint32_t from, uint32_t to) {
+        uint32_t n = std::min<uint32_t>(to - from, capacity);
+        size_t a = (to - n) & (capacity - 1);
+        size_t first = std::min<size_t>(n, capacity - a);
+        clearIndices(a, a + first);
+        clearIndices(0, n - first);
+    }
+
+    void reset() {
+        std::fill(bits.begin(), bits.end(), 0);
+        std::fill(full.begin(), full.end(), 0);
+        std::fill(any.begin(), any.end(), 0);
+    }
+
+    // First sequence number in [from, to) that hasn't arrived, or to if they all have.
+    // to - from must be at most capacity.
+    uint32_t nextMissing(uint32_t from, uint32_t to) { return next(from, to, true); }
+
+    // First sequence number in [from, to) that has arrived, or to if none has
+    uint32_t nextArrived(uint32_t from, uint32_t to) { return next(from, to, false); }
+
+private:
+    static const size_t NONE = SIZE_MAX;
+
+    static size_t wordsFor(size_t n) { return (n + 63) / 64; }
+
+    uint32_t next(uint32_t from, uint32_t to, bool missing) {
+        if (!seqBefore(from, to)) return to;
+        uint32_t n = to - from;
+        size_t a = from & (capacity - 1);
+        size_t first = std::min<size_t>(n, capacity - a);
+        size_t i = find(a, a + first, missing);
+        if (i != NONE) return from + (uint32_t) (i - a);
+        i = find(0, n - first, missing);
+        if (i != NONE) return from + (uint32_t) (first + i);
+        return to;
+    }
+
+    // First index in [a, b) whose bit is 0 (missing) or 1, NONE if there is none
+    size_t find(size_t a, size_t b, bool missing) {
+        if (a >= b) return NONE;
+        size_t w = a >> 6;
+        uint64_t word = (missing ? ~bits[w] : bits[w]) & (~0ULL << (a & 63));
+        while (!word) {
+            w = nextWord(w + 1, missing);
+            if (w == NONE || (w << 6) >= b) return NONE;
+            word = missing ? ~bits[w] : bits[w];
+        }
+        size_t i = (w << 6) + __builtin_ctzll(word);
+        return i < b ? i : NONE;
+    }
+
+    // First word from w on that isn't all ones (missing) or isn't all zeros
+    size_t nextWord(size_t w, bool missing) {
+        std::vector<uint64_t>& summary = missing ? full : any;
+        for (size_t s = w >> 6; s < summary.size(); s++) {
+            uint64_t word = missing ? ~summary[s] : summary[s];
+            if (s == (w >> 6)) word &= ~0ULL << (w & 63);
+            if (word) {
+                size_t found = (s << 6) + __builtin_ctzll(word);
+                return found < bits.size() ? found : NONE;
+            }
+        }
+        return NONE;
+    }
+
+    void clearIndices(size_t a, size_t b) {
+        while (a < b) {
+            size_t w = a >> 6;
+            size_t end = std::min(b, (w + 1) << 6);
+            uint64_t m = (end - a == 64) ? ~0ULL : (((1ULL << (end - a)) - 1) << (a & 63));
+            bits[w] &= ~m;
+            full[w >> 6] &= ~(1ULL << (w & 63));
+            if (bits[w] == 0) any[w >> 6] &= ~(1ULL << (w & 63));
+            a = end;
+        }
+    }
+
+    uint32_t capacity;
+    std::vector<uint64_t> bits;
+    std::vector<uint64_t> full;     // bit w: bits[w] is all ones
+    std::vector<uint64_t> any;      // bit w: bits[w] has a one
+};
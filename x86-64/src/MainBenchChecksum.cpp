@@ -0,0 +1,188 @@
+// Checksum microbenchmark: GB/s on one core for each checksum_partial() implementation the CPU has,
+// for checksum_copy() against a memcpy followed by a checksum, and for each CRC32C implementation
+// (CAP_CRC32C). Checks every implementation against the scalar one first, over odd and even lengths
+// at every alignment.
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include "Protocol.hpp"
+
+struct Impl {
+    const char* name;
+    csum::SumFn sum;
+    csum::CopySumFn copy_sum;
+};
+
+static std::vector<Impl> supported() {
+    std::vector<Impl> impls;
+    impls.push_back({"scalar", csum::sumScalar, csum::copySumScalar});
+#ifdef CHECKSUM_X86
+    __builtin_cpu_init();
+    impls.push_back({"sse2", csum::sumSSE2, csum::copySumSSE2});
+    if (__builtin_cpu_supports("avx2"))
+        impls.push_back({"avx2", csum::sumAVX2, csum::copySumAVX2});
+    if (__builtin_cpu_supports("avx512f"))
+        impls.push_back({"avx512", csum::sumAVX512, csum::copySumAVX512});
+#endif
+    return impls;
+}
+
+struct CrcImpl {
+    const char* name;
+    crc32c::ExtendFn extend;
+};
+
+static std::vector<CrcImpl> supportedCrc() {
+    std::vector<CrcImpl> impls;
+    impls.push_back({"scalar", crc32c::extendScalar});
+#ifdef CRC32C_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        impls.push_back({"sse4.2", crc32c::extendSSE42});
+        if (__builtin_cpu_supports("pclmul"))
+            impls.push_back({"sse4.2+pclmul", crc32c::extendSSE42Clmul});
+    }
+#endif
+    return impls;
+}
+
+static bool checkCrc(const std::vector<CrcImpl>& impls) {
+    std::vector<uint8_t> src(8192 + 64);
+    for (size_t i = 0; i < src.size(); i++) src[i] = rand();
+    bool ok = true;
+    for (const CrcImpl& impl : impls) {
+        if (~impl.extend(~0u, "123456789", 9) != 0xE3069283) {     // the standard check value
+            std::cerr << impl.name << " CRC32C of \"123456789\" is wrong" << std::endl;
+            ok = false;
+        }
+        for (size_t offset = 0; offset < 64 && ok; offset += 7) {
+            for (size_t len = 0; len <= 8192; len += (len < 300 ? 1 : 61)) {
+                if (impl.extend(~0u, &src[offset], len) != crc32c::extendScalar(~0u, &src[offset], len)) {
+                    std::cerr << impl.name << " CRC32C differs from scalar at offset " << offset << " length " << len << std::endl;
+                    ok = false;
+                    break;
+                }
+            }
+        }
+    }
+    return ok;
+}
+
+// The scalar loop's uint32_t overflows past 128 KB of 0xFF (far beyond any datagram), this reference doesn't
+static uint32_t sum64(const uint8_t* data, size_t len) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i + 1 < len; i += 2)
+        sum += csum::sumScalar(data + i, 2);
+    if (len & 1)
+        sum += data[len - 1];
+    return csum::foldTotal(sum);
+}
+
+// Same checksum after folding, which is all compute_checksum() and packet_checksum() look at
+static bool check(const std::vector<Impl>& impls) {
+    std::vector<uint8_t> src(4096 + 64), dst(src.size());
+    for (size_t i = 0; i < src.size(); i++) src[i] = rand();
+    // all 0xFF makes the lanes carry as much as they can, 2 MB is enough to flush them
+    std::vector<uint8_t> ones(1 << 21, 0xFF), ones_dst(ones.size());
+
+    bool ok = true;
+    for (const Impl& impl : impls) {
+        for (size_t offset = 0; offset < 64; offset++) {
+            for (size_t len = 0; len <= 2600; len += (len < 300 ? 1 : 97)) {
+                uint16_t want = checksum_finish(csum::sumScalar(&src[offset], len));
+                uint16_t got = checksum_finish(impl.sum(&src[offset], len));
+                std::memset(dst.data(), 0, dst.size());
+                uint16_t copied = checksum_finish(impl.copy_sum(&dst[offset], &src[offset], len));
+                if (got != want || copied != want || std::memcmp(&dst[offset], &src[offset], len) != 0) {
+                    std::cerr << impl.name << " differs from scalar at offset " << offset << " length " << len << std::endl;
+                    ok = false;
+                    break;
+                }
+            }
+        }
+        if (impl.sum == csum::sumScalar)
+            continue;
+        for (size_t len : {ones.size() - 1, ones.size()}) {
+            uint16_t want = checksum_finish(sum64(ones.data(), len));
+            if (checksum_finish(impl.sum(ones.data(), len)) != want ||
+                checksum_finish(impl.copy_sum(ones_dst.data(), ones.data(), len)) != want) {
+                std::cerr << impl.name << " differs from scalar on " << len << " bytes of 0xFF" << std::endl;
+                ok = false;
+            }
+        }
+    }
+    return ok;
+}
+
+// Sums or copies len byte buffers spread over 1 MB (stays in L2), returns GB/s
+template<typename F>
+static double rate(size_t len, double seconds, F f) {
+    const size_t span = 1 << 20;
+    size_t slots = span / len;
+    volatile uint32_t sink = 0;
+    uint64_t bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed;
+    do {
+        for (size_t i = 0; i < slots; i++)
+            sink = sink + f(i * len, len);
+        bytes += slots * len;
+        elapsed = std::chrono::steady_clock::now() - start;
+    } while (elapsed.count() < seconds);
+    (void) sink;
+    return bytes / elapsed.count() / 1e9;
+}
+
+int main(int argc, char* argv[]) {
+    double seconds = 0.5;
+    std::vector<size_t> lengths = {(size_t) DATA_PACKET_SIZE, (size_t) PAYLOAD_SIZE, HEADER_SIZE, 64, 1499};
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-len") && i + 1 < argc) {
+            lengths = {(size_t) atoi(argv[++i])};
+        } else {
+            std::cout << "Usage: " << argv[0] << " [-t seconds per measurement] [-len bytes]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<Impl> impls = supported();
+    std::vector<CrcImpl> crc_impls = supportedCrc();
+    if (!check(impls) || !checkCrc(crc_impls))
+        return 1;
+    std::cout << "all implementations match scalar, checksum_partial() uses " << csum::dispatch().name
+              << ", CRC32C uses " << crc32c::dispatch().name << std::endl;
+
+    std::vector<uint8_t> src((1 << 20) + 64), dst(src.size());
+    for (size_t i = 0; i < src.size(); i++) src[i] = rand();
+
+    std::cout << std::left << std::setw(8) << "impl" << std::setw(8) << "bytes"
+              << std::setw(12) << "sum GB/s" << std::setw(14) << "copy+sum GB/s" << " memcpy+sum GB/s" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+    for (size_t len : lengths) {
+        for (const Impl& impl : impls) {
+            double sum = rate(len, seconds, [&](size_t off, size_t n) { return impl.sum(&src[off], n); });
+            double fused = rate(len, seconds, [&](size_t off, size_t n) { return impl.copy_sum(&dst[off], &src[off], n); });
+            double separate = rate(len, seconds, [&](size_t off, size_t n) {
+                std::memcpy(&dst[off], &src[off], n);
+                return impl.sum(&dst[off], n);
+            });
+            std::cout << std::setw(8) << impl.name << std::setw(8) << len
+                      << std::setw(12) << sum << std::setw(14) << fused << " " << separate << std::endl;
+        }
+    }
+
+    std::cout << std::endl << std::setw(16) << "crc32c" << std::setw(8) << "bytes" << "GB/s" << std::endl;
+    for (size_t len : lengths) {
+        for (const CrcImpl& impl : crc_impls) {
+            double crc = rate(len, seconds, [&](size_t off, size_t n) { return impl.extend(~0u, &src[off], n); });
+            std::cout << std::setw(16) << impl.name << std::setw(8) << len << crc << std::endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,295 @@
+// Window trace benchmark: replays arrival orders through every window the receiver could keep its out-of-order
+// packets in, with the receiver's logic (deliver expected_seq and whatever follows it from the window, store
+// anything newer that isn't there yet, ignore the rest), and prints ns per arriving packet and the most memory it had resident.
+//
+// The DataWindow implementations (PacketMap, PacketHashMap, PacketRing) copy each packet in, through the
+// virtual interface. "sliding" is a SlidingWindow of pointers into PacketBuffers, which copies too, and
+// "packet" is the receiver's PacketWindow, which adopts the receive buffer instead.
+//
+// Traces are generated from a sender with the same window that retransmits a lost packet an RTT later and
+// delays some to reorder them; -save writes them out, -trace replays one recorded elsewhere, e.g. the seqs
+// of a Receiver --debug log. Each implementation runs in a child process so resident memory is its own.
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <memory>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "DataWindow.hpp"
+#include "SlidingWindow.hpp"
+
+struct Trace {
+    std::string name;
+    std::vector<uint32_t> arrivals;
+};
+
+// n packets from isn on, each transmission lost with probability loss (and sent again rtt transmissions
+// later) or, with probability reorder, held back 1 to 8 transmissions. The sender stays window packets
+// ahead of the oldest one not yet through, like StreamSender.
+static Trace makeTrace(const char* name, uint32_t isn, size_t n, size_t window_size, double loss, double reorder, size_t rtt) {
+    Trace trace;
+    trace.name = name;
+    std::vector<bool> through(n);
+    std::deque<std::pair<size_t, uint32_t>> retransmits;     // when, seq
+    std::vector<std::pair<size_t, uint32_t>> arrivals;        // when, seq
+    size_t next = 0, oldest = 0;
+    for (size_t now = 0; oldest < n; now++) {
+        size_t seq;
+        if (!retransmits.empty() && retransmits.front().first <= now) {
+            seq = retransmits.front().second;
+            retransmits.pop_front();
+        } else if (next < n && next - oldest < window_size - 8) {
+            seq = next++;
+        } else {
+            continue;
+        }
+        if (rand() < loss * RAND_MAX) {
+            retransmits.push_back(std::make_pair(now + rtt, seq));
+            continue;
+        }
+        size_t delay = rand() < reorder * RAND_MAX ? 1 + rand() % 8 : 0;
+        arrivals.push_back(std::make_pair(now + delay, seq));
+        through[seq] = true;
+        while (oldest < n && through[oldest]) oldest++;
+    }
+    std::stable_sort(arrivals.begin(), arrivals.end(),
+        [](const std::pair<size_t, uint32_t>& a, const std::pair<size_t, uint32_t>& b) { return a.first < b.first; });
+    for (auto& arrival : arrivals) trace.arrivals.push_back(isn + arrival.second);
+    return trace;
+}
+
+static bool loadTrace(const char* path, Trace& trace) {
+    std::ifstream file(path);
+    if (!file) {
+        perror(path);
+        return false;
+    }
+    trace.name = path;
+    trace.name = trace.name.substr(trace.name.rfind('/') + 1);
+    uint32_t seq;
+    while (file >> seq) trace.arrivals.push_back(seq);
+    return !trace.arrivals.empty();
+}
+
+static void saveTrace(const std::string& dir, const Trace& trace) {
+    std::ofstream file(dir + "/" + trace.name + ".txt");
+    for (uint32_t seq : trace.arrivals) file << seq << "\n";
+}
+
+static size_t residentKB() {
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    size_t size = 0, resident = 0;
+    if (fscanf(f, "%zu %zu", &size, &resident) != 2) resident = 0;
+    fclose(f);
+    return resident * sysconf(_SC_PAGESIZE) / 1024;
+}
+
+// Any DataWindow<Packet>, called through the interface. Packets are received into one buffer and copied in.
+struct DataWindowStore {
+    std::unique_ptr<DataWindow<Packet>> window;
+    Packet received;
+
+    DataWindowStore(DataWindow<Packet>* window) : window(window) {}
+    Packet* receiveBuffer() { return &received; }
+    bool contains(uint32_t seq_num) { return window->contains(seq_num); }
+    bool store(uint32_t seq_num, size_t size) {
+        Packet* packet = window->reserve(seq_num);
+        if (!packet) return false;
+        memcpy(packet, &received, size);
+        return true;
+    }
+    Packet* get(uint32_t seq_num) { return window->get(seq_num); }
+    void erase(uint32_t seq_num) { window->erase(seq_num); }
+    void advanceTo(uint32_t) {}
+    void clear(uint32_t) { window->clear(); }
+};
+
+struct SlidingStore {
+    SlidingWindow<Packet*> window;
+    PacketBuffers buffers;
+    Packet received;
+
+    SlidingStore(size_t window_size, size_t packet_size) : window(window_size) {
+        buffers.allocate(window.capacity(), packet_size);
+        for (uint32_t i = 0; i < window.capacity(); i++) window.slot(i) = buffers[i];
+    }
+    Packet* receiveBuffer() { return &received; }
+    bool contains(uint32_t seq_num) { return window.contains(seq_num); }
+    bool store(uint32_t seq_num, size_t size) {
+        Packet** packet = window.reserve(seq_num);
+        if (!packet) return false;
+        memcpy(*packet, &received, size);
+        return true;
+    }
+    Packet* get(uint32_t seq_num) {
+        Packet** packet = window.get(seq_num);
+        return packet ? *packet : nullptr;
+    }
+    void erase(uint32_t seq_num) { window.erase(seq_num); }
+    void advanceTo(uint32_t seq_num) { window.advanceTo(seq_num); }
+    void clear(uint32_t seq_num) { window.clear(seq_num); }
+};
+
+// The receive buffer goes into the window, and the slot's old buffer is where the next packet lands
+struct PacketWindowStore {
+    PacketWindow window;
+    Packet receive_buffer;      // the batch's buffer, which may end up in the window
+    Packet* spare = &receive_buffer;
+
+    PacketWindowStore(size_t window_size, size_t packet_size) : window(window_size) {
+        window.allocate(packet_size);
+    }
+    Packet* receiveBuffer() { return spare; }
+    bool contains(uint32_t seq_num) { return window.contains(seq_num); }
+    bool store(uint32_t seq_num, size_t) {
+        Packet* old = window.adopt(seq_num, spare);
+        if (!old) return false;
+        spare = old;
+        return true;
+    }
+    Packet* get(uint32_t seq_num) { return window.get(seq_num); }
+    void erase(uint32_t) {}
+    void advanceTo(uint32_t seq_num) { window.advanceTo(seq_num); }
+    void clear(uint32_t seq_num) { window.clear(seq_num); }
+};
+
+// One pass of the receiver over the trace, with each packet written to the receive buffer as recvmmsg() would.
+// Returns how many packets were delivered.
+template<typename Store>
+static size_t replay(Store& store, const Trace& trace, const Packet* datagram, size_t packet_size) {
+    uint32_t expected = trace.arrivals.front();
+    for (uint32_t seq : trace.arrivals) expected = seqMin(expected, seq);
+    store.clear(expected);
+    size_t delivered = 0;
+    for (uint32_t seq : trace.arrivals) {
+        Packet* received = store.receiveBuffer();
+        memcpy(received, datagram, packet_size);
+        received->header.seq_num = htonl(seq);
+        if (seq == expected) {
+            delivered++;
+            expected++;
+            for (Packet* packet = store.get(expected); packet; packet = store.get(expected)) {
+                delivered += packet->header.seq_num == htonl(expected);
+                store.erase(expected);
+                expected++;
+            }
+            store.advanceTo(expected);
+        } else if (seqBefore(expected, seq) && !store.contains(seq)) {
+            store.store(seq, packet_size);
+        }
+    }
+    return delivered;
+}
+
+static size_t peakKB() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+template<typename Store>
+static void run(const char* name, Store* store, const Trace& trace, size_t packet_size, double seconds, size_t before) {
+    Packet* datagram = static_cast<Packet*>(calloc(1, sizeof(Packet)));
+    size_t delivered = replay(*store, trace, datagram, packet_size);
+    size_t peak = peakKB();
+    uint64_t ops = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed;
+    do {
+        replay(*store, trace, datagram, packet_size);
+        ops += trace.arrivals.size();
+        elapsed = std::chrono::steady_clock::now() - start;
+    } while (elapsed.count() < seconds);
+    std::cout << std::setw(22) << trace.name << std::setw(10) << name << std::setw(12) << elapsed.count() * 1e9 / ops
+              << std::setw(14) << (peak > before ? peak - before : 0) << delivered << std::endl;
+    delete store;
+    free(datagram);
+}
+
+// Runs one implementation in a child, so the memory it touched doesn't count for the next one
+template<typename Make>
+static void measure(const char* name, Make make, const Trace& trace, size_t packet_size, double seconds) {
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return;
+    }
+    if (pid == 0) {
+        size_t before = residentKB();
+        run(name, make(), trace, packet_size, seconds, before);
+        std::cout.flush();
+        _exit(0);
+    }
+    waitpid(pid, nullptr, 0);
+}
+
+int main(int argc, char* argv[]) {
+    double seconds = 0.5;
+    size_t payload = PAYLOAD_SIZE;
+    size_t window_size = WINDOW_SIZE;
+    size_t packets = 200000;
+    size_t rtt = 1000;
+    std::vector<Trace> traces;
+    std::string save_dir;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-payload") && i + 1 < argc) {
+            payload = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-window") && i + 1 < argc) {
+            window_size = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-packets") && i + 1 < argc) {
+            packets = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-rtt") && i + 1 < argc) {
+            rtt = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-trace") && i + 1 < argc) {
+            Trace trace;
+            if (!loadTrace(argv[++i], trace)) return 1;
+            traces.push_back(trace);
+        } else if (!strcmp(argv[i], "-save") && i + 1 < argc) {
+            save_dir = argv[++i];
+        } else {
+            std::cout << "Usage: " << argv[0] << " [-t seconds per measurement] [-payload bytes] [-window packets]"
+                      << " [-packets per trace] [-rtt packets] [-trace seqs.txt]... [-save dir]" << std::endl;
+            return 1;
+        }
+    }
+    if (window_size < 16 || window_size > (size_t) MAX_WINDOW_SIZE) {
+        std::cerr << "Bad -window " << window_size << ", expected 16 to " << MAX_WINDOW_SIZE << " packets" << std::endl;
+        return 1;
+    }
+    if (traces.empty()) {
+        uint32_t isn = 0xFFFFFFFF - packets / 2;     // across the wrap
+        traces.push_back(makeTrace("in_order", isn, packets, window_size, 0, 0, rtt));
+        traces.push_back(makeTrace("reorder_5%", isn, packets, window_size, 0, 0.05, rtt));
+        traces.push_back(makeTrace("loss_1%", isn, packets, window_size, 0.01, 0, rtt));
+        traces.push_back(makeTrace("loss_10%", isn, packets, window_size, 0.1, 0.05, rtt));
+    }
+    if (!save_dir.empty()) {
+        for (const Trace& trace : traces) saveTrace(save_dir, trace);
+    }
+
+    size_t packet_size = HEADER_SIZE + payload;
+    std::cout << "window " << window_size << ", " << packet_size << " byte packets" << std::endl;
+    std::cout << std::left << std::fixed << std::setprecision(2);
+    std::cout << std::setw(22) << "trace" << std::setw(10) << "window" << std::setw(12) << "ns/packet"
+              << std::setw(14) << "peak KB" << "delivered" << std::endl;
+    for (const Trace& trace : traces) {
+        measure("map", [&]() { return new DataWindowStore(new PacketMap<Packet>(window_size)); }, trace, packet_size, seconds);
+        measure("hash", [&]() { return new DataWindowStore(new PacketHashMap<Packet>(window_size)); }, trace, packet_size, seconds);
+        measure("ring", [&]() { return new DataWindowStore(new PacketRing<Packet>(window_size)); }, trace, packet_size, seconds);
+        measure("sliding", [&]() { return new SlidingStore(window_size, packet_size); }, trace, packet_size, seconds);
+        measure("packet", [&]() { return new PacketWindowStore(window_size, packet_size); }, trace, packet_size, seconds);
+    }
+    return 0;
+}
@@ -0,0 +1,331 @@
+// Policy benchmark: what debug tracing, statistics and checksum verification cost per packet. A StreamReceiver
+// and a StreamSender of each policy (see Policies.hpp) run a whole stream over an in-memory connection in this
+// thread, so everything measured is their own per-packet work: the receiver gets prebuilt in-order DATA packets
+// and a FIN, the sender gets a cumulative ACK for everything it sent whenever it looks for one.
+//
+// Prints ns per packet and, where the kernel exposes the PMU (perf_event_open), instructions per packet.
+// Without it, -run one policy and side and count instructions from outside, at two -packets counts.
+// Debug output goes to a null stream, so Tracing pays for formatting but not for a terminal.
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#include "StreamSender.hpp"
+#include "StreamReceiver.hpp"
+#include "DummyData.hpp"
+
+const size_t STRIDE = HEADER_SIZE + PAYLOAD_SIZE;
+
+// Feeds a StreamReceiver: a bare HANDSHAKE, then the packets in order, then the final ACK of the FIN exchange
+class ReceiverLoop : public NetworkConnection {
+public:
+    ReceiverLoop(const std::vector<char>* stream, const std::vector<ssize_t>* lengths) :
+            stream(stream), lengths(lengths) {}
+
+    bool open() override { return true; }
+    bool close() override { return true; }
+    bool ready(timeval) override { return true; }
+    int wait(std::chrono::steady_clock::time_point, bool writable=false) override {
+        return writable ? (POLL_READABLE | POLL_WRITABLE) : POLL_READABLE;
+    }
+    ssize_t send(void*, size_t len) override { return len; }
+
+    ssize_t receive(void* buffer, size_t len) override {
+        if (!handshaken) {
+            handshaken = true;
+            memcpy(buffer, HANDSHAKE, HANDSHAKE_SIZE);
+            return HANDSHAKE_SIZE;
+        }
+        ControlPacket ack = {};
+        ack.header.control_flags = FLAG_ACK;
+        size_t ack_len = sealPacket(&ack, CTRL_PACKET_SIZE, false);
+        memcpy(buffer, &ack, std::min(len, sizeof(ack)));
+        return ack_len;
+    }
+
+    int receiveBatch(iovec* buffers, ssize_t* received, size_t n) override {
+        size_t i = 0;
+        for (; i < n && next < lengths->size(); i++, next++) {
+            memcpy(buffers[i].iov_base, &(*stream)[next * STRIDE], (*lengths)[next]);
+            received[i] = (*lengths)[next];
+        }
+        return i > 0 ? (int) i : -1;
+    }
+
+private:
+    const std::vector<char>* stream;     // packet i at i * STRIDE
+    const std::vector<ssize_t>* lengths;
+    size_t next = 0;
+    bool handshaken = false;
+};
+
+// Answers a StreamSender: the negotiation packet, a cumulative ACK for every DATA packet sent so far, FIN-ACK for FIN
+class SenderLoop : public NetworkConnection {
+public:
+    bool open() override { return true; }
+    bool close() override { return true; }
+    bool ready(timeval) override { return true; }
+    int wait(std::chrono::steady_clock::time_point, bool writable=false) override {
+        return writable ? (POLL_READABLE | POLL_WRITABLE) : POLL_READABLE;
+    }
+
+    ssize_t send(void* packet, size_t len) override {
+        if (len >= HANDSHAKE_SIZE && !memcmp(packet, HANDSHAKE, HANDSHAKE_SIZE)) {
+            negotiate = true;
+            return len;
+        }
+        if (len >= (size_t) HEADER_SIZE) {
+            PacketHeader* header = static_cast<PacketHeader*>(packet);
+            if (header->control_flags == FLAG_DATA) {
+                uint32_t seq_num = ntohl(header->seq_num) + 1;
+                highest = sent ? seqMax(highest, seq_num) : seq_num;
+                sent = true;
+            } else if (header->control_flags == FLAG_FIN) {
+                fin = true;
+            }
+        }
+        return len;
+    }
+
+    ssize_t receive(void* buffer, size_t len) override {
+        if (negotiate) {
+            // The bare negotiation packet: no capabilities, PAYLOAD_SIZE payloads
+            negotiate = false;
+            uint16_t reply[2] = {htons(1024), htons(HEADER_SIZE + PAYLOAD_SIZE)};
+            memcpy(buffer, reply, NEGOTIATION_SIZE);
+            return NEGOTIATION_SIZE;
+        }
+        if (!fin && (!sent || highest == acked)) return -1;
+        ControlPacket ack = {};
+        ack.header.seq_num = htonl(highest);
+        ack.header.window_size = htons(WINDOW_SIZE);
+        ack.header.control_flags = fin ? FLAG_FIN_ACK : FLAG_ACK;
+        size_t ack_len = sealPacket(&ack, CTRL_PACKET_SIZE, false);
+        memcpy(buffer, &ack, std::min(len, sizeof(ack)));
+        acked = highest;
+        fin = false;
+        return ack_len;
+    }
+
+private:
+    bool negotiate = false;
+    bool sent = false;
+    bool fin = false;
+    uint32_t highest = 0;
+    uint32_t acked = 0;
+};
+
+// Counts the instructions this process retires in user space, if the kernel lets it
+class InstructionCounter {
+public:
+    InstructionCounter() {
+#ifdef __linux__
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+    ~InstructionCounter() {
+        if (fd >= 0) ::close(fd);
+    }
+    bool available() { return fd >= 0; }
+    void start() {
+#ifdef __linux__
+        if (fd < 0) return;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+    }
+    uint64_t stop() {
+        uint64_t count = 0;
+#ifdef __linux__
+        if (fd < 0) return 0;
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) != sizeof(count)) count = 0;
+#endif
+        return count;
+    }
+
+private:
+    int fd = -1;
+};
+
+struct Result {
+    double ns;              // per packet
+    double instructions;    // per packet, 0 if they couldn't be counted
+};
+
+// n DATA packets from 0 on, as a sender with the default payload would seal them, then its FIN
+static void makeStream(size_t n, std::vector<char>& stream, std::vector<ssize_t>& lengths) {
+    stream.resize((n + 1) * STRIDE);
+    lengths.resize(n + 1);
+    for (size_t i = 0; i <= n; i++) {
+        Packet* packet = reinterpret_cast<Packet*>(&stream[i * STRIDE]);
+        packet->header.seq_num = htonl(i);
+        packet->header.window_size = htons(WINDOW_SIZE);
+        packet->header.control_flags = (i < n) ? FLAG_DATA : FLAG_FIN;
+        memset(packet->data, 'A' + i % 26, PAYLOAD_SIZE);
+        lengths[i] = sealPacket(packet, (i < n) ? HEADER_SIZE + PAYLOAD_SIZE : CTRL_PACKET_SIZE, false);
+    }
+}
+
+template<typename Policy>
+static Result runReceiver(size_t n, InstructionCounter& counter) {
+    std::vector<char> stream;
+    std::vector<ssize_t> lengths;
+    makeStream(n, stream, lengths);
+    StreamReceiver<DummyProcessor, ReceiverLoop, Policy> receiver(
+        DummyProcessor(false), ReceiverLoop(&stream, &lengths), WINDOW_SIZE
+    );
+    auto start = std::chrono::steady_clock::now();
+    counter.start();
+    receiver.receiveData();
+    receiver.teardown();
+    uint64_t instructions = counter.stop();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return {elapsed.count() * 1e9 / n, (double) instructions / n};
+}
+
+template<typename Policy>
+static Result runSender(size_t n, InstructionCounter& counter) {
+    SenderOptions options;
+    options.gso = false;
+    StreamSender<DummyProvider, SenderLoop, Policy> sender(
+        DummyProvider(n, true), SenderLoop(), WINDOW_SIZE, false, options
+    );
+    auto start = std::chrono::steady_clock::now();
+    counter.start();
+    sender.stream();
+    sender.teardown();
+    uint64_t instructions = counter.stop();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return {elapsed.count() * 1e9 / n, (double) instructions / n};
+}
+
+template<typename Policy>
+static Result run(bool sender, size_t n) {
+    // Traces and statistics still get formatted, they just go nowhere
+    std::ofstream null("/dev/null");
+    std::streambuf* out = std::cout.rdbuf(null.rdbuf());
+    InstructionCounter counter;
+    Result result = sender ? runSender<Policy>(n, counter) : runReceiver<Policy>(n, counter);
+    if (!counter.available()) result.instructions = 0;
+    std::cout.rdbuf(out);
+    return result;
+}
+
+template<typename Policy>
+static Result measure(bool sender, size_t n) {
+    // In a child, so every policy starts from the same heap and nothing of the last one is in cache
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        return Result();
+    }
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return Result();
+    }
+    if (pid == 0) {
+        ::close(fds[0]);
+        run<Policy>(sender, n / 10);     // warm up
+        Result result = run<Policy>(sender, n);
+        if (write(fds[1], &result, sizeof(result)) != sizeof(result)) perror("write");
+        _exit(0);
+    }
+    ::close(fds[1]);
+    Result result;
+    if (read(fds[0], &result, sizeof(result)) != sizeof(result)) result = Result();
+    ::close(fds[0]);
+    waitpid(pid, nullptr, 0);
+    return result;
+}
+
+static void printCell(double value) {
+    if (value > 0) {
+        std::cout << std::setw(12) << value;
+    } else {
+        std::cout << std::setw(12) << "n/a";
+    }
+}
+
+template<typename Policy>
+static void row(const char* name, size_t n) {
+    Result receiver = measure<Policy>(false, n);
+    Result sender = measure<Policy>(true, n);
+    std::cout << std::setw(10) << name;
+    printCell(receiver.ns);
+    printCell(receiver.instructions);
+    printCell(sender.ns);
+    printCell(sender.instructions);
+    std::cout << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    size_t packets = 20000;
+    std::string policy, side;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-packets") && i + 1 < argc) {
+            packets = strtoul(argv[++i], nullptr, 0);
+        } else if (!strcmp(argv[i], "-run") && i + 2 < argc) {
+            policy = argv[++i];
+            side = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [-packets n] [-run debug|default|lean sender|receiver]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (packets == 0) {
+        std::cerr << "-packets must be at least 1" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (!policy.empty()) {
+        // One stream in this process and nothing else, for an instruction count taken from outside
+        bool sender = (side == "sender");
+        if (!sender && side != "receiver") {
+            std::cerr << "Unknown side " << side << std::endl;
+            return EXIT_FAILURE;
+        }
+        Result result;
+        if (policy == "debug") {
+            result = run<DebugPolicy>(sender, packets);
+        } else if (policy == "default") {
+            result = run<DefaultPolicy>(sender, packets);
+        } else if (policy == "lean") {
+            result = run<LeanPolicy>(sender, packets);
+        } else {
+            std::cerr << "Unknown policy " << policy << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::cout << policy << " " << side << ": " << result.ns << " ns/packet" << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+    std::cout << "Streams of " << packets << " packets of " << PAYLOAD_SIZE << " bytes, per packet" << std::endl;
+    std::cout << std::setw(10) << "policy" << std::setw(12) << "recv ns" << std::setw(12) << "recv instr"
+              << std::setw(12) << "send ns" << std::setw(12) << "send instr" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    row<DebugPolicy>("debug", packets);
+    row<DefaultPolicy>("default", packets);
+    row<LeanPolicy>("lean", packets);
+    return EXIT_SUCCESS;
+}
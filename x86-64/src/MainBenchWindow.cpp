@@ -0,0 +1,349 @@
+// SlidingWindow microbenchmark: how long a sender window (SlidingWindow<PacketInfo> and its PacketBuffers)
+// takes to set up and how much of it is resident, then ns per contains()/get() at random and per packet of
+// a streaming pass (reserve, get, erase, advance). Each is compared against the layout the window used to
+// have, with every Packet inline in its slot ahead of the slot's sequence number and slots found with %.
+// Last, the receiver's NACK scan: separate windows of NACK and ACK times, the packed ReceiverSlot checking
+// every sequence number, and the packed slot walking only the holes the GapTracker finds.
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include "SlidingWindow.hpp"
+#include "StreamSender.hpp"
+
+// The previous SlidingWindow, kept here for comparison only
+struct InlineInfo {
+    Packet packet;
+    size_t data_size;
+    size_t wire_size;
+    bool retried = false;
+    std::chrono::steady_clock::time_point first_sent;
+    std::chrono::steady_clock::time_point last_sent;
+    uint32_t prev_seq = 0;
+    uint32_t next_seq = 0;
+    bool queued = false;
+};
+
+class InlineWindow {
+public:
+    InlineWindow(size_t window_size) : window_size(window_size), arr(window_size) { clear(); }
+
+    InlineInfo* reserve(uint32_t seq_num) {
+        if (!inBounds(seq_num)) return nullptr;
+        NumberedPacket& packet = arr[indexOf(seq_num)];
+        packet.seq_num = seq_num;
+        return &packet.packet;
+    }
+    bool contains(uint32_t seq_num) {
+        return inBounds(seq_num) && arr[indexOf(seq_num)].seq_num == seq_num;
+    }
+    InlineInfo* get(uint32_t seq_num) {
+        if (!inBounds(seq_num)) return nullptr;
+        NumberedPacket& packet = arr[indexOf(seq_num)];
+        return packet.seq_num == seq_num ? &packet.packet : nullptr;
+    }
+    bool erase(uint32_t seq_num) {
+        if (!inBounds(seq_num)) return false;
+        arr[indexOf(seq_num)].seq_num = seq_num - window_size;
+        return true;
+    }
+    bool advanceTo(uint32_t seq_num) {
+        if (!seqBefore(base_seq, seq_num)) return false;
+        uint32_t passed = std::min<uint32_t>(seq_num - base_seq, window_size);
+        for (uint32_t i = 0; i < passed; i++) {
+            arr[(base + i) % window_size].seq_num = base_seq + i;
+        }
+        base = indexOf(seq_num);
+        base_seq = seq_num;
+        return true;
+    }
+    void clear(uint32_t seq_num=0) {
+        base = 0;
+        base_seq = seq_num;
+        for (size_t i = 0; i < window_size; i++) {
+            arr[i].seq_num = seq_num + i - window_size;
+        }
+    }
+    bool inBounds(uint32_t seq_num) { return seq_num - base_seq < window_size; }
+
+private:
+    struct NumberedPacket {
+        InlineInfo packet;
+        uint32_t seq_num;
+    };
+    size_t indexOf(uint32_t seq_num) { return (base + (size_t) (seq_num - base_seq)) % window_size; }
+
+    size_t base = 0;
+    uint32_t base_seq = 0;
+    size_t window_size;
+    std::vector<NumberedPacket> arr;
+};
+
+// What the sender sets up: the window, then (after the handshake) its buffers
+struct RingWindow {
+    SlidingWindow<PacketInfo> window;
+    PacketBuffers buffers;
+
+    RingWindow(size_t window_size, size_t packet_size) : window(window_size) {
+        buffers.allocate(window.capacity(), packet_size);
+        for (uint32_t i = 0; i < window.capacity(); i++) {
+            window.slot(i).packet = buffers[i];
+        }
+    }
+    bool contains(uint32_t seq_num) { return window.contains(seq_num); }
+    PacketInfo* get(uint32_t seq_num) { return window.get(seq_num); }
+    PacketInfo* reserve(uint32_t seq_num) { return window.reserve(seq_num); }
+    bool erase(uint32_t seq_num) { return window.erase(seq_num); }
+    bool advanceTo(uint32_t seq_num) { return window.advanceTo(seq_num); }
+    Packet* packetOf(PacketInfo* info) { return info->packet; }
+};
+
+struct InlineRingWindow : InlineWindow {
+    InlineRingWindow(size_t window_size, size_t) : InlineWindow(window_size) {}
+    Packet* packetOf(InlineInfo* info) { return &info->packet; }
+};
+
+// The receiver's bookkeeping before ReceiverSlot: the packet window plus a window of NACK times (and one of
+// ACK times, which moved in lockstep), kept here for comparison only
+struct SplitReceiverState {
+    typedef std::chrono::steady_clock::time_point timepoint;
+    SlidingWindow<Packet*> window;
+    SlidingWindow<timepoint> ackTimes;
+    SlidingWindow<timepoint> nackTimes;
+
+    SplitReceiverState(size_t window_size) : window(window_size), ackTimes(window_size), nackTimes(window_size) {}
+    void receive(uint32_t seq_num) { window.reserve(seq_num); }
+    bool nack(uint32_t seq_num, uint32_t now) {
+        if (window.contains(seq_num)) return false;
+        timepoint t = timepoint(std::chrono::microseconds(now));
+        bool sent_before = nackTimes.contains(seq_num);
+        timepoint* time = nackTimes.reserve(seq_num);
+        bool due = !sent_before || std::chrono::duration_cast<std::chrono::microseconds>(t - *time).count() > RETRY_ACK_US;
+        *time = t;
+        return due;
+    }
+    size_t scan(uint32_t from, uint32_t to, uint32_t now) {
+        size_t nacks = 0;
+        for (uint32_t seq = from; seq != to; seq++) nacks += nack(seq, now);
+        return nacks;
+    }
+    void advanceTo(uint32_t seq_num) {
+        window.advanceTo(seq_num);
+        ackTimes.advanceTo(seq_num);
+        nackTimes.advanceTo(seq_num);
+    }
+    static double slotBytes() { return 3 * sizeof(uint32_t) + sizeof(Packet*) + 2 * sizeof(timepoint); }
+};
+
+struct PackedReceiverState {
+    PacketWindow window;
+
+    PackedReceiverState(size_t window_size) : window(window_size) {}
+    void receive(uint32_t seq_num) { window.reserve(seq_num); }
+    size_t scan(uint32_t from, uint32_t to, uint32_t now) {
+        size_t nacks = 0;
+        for (uint32_t seq = from; seq != to; seq++) nacks += window.nack(seq, now);
+        return nacks;
+    }
+    void advanceTo(uint32_t seq_num) { window.advanceTo(seq_num); }
+    static double slotBytes() { return sizeof(uint32_t) + sizeof(ReceiverSlot); }
+};
+
+// What StreamReceiver::sendSACK() does now: jump from hole to hole, only NACK'ing inside them
+struct GapReceiverState : PackedReceiverState {
+    GapReceiverState(size_t window_size) : PackedReceiverState(window_size) {}
+    size_t scan(uint32_t from, uint32_t to, uint32_t now) {
+        size_t nacks = 0;
+        for (uint32_t seq = window.nextMissing(from, to); seq != to; ) {
+            uint32_t hole_end = window.nextArrived(seq, to);
+            for (; seq != hole_end; seq++) nacks += window.nack(seq, now);
+            seq = window.nextMissing(hole_end, to);
+        }
+        return nacks;
+    }
+    static double slotBytes() { return sizeof(uint32_t) + sizeof(ReceiverSlot) + 1.0 / 8; }
+};
+
+// The receiver's SACK scan: packets arrive 64 at a time with `loss` of them missing, every hole between the
+// base and the newest packet is checked for a NACK, then the base moves on 64 as if the holes were filled.
+// The clock moves 1 ms per round, so holes get NACK'd again every RETRY_ACK_US. Losses come one at a time,
+// or in runs of `burst`. Returns ns per seq between the base and the newest packet.
+template<typename State>
+static double nackScan(size_t window_size, double loss, size_t burst, double seconds) {
+    State state(window_size);
+    std::vector<bool> lost(1 << 16);
+    for (size_t i = 0; i < lost.size(); i += burst) {
+        bool drop = rand() < loss * RAND_MAX;
+        for (size_t j = i; j < i + burst && j < lost.size(); j++) lost[j] = drop;
+    }
+    uint32_t base = 0, next = 0, now = 0;
+    volatile size_t sink = 0;
+    uint64_t ops = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed;
+    do {
+        for (int round = 0; round < 64; round++) {
+            for (; next - base < window_size && next - base < 64 * (uint32_t) round + 64; next++) {
+                if (!lost[next & 0xFFFF]) state.receive(next);
+            }
+            sink = sink + state.scan(base, next, now);
+            ops += next - base;
+            if (next - base == window_size) {
+                base += 64;
+                state.advanceTo(base);
+            }
+            now += 1000;
+        }
+        elapsed = std::chrono::steady_clock::now() - start;
+    } while (elapsed.count() < seconds);
+    (void) sink;
+    return elapsed.count() * 1e9 / ops;
+}
+
+template<typename State>
+static void nackScans(const char* name, size_t window_size, double seconds) {
+    std::cout << std::setw(8) << name << std::setw(12) << State::slotBytes() << std::setw(8) << window_size
+              << std::setw(12) << nackScan<State>(window_size, 0.01, 1, seconds)
+              << std::setw(12) << nackScan<State>(window_size, 0.1, 1, seconds)
+              << nackScan<State>(window_size, 0.1, 100, seconds) << std::endl;
+}
+
+static size_t residentKB() {
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    size_t size = 0, resident = 0;
+    if (fscanf(f, "%zu %zu", &size, &resident) != 2) resident = 0;
+    fclose(f);
+    return resident * sysconf(_SC_PAGESIZE) / 1024;
+}
+
+template<typename Window>
+static void setup(const char* name, size_t window_size, size_t packet_size) {
+    size_t before = residentKB();
+    auto start = std::chrono::steady_clock::now();
+    Window* window = new Window(window_size, packet_size);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    size_t resident = residentKB() - before;
+    std::cout << std::setw(8) << name << std::setw(8) << window_size << std::setw(12) << ms << std::setw(14) << resident << std::endl;
+    delete window;
+}
+
+// Random contains() and get() over a full window, half of it present, like the receiver's NACK scans and
+// the sender's ACK processing. Returns ns per lookup.
+template<typename Window>
+static double lookups(size_t window_size, size_t packet_size, double seconds) {
+    Window window(window_size, packet_size);
+    uint32_t base = 0xFFFFFF00;     // across the wrap
+    window.advanceTo(base);
+    for (uint32_t i = 0; i < window_size; i += 2) {
+        window.reserve(base + i);
+    }
+    std::vector<uint32_t> seqs(1 << 16);
+    for (size_t i = 0; i < seqs.size(); i++) seqs[i] = base + rand() % window_size;
+
+    volatile size_t sink = 0;
+    uint64_t ops = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed;
+    do {
+        size_t found = 0;
+        for (uint32_t seq : seqs) {
+            found += window.contains(seq);
+            found += window.get(seq ^ 1) != nullptr;
+        }
+        sink = sink + found;
+        ops += 2 * seqs.size();
+        elapsed = std::chrono::steady_clock::now() - start;
+    } while (elapsed.count() < seconds);
+    (void) sink;
+    return elapsed.count() * 1e9 / ops;
+}
+
+// The sender's steady state: reserve the next packet and write its header, look up the oldest one as an
+// ACK would, erase and advance past it. Returns ns per packet.
+template<typename Window>
+static void stream(Window& window, size_t window_size, size_t packet_size, uint32_t& base, uint32_t& next, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (next - base == window_size) {
+            window.get(base)->retried = false;
+            window.erase(base);
+            window.advanceTo(++base);
+        }
+        auto* info = window.reserve(next);
+        window.packetOf(info)->header.seq_num = htonl(next);
+        info->data_size = packet_size;
+        next++;
+    }
+}
+
+template<typename Window>
+static double streaming(size_t window_size, size_t packet_size, double seconds) {
+    Window window(window_size, packet_size);
+    uint32_t base = 0, next = 0;
+    stream(window, window_size, packet_size, base, next, 2 * MAX_WINDOW_SIZE);    // every slot faulted in
+    uint64_t ops = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed;
+    do {
+        stream(window, window_size, packet_size, base, next, 4096);
+        ops += 4096;
+        elapsed = std::chrono::steady_clock::now() - start;
+    } while (elapsed.count() < seconds);
+    return elapsed.count() * 1e9 / ops;
+}
+
+int main(int argc, char* argv[]) {
+    double seconds = 0.5;
+    size_t payload = PAYLOAD_SIZE;
+    std::vector<size_t> windows = {100, 1000, (size_t) WINDOW_SIZE, (size_t) MAX_WINDOW_SIZE};
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-payload") && i + 1 < argc) {
+            payload = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-window") && i + 1 < argc) {
+            windows = {(size_t) atoi(argv[++i])};
+        } else {
+            std::cout << "Usage: " << argv[0] << " [-t seconds per measurement] [-payload bytes] [-window packets]" << std::endl;
+            return 1;
+        }
+    }
+    size_t packet_size = HEADER_SIZE + payload;
+    {
+        PacketBuffers probe;
+        probe.allocate(MAX_WINDOW_SIZE, packet_size);
+        std::cout << "packet buffers of " << probe.bufferSize() << " bytes on " << probe.backing() << " pages" << std::endl;
+    }
+
+    std::cout << std::left << std::fixed << std::setprecision(2);
+    std::cout << std::setw(8) << "layout" << std::setw(8) << "window" << std::setw(12) << "setup ms" << std::setw(14) << "resident KB" << std::endl;
+    for (size_t window_size : windows) {
+        setup<InlineRingWindow>("inline", window_size, packet_size);
+        setup<RingWindow>("ring", window_size, packet_size);
+    }
+
+    std::cout << std::endl << std::setw(8) << "layout" << std::setw(8) << "window"
+              << std::setw(12) << "lookup ns" << "stream ns/packet" << std::endl;
+    for (size_t window_size : windows) {
+        double l = lookups<InlineRingWindow>(window_size, packet_size, seconds);
+        double s = streaming<InlineRingWindow>(window_size, packet_size, seconds);
+        std::cout << std::setw(8) << "inline" << std::setw(8) << window_size << std::setw(12) << l << s << std::endl;
+        l = lookups<RingWindow>(window_size, packet_size, seconds);
+        s = streaming<RingWindow>(window_size, packet_size, seconds);
+        std::cout << std::setw(8) << "ring" << std::setw(8) << window_size << std::setw(12) << l << s << std::endl;
+    }
+
+    std::cout << std::endl << "receiver NACK scan, ns per seq" << std::endl;
+    std::cout << std::setw(8) << "layout" << std::setw(12) << "slot bytes" << std::setw(8) << "window"
+              << std::setw(12) << "1% loss" << std::setw(12) << "10% loss" << "10% in runs of 100" << std::endl;
+    for (size_t window_size : windows) {
+        nackScans<SplitReceiverState>("split", window_size, seconds);
+        nackScans<PackedReceiverState>("packed", window_size, seconds);
+        nackScans<GapReceiverState>("gaps", window_size, seconds);
+    }
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include <fstream>
+#include <vector>
+#include "FrameReceiver.hpp"
+#include "RawEthernetConnection.hpp"
+#include "DummyData.hpp"
+#include "FileData.hpp"
+#include "cmn.h"
+
+#ifdef __linux__
+
+// Sends num_frames HLS style frames, with payloads from istream if it is open, else a frame counter.
+// Stands in for the FPGA when testing on loopback or a veth pair.
+int inject(RawEthernetConnection& conn, std::istream* istream, uint64_t num_frames) {
+    using namespace std::chrono;
+    char payload[HLS_PAYLOAD_SIZE] = {};
+    uint64_t sent = 0;
+    while (num_frames == 0 || sent < num_frames) {
+        size_t len = HLS_PAYLOAD_SIZE;
+        if (istream) {
+            istream->read(payload, HLS_PAYLOAD_SIZE);
+            len = istream->gcount();
+            if (len == 0) break;
+        } else {
+            std::memcpy(payload, &sent, sizeof(sent));
+        }
+        while (conn.send(payload, len) < 0) {
+            if (errno != EAGAIN && errno != ENOBUFS) {
+                perror("frame send failed");
+                return 1;
+            }
+            conn.wait(steady_clock::now() + milliseconds(1), true);
+        }
+        sent++;
+    }
+    std::cout << "Injected " << sent << " frames" << std::endl;
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    std::cout << "This is main ethernet receiver" << std::endl;
+
+    bool debug = false;
+    std::string filename = "";
+    uint64_t num_frames = 0;
+    int idle_ms = 1000;
+    bool injecting = false;
+
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--debug") {
+            debug = true;
+        } else if (arg == "-file") {
+            filename = argv[i+1];
+            i++;
+        } else if (arg == "-num") {
+            num_frames = std::atoll(argv[i+1]);
+            i++;
+        } else if (arg == "-idle") {
+            idle_ms = std::atoi(argv[i+1]);
+            i++;
+        } else if (arg == "--inject") {
+            injecting = true;
+        } else {
+            args.push_back(arg);
+        }
+    }
+    if (args.size() < 1) {
+        std::cerr << "Usage: " << argv[0] << " <interface> [-file filename] [-num frames] [-idle ms] [--inject] [--debug]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (injecting) {
+        RawEthernetConnection conn(args[0]);
+        if (!conn.open()) return EXIT_FAILURE;
+        std::ifstream fstream;
+        if (filename != "") fstream.open(filename, std::ios::binary | std::ios::in);
+        int ret = inject(conn, fstream.is_open() ? &fstream : nullptr, num_frames);
+        conn.close();
+        return ret;
+    }
+
+    std::ofstream fstream;
+    std::ostream* ostream;
+    NullStream nullstr;
+    if (filename != "") {
+        fstream.open(filename, std::ios::binary | std::ios::out);
+        ostream = &fstream;
+    } else {
+        ostream = &nullstr;
+    }
+
+    FrameReceiver<FileWriter, RawEthernetConnection> receiver(
+        FileWriter(*ostream), RawEthernetConnection(args[0]), HLS_PAYLOAD_SIZE, debug
+    );
+    if (receiver.receiveStream(num_frames, idle_ms) != 0) return EXIT_FAILURE;
+    receiver.report();
+    std::cout << "Kernel drops: " << receiver.conn.drops() << " Runts: " << receiver.conn.runts << std::endl;
+    receiver.teardown();
+}
+
+#else
+
+int main() {
+    std::cerr << "AF_PACKET raw Ethernet is Linux only" << std::endl;
+    return EXIT_FAILURE;
+}
+
+#endif
@@ -1,22 +1,38 @@
 #include <memory>
 #include "StreamReceiver.hpp"
+#include "Sharding.hpp"
 #include "DataWindow.hpp"
 #include "DummyData.hpp"
 #include "FileData.hpp"
 #include "UDPNetworkConnection.hpp"
+#include "UringUDPNetworkConnection.hpp"
 #include "cmn.h"
 
-std::unique_ptr<StreamReceiverInterface> receiverFactory(int receiver_port, std::ostream& ostream, float perror, bool debug, bool csv, int windowsize) {
+template<typename ConnectionType, typename Policy>
+std::unique_ptr<StreamReceiverInterface> receiverFactory(int receiver_port, std::ostream& ostream, float perror, int errbits, bool csv, int windowsize, int shards, ReceiverOptions options) {
     std::unique_ptr<StreamReceiverInterface> ptr;
 
-    if (perror == 0) {
-        auto receiver = new StreamReceiver<FileWriter, UDPStreamReceiver>(
-            FileWriter(ostream), UDPStreamReceiver(receiver_port), debug, windowsize, csv
+    if (shards > 1) {
+        std::cout << "merging " << shards << " shards on ports " << receiver_port << "-" << receiver_port + shards - 1 << std::endl;
+        if (perror == 0) {
+            ptr.reset(new ShardedStreamReceiver<FileWriter, ConnectionType, Policy>(
+                FileWriter(ostream), [&](size_t i) { return ConnectionType(receiver_port + i); },
+                shards, windowsize, csv, options
+            ));
+        } else {
+            ptr.reset(new ShardedStreamReceiver<FileWriter, FaultyStreamReceiver<ConnectionType>, Policy>(
+                FileWriter(ostream), [&](size_t i) { return FaultyStreamReceiver<ConnectionType>(receiver_port + i, perror, true, 1 + i, errbits); },
+                shards, windowsize, csv, options
+            ));
+        }
+    } else if (perror == 0) {
+        auto receiver = new StreamReceiver<FileWriter, ConnectionType, Policy>(
+            FileWriter(ostream), ConnectionType(receiver_port), windowsize, csv, options
         );
         ptr.reset(receiver);
     } else {
-        auto receiver = new StreamReceiver<FileWriter, FaultyUDPStreamReceiver>(
-            FileWriter(ostream), FaultyUDPStreamReceiver(receiver_port, perror, true, 1), debug, windowsize, csv
+        auto receiver = new StreamReceiver<FileWriter, FaultyStreamReceiver<ConnectionType>, Policy>(
+            FileWriter(ostream), FaultyStreamReceiver<ConnectionType>(receiver_port, perror, true, 1, errbits), windowsize, csv, options
         );
         ptr.reset(receiver);
     }
@@ -24,6 +40,14 @@ std::unique_ptr<StreamReceiverInterface> receiverFactory(int receiver_port, std:
     return ptr;
 }
 
+// Every policy is compiled in, --debug and --lean pick one
+template<typename Policy>
+std::unique_ptr<StreamReceiverInterface> receiverFactory(bool uring, int receiver_port, std::ostream& ostream, float perror, int errbits, bool csv, int windowsize, int shards, ReceiverOptions options) {
+    return uring
+        ? receiverFactory<UringUDPStreamReceiver, Policy>(receiver_port, ostream, perror, errbits, csv, windowsize, shards, options)
+        : receiverFactory<UDPStreamReceiver, Policy>(receiver_port, ostream, perror, errbits, csv, windowsize, shards, options);
+}
+
 int main(int argc, char* argv[]) {
     // --- Command-line parsing ---
     // Usage: ./StreamReceiver <receiver_port> windowsize [filename] [--debug] [--statistics]
@@ -31,34 +55,88 @@ int main(int argc, char* argv[]) {
     std::cout << "This is main receiver" << std::endl;
 
     bool debug = false;
+    bool lean = false;
     bool csv = false;
     float perror = 0;
+    int errbits = 1;
     int windowsize = WINDOW_SIZE;
     std::string filename = "";
+    bool uring = false;
+    int shards = 1;
+    ReceiverOptions options;
 
     std::vector<std::string> args;
     for (int i = 1; i < argc; i++) {
         std::string arg = argv[i];
         if(arg == "--debug") {
             debug = true;
+        } else if (arg == "--lean") {
+            lean = true;
         } else if(arg == "--csv") {
             csv = true;
         } else if (arg == "-perror") {
             perror = std::atof(argv[i+1]);
             std::cout << "set error " << perror << std::endl;
             i++;
+        } else if (arg == "-errbits") {
+            errbits = std::atoi(argv[i+1]);
+            i++;
         } else if (arg == "-window") {
             windowsize = std::atoi(argv[i+1]);
+            if (windowsize < 1 || windowsize > MAX_WINDOW_SIZE) {
+                std::cerr << "Bad -window " << argv[i+1] << ", expected 1 to " << MAX_WINDOW_SIZE << " packets" << std::endl;
+                return EXIT_FAILURE;
+            }
             i++;
         } else if (arg == "-file") {
             filename = argv[i+1];
             i++;
+        } else if (arg == "-batch") {
+            options.batch_size = std::atoi(argv[i+1]);
+            if (options.batch_size < 1 || options.batch_size > RECV_BATCH_SIZE) {
+                std::cerr << "Bad -batch " << argv[i+1] << ", expected 1 to " << RECV_BATCH_SIZE << " datagrams" << std::endl;
+                return EXIT_FAILURE;
+            }
+            i++;
+        } else if (arg == "-queue") {
+            int ring = std::atoi(argv[i+1]);
+            if (ring < 0 || ring > MAX_WINDOW_SIZE) {
+                std::cerr << "Bad -queue " << argv[i+1] << ", expected 0 to " << MAX_WINDOW_SIZE << " packets" << std::endl;
+                return EXIT_FAILURE;
+            }
+            options.process_ring = ring;
+            i++;
+        } else if (arg == "-shards") {
+            shards = std::atoi(argv[i+1]);
+            if (shards < 1 || shards > MAX_SHARDS) {
+                std::cerr << "Bad -shards " << argv[i+1] << ", expected 1 to " << MAX_SHARDS << " streams" << std::endl;
+                return EXIT_FAILURE;
+            }
+            i++;
+        } else if (arg == "--uring") {
+            uring = true;
+        } else if (arg == "--nogro") {
+            options.gro = false;
+        } else if (arg == "--nosack") {
+            options.sack = false;
+        } else if (arg == "--nofec") {
+            options.fec = false;
+        } else if (arg == "--nocrc32c") {
+            options.crc32c = false;
         } else {
             args.push_back(arg);
         }
     }
     if(args.size() < 1) {
-        std::cerr << "Usage: " << argv[0] << " <receiver_port> [-perror err] [-window windowsize] [--debug] [--csv]" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " <receiver_port> [-perror err] [-errbits bits] [-window windowsize] [-batch n] [-queue packets] [-shards n] [--uring] [--nogro] [--nosack] [--nofec] [--nocrc32c] [--debug] [--lean] [--csv]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (lean && (debug || csv)) {
+        std::cerr << "--lean builds have no debug output or statistics, drop --debug and --csv" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (lean && perror != 0) {
+        std::cerr << "--lean doesn't verify checksums, so it can't see the errors -perror makes" << std::endl;
         return EXIT_FAILURE;
     }
 
@@ -77,7 +155,9 @@ int main(int argc, char* argv[]) {
         ostream = &nullstr;
     }
 
-    auto receiver = receiverFactory(receiver_port, *ostream, perror, debug, csv, windowsize);
+    auto receiver = debug ? receiverFactory<DebugPolicy>(uring, receiver_port, *ostream, perror, errbits, csv, windowsize, shards, options)
+                  : lean ? receiverFactory<LeanPolicy>(uring, receiver_port, *ostream, perror, errbits, csv, windowsize, shards, options)
+                  : receiverFactory<DefaultPolicy>(uring, receiver_port, *ostream, perror, errbits, csv, windowsize, shards, options);
     receiver->receiveData();
     receiver->teardown();
 }
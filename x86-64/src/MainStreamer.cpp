@@ -1,23 +1,38 @@
 #include <memory>
 #include "StreamSender.hpp"
+#include "Sharding.hpp"
 #include "DummyData.hpp"
 #include "FileData.hpp"
 #include "UDPNetworkConnection.hpp"
+#include "UringUDPNetworkConnection.hpp"
 #include "cmn.h"
 
-std::unique_ptr<StreamSenderInterface> senderFactory(int receiver_port, std::string& receiver_ip, std::istream& istream, int num_dummy_packets, bool debug, bool csv, int windowsize, bool superdumb) {
+template<typename ConnectionType, typename Policy>
+std::unique_ptr<StreamSenderInterface> senderFactory(int receiver_port, std::string& receiver_ip, std::istream& istream, int num_dummy_packets, bool csv, int windowsize, bool superdumb, int shards, SenderOptions options) {
     std::unique_ptr<StreamSenderInterface> ptr;
 
-    if (num_dummy_packets == -1) {
+    if (shards > 1) {
+        std::cout << "striping over " << shards << " shards on ports " << receiver_port << "-" << receiver_port + shards - 1 << std::endl;
+        auto makeConnection = [&](size_t i) { return ConnectionType(receiver_port + i, receiver_ip); };
+        if (num_dummy_packets == -1) {
+            ptr.reset(new ShardedStreamSender<FileReader, ConnectionType, Policy>(
+                FileReader(istream), makeConnection, shards, windowsize, csv, options
+            ));
+        } else {
+            ptr.reset(new ShardedStreamSender<DummyProvider, ConnectionType, Policy>(
+                DummyProvider(num_dummy_packets, superdumb), makeConnection, shards, windowsize, csv, options
+            ));
+        }
+    } else if (num_dummy_packets == -1) {
         std::cout << "streaming from file" << std::endl;
-        auto sender = new StreamSender<FileReader, UDPStreamSender>(
-            FileReader(istream), UDPStreamSender(receiver_port, receiver_ip), debug, windowsize, csv
+        auto sender = new StreamSender<FileReader, ConnectionType, Policy>(
+            FileReader(istream), ConnectionType(receiver_port, receiver_ip), windowsize, csv, options
         );
         ptr.reset(sender);
     } else {
         std::cout << "streaming dummy data" << std::endl;
-        auto sender = new StreamSender<DummyProvider, UDPStreamSender>(
-            DummyProvider(num_dummy_packets, superdumb), UDPStreamSender(receiver_port, receiver_ip), debug, windowsize, csv
+        auto sender = new StreamSender<DummyProvider, ConnectionType, Policy>(
+            DummyProvider(num_dummy_packets, superdumb), ConnectionType(receiver_port, receiver_ip), windowsize, csv, options
         );
         ptr.reset(sender);
     }
@@ -26,6 +41,14 @@ std::unique_ptr<StreamSenderInterface> senderFactory(int receiver_port, std::str
     return ptr;
 }
 
+// Every policy is compiled in, --debug and --lean pick one
+template<typename Policy>
+std::unique_ptr<StreamSenderInterface> senderFactory(bool uring, int receiver_port, std::string& receiver_ip, std::istream& istream, int num_dummy_packets, bool csv, int windowsize, bool superdumb, int shards, SenderOptions options) {
+    return uring
+        ? senderFactory<UringUDPStreamSender, Policy>(receiver_port, receiver_ip, istream, num_dummy_packets, csv, windowsize, superdumb, shards, options)
+        : senderFactory<UDPStreamSender, Policy>(receiver_port, receiver_ip, istream, num_dummy_packets, csv, windowsize, superdumb, shards, options);
+}
+
 int main(int argc, char* argv[]) {
     // --- Command-line parsing ---
     // Usage: ./StreamReceiver <receiver_port> windowsize [filename] [--debug] [--statistics]
@@ -33,27 +56,99 @@ int main(int argc, char* argv[]) {
     std::cout << "This is main receiver" << std::endl;
 
     bool debug = false;
+    bool lean = false;
     bool csv = false;
     int windowsize = WINDOW_SIZE;
     std::string filename = "";
     int num_dummy_packets = 1000;
     bool superdumb = false;
+    bool uring = false;
+    int shards = 1;
+    SenderOptions options;
 
     std::vector<std::string> args;
     for (int i = 1; i < argc; i++) {
         std::string arg = argv[i];
         if(arg == "--debug") {
             debug = true;
+        } else if (arg == "--lean") {
+            lean = true;
         } else if (arg == "--csv") {
             csv = true;
         } else if (arg == "--superdumb") {
             superdumb = true;
+        } else if (arg == "--uring") {
+            uring = true;
+        } else if (arg == "--nogso") {
+            options.gso = false;
         } else if (arg == "-window") {
             windowsize = std::atoi(argv[i+1]);
+            if (windowsize < 1 || windowsize > MAX_WINDOW_SIZE) {
+                std::cerr << "Bad -window " << argv[i+1] << ", expected 1 to " << MAX_WINDOW_SIZE << " packets" << std::endl;
+                return EXIT_FAILURE;
+            }
             i++;
         } else if (arg == "-file") {
             filename = argv[i+1];
             i++;
+        } else if (arg == "-rate") {
+            options.pace_mbps = std::atof(argv[i+1]);
+            i++;
+        } else if (arg == "-burst") {
+            int burst = std::atoi(argv[i+1]);
+            if (burst < 1 || burst > MAX_WINDOW_SIZE) {
+                std::cerr << "Bad -burst " << argv[i+1] << ", expected 1 to " << MAX_WINDOW_SIZE << " packets" << std::endl;
+                return EXIT_FAILURE;
+            }
+            options.pace_burst = burst;
+            i++;
+        } else if (arg == "--txtime") {
+            options.txtime = true;
+        } else if (arg == "-cc") {
+            if (!parseCongestionMode(argv[i+1], options.congestion)) {
+                std::cerr << "Unknown congestion control " << argv[i+1] << ", expected fixed, aimd or delay" << std::endl;
+                return EXIT_FAILURE;
+            }
+            i++;
+        } else if (arg == "-fec") {
+            if (!parseFecRatio(argv[i+1], options.fec_data, options.fec_parity)) {
+                std::cerr << "Bad -fec " << argv[i+1] << ", expected data:parity with at most "
+                          << FEC_MAX_DATA << ":" << FEC_MAX_PARITY << std::endl;
+                return EXIT_FAILURE;
+            }
+            i++;
+        } else if (arg == "--fec-adapt") {
+            options.fec_adapt = true;
+        } else if (arg == "-producer") {
+            int ring = std::atoi(argv[i+1]);
+            if (ring < 0 || ring > MAX_WINDOW_SIZE) {
+                std::cerr << "Bad -producer " << argv[i+1] << ", expected 0 to " << MAX_WINDOW_SIZE << " packets" << std::endl;
+                return EXIT_FAILURE;
+            }
+            options.producer_ring = ring;
+            i++;
+        } else if (arg == "-shards") {
+            shards = std::atoi(argv[i+1]);
+            if (shards < 1 || shards > MAX_SHARDS) {
+                std::cerr << "Bad -shards " << argv[i+1] << ", expected 1 to " << MAX_SHARDS << " streams" << std::endl;
+                return EXIT_FAILURE;
+            }
+            i++;
+        } else if (arg == "-isn") {
+            options.initial_seq = std::strtoul(argv[i+1], nullptr, 0);
+            i++;
+        } else if (arg == "--crc32c") {
+            options.crc32c = true;
+        } else if (arg == "-payload") {
+            int payload = std::atoi(argv[i+1]);
+            if (payload < MIN_PAYLOAD_SIZE || payload > MAX_PAYLOAD_SIZE) {
+                std::cerr << "Bad -payload " << argv[i+1] << ", expected " << MIN_PAYLOAD_SIZE << " to " << MAX_PAYLOAD_SIZE << " bytes" << std::endl;
+                return EXIT_FAILURE;
+            }
+            options.payload_size = payload;
+            i++;
+        } else if (arg == "--pmtu") {
+            options.pmtu_probe = true;
         } else if (arg == "-num") {
             num_dummy_packets = std::atoi(argv[i+1]);
             i++;
@@ -62,7 +157,11 @@ int main(int argc, char* argv[]) {
         }
     }
     if(args.size() < 1) {
-        std::cerr << "Usage: " << argv[0] << " <receiver_ip> <receiver_port> [-file filename] [-num num_dummy_packets] [-window windowsize] [--debug] [--csv] [--superdumb]" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " <receiver_ip> <receiver_port> [-file filename] [-num num_dummy_packets] [-window windowsize] [-rate mbps] [-burst packets] [--txtime] [-cc fixed|aimd|delay] [-fec data:parity] [--fec-adapt] [-producer packets] [-shards n] [-isn seq] [--crc32c] [-payload bytes] [--pmtu] [--uring] [--nogso] [--debug] [--lean] [--csv] [--superdumb]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (lean && (debug || csv)) {
+        std::cerr << "--lean builds have no debug output or statistics, drop --debug and --csv" << std::endl;
         return EXIT_FAILURE;
     }
 
@@ -76,7 +175,9 @@ int main(int argc, char* argv[]) {
         num_dummy_packets = -1;
     }
 
-    auto receiver = senderFactory(receiver_port, receiver_ip, fstream, num_dummy_packets, debug, csv, windowsize, superdumb);
+    auto receiver = debug ? senderFactory<DebugPolicy>(uring, receiver_port, receiver_ip, fstream, num_dummy_packets, csv, windowsize, superdumb, shards, options)
+                  : lean ? senderFactory<LeanPolicy>(uring, receiver_port, receiver_ip, fstream, num_dummy_packets, csv, windowsize, superdumb, shards, options)
+                  : senderFactory<DefaultPolicy>(uring, receiver_port, receiver_ip, fstream, num_dummy_packets, csv, windowsize, superdumb, shards, options);
     receiver->stream();
     receiver->teardown();
 }
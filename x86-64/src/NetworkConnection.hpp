@@ -1,7 +1,11 @@
 // Abstraction for UDP socket or AXI Stream
 #pragma once
 #include <stdio.h>
+#include <stdint.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <chrono>
+#include "EventPoller.hpp"
 
 class NetworkConnection {
 public:
@@ -10,4 +14,79 @@ public:
     virtual ssize_t receive(void* buffer, size_t len) = 0;
     virtual bool ready(timeval timeout) = 0;
     virtual bool close() = 0;
-};
\ No newline at end of file
+
+    // Block until the connection is readable (or writable, when asked) or deadline passes.
+    // Returns a mask of POLL_READABLE / POLL_WRITABLE, POLL_TIMEOUT if the deadline passed first.
+    virtual int wait(std::chrono::steady_clock::time_point deadline, bool writable=false) {
+        auto now = std::chrono::steady_clock::now();
+        auto wait_us = (deadline > now) ? std::chrono::duration_cast<std::chrono::microseconds>(deadline - now).count() : 0;
+        timeval tv = {(time_t) (wait_us / 1000000), (suseconds_t) (wait_us % 1000000)};
+        int mask = ready(tv) ? POLL_READABLE : POLL_TIMEOUT;
+        return writable ? (mask | POLL_WRITABLE) : mask;
+    }
+
+    // Also return POLL_WAKEUP from wait() while fd is readable, so another thread can wake the caller.
+    // Returns false if the connection can't, in which case the caller has to poll for whatever fd signals.
+    virtual bool watch(int fd) {
+        (void) fd;
+        return false;
+    }
+
+    // Ask the transport to release each datagram at the time passed to sendBatch() (SO_TXTIME).
+    // Returns false if it can't, in which case txtimes are ignored and the caller has to pace itself.
+    virtual bool enableTxTime() {
+        return false;
+    }
+
+    // Let sendBatch() hand runs of equal sized datagrams to the kernel as one, which it splits up again (UDP GSO).
+    // Returns false if the transport can't, in which case every datagram goes through the kernel on its own.
+    virtual bool enableSegmentation() {
+        return false;
+    }
+
+    // Let receiveBatch() take datagrams the kernel coalesced (UDP GRO) and split them up again. Calls will pass
+    // batch buffers of buffer_size bytes. Returns false if the transport can't, or a batch can't hold one coalesced datagram.
+    virtual bool enableCoalescing(size_t batch, size_t buffer_size) {
+        (void) batch;
+        (void) buffer_size;
+        return false;
+    }
+
+    // Stop (on) or allow (off) IP fragmentation of outgoing datagrams, so one larger than the path MTU is dropped
+    // or refused with EMSGSIZE instead of split up. Returns false if the transport can't, for the path MTU probe.
+    virtual bool setDontFragment(bool on) {
+        (void) on;
+        return false;
+    }
+
+    // Send n datagrams, one per iovec. Returns the number of datagrams sent, or -1 if none could be sent.
+    // txtimes, if given, holds each datagram's CLOCK_MONOTONIC departure time in ns (see enableTxTime()).
+    // Connections that can hand a whole batch to the kernel at once should override this.
+    virtual int sendBatch(iovec* packets, size_t n, const uint64_t* txtimes=nullptr) {
+        (void) txtimes;
+        for (size_t i = 0; i < n; i++) {
+            if (send(packets[i].iov_base, packets[i].iov_len) < 0) {
+                return (i == 0) ? -1 : (int) i;
+            }
+        }
+        return (int) n;
+    }
+
+    // Receive up to n datagrams, one per iovec, writing each datagram's length into lengths.
+    // Returns the number of datagrams received, or -1 if none were available.
+    // May reorder the iovecs: afterwards datagram i is in buffers[i], whichever buffer that now is.
+    virtual int receiveBatch(iovec* buffers, ssize_t* lengths, size_t n) {
+        size_t i = 0;
+        for (; i < n; i++) {
+            lengths[i] = receive(buffers[i].iov_base, buffers[i].iov_len);
+            if (lengths[i] < 0) break;
+        }
+        return (i == 0) ? -1 : (int) i;
+    }
+
+    // Bytes receiveBatch() copied between buffers since the last call, for the receiver's Copied/B.
+    // 0 if the datagrams land where the caller gets them.
+    virtual size_t takeCopied() {
+        return 0;
+    }
+};
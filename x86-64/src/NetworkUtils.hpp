@@ -11,12 +11,18 @@
 #include <stdint.h>
 #include <string>
 
+const int SOCKET_BUFFER_SIZE = 8 * 1024 * 1024;    // requested SO_SNDBUF/SO_RCVBUF, the kernel caps it at [rw]mem_max
+
 inline int createUDPSocket() {
     int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
     if(sockfd < 0) {
         perror("socket creation failed");
         exit(EXIT_FAILURE);
     }
+    // The default ~200KB receive buffer holds less than 100 DATA packets, far smaller than a window burst.
+    int bufsize = SOCKET_BUFFER_SIZE;
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
     // Set non-blocking mode.
     int flags = fcntl(sockfd, F_GETFL, 0);
     fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
@@ -0,0 +1,100 @@
+#pragma once
+#include <chrono>
+#include <algorithm>
+#include <stdint.h>
+#include <sys/uio.h>
+
+// Limits the sender to a target rate so a freshly opened window doesn't leave as one line-rate burst.
+//
+// This is a token bucket holding `burst` bytes and refilled at `mbps`. It is kept as a single clock:
+// next_departure is when the next byte may leave at the target rate. The bucket is full when that time
+// is `burst` bytes' worth of time in the past, and empty when it is now.
+//
+// In token bucket mode admitted packets leave immediately, so up to `burst` bytes can go back-to-back.
+// In txtime mode every admitted packet is also given its own departure time for SO_TXTIME. The kernel's
+// fq qdisc then spaces the packets evenly instead of the sender sleeping between them.
+class Pacer {
+public:
+    typedef std::chrono::steady_clock::time_point timepoint;
+
+    Pacer(double mbps=0, size_t burst=0, bool txtime=false) {
+        configure(mbps, burst, txtime);
+    }
+
+    void configure(double mbps, size_t burst, bool txtime) {
+        this->txtime = txtime;
+        ns_per_byte = (mbps > 0) ? 8 * 1000.0 / mbps : 0;
+        burst_ns = std::chrono::nanoseconds((int64_t) (burst * ns_per_byte));
+        next_departure = timepoint();
+    }
+
+    bool enabled() {
+        return ns_per_byte > 0;
+    }
+    bool txtimeEnabled() {
+        return enabled() && txtime;
+    }
+
+    // True if a packet of `bytes` could be admitted now.
+    bool ready(size_t bytes, timepoint now=std::chrono::steady_clock::now()) {
+        return !enabled() || start(now) + duration(bytes) <= now + burst_ns;
+    }
+
+    // How many packets of `bytes` admit() would take right now, at most max.
+    size_t available(size_t bytes, size_t max) {
+        if (!enabled()) return max;
+        auto now = std::chrono::steady_clock::now();
+        auto budget = now + burst_ns - start(now);
+        if (budget.count() <= 0) return 0;
+        return std::min(max, (size_t) (budget / duration(bytes)));
+    }
+
+    // When ready(bytes) next becomes true.
+    timepoint nextRelease(size_t bytes) {
+        return next_departure + duration(bytes) - burst_ns;
+    }
+
+    // Take tokens for as many of the n packets as the bucket holds, in order, and return how many.
+    // If txtimes is given, it receives each admitted packet's departure time in CLOCK_MONOTONIC nanoseconds.
+    size_t admit(const iovec* packets, size_t n, uint64_t* txtimes=nullptr) {
+        if (!enabled()) return n;
+        auto now = std::chrono::steady_clock::now();
+        timepoint departure = start(now);
+        size_t i = 0;
+        for (; i < n; i++) {
+            auto next = departure + duration(packets[i].iov_len);
+            if (next > now + burst_ns) break;
+            if (txtimes) {
+                txtimes[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(departure.time_since_epoch()).count();
+            }
+            departure = next;
+        }
+        if (i > 0) next_departure = departure;
+        return i;
+    }
+
+    // Give back the tokens of the last n packets admit() took that the socket then refused.
+    // They were admitted last, so this also takes back their departure times.
+    void refund(const iovec* packets, size_t n) {
+        if (!enabled()) return;
+        for (size_t i = 0; i < n; i++) {
+            next_departure -= duration(packets[i].iov_len);
+        }
+    }
+
+private:
+    double ns_per_byte = 0;
+    std::chrono::nanoseconds burst_ns;
+    bool txtime = false;
+    timepoint next_departure;
+
+    std::chrono::nanoseconds duration(size_t bytes) {
+        return std::chrono::nanoseconds((int64_t) (bytes * ns_per_byte));
+    }
+    // Departure time of the next admitted packet. An idle sender doesn't bank more than a full bucket,
+    // and with txtime nothing is scheduled in the past, where fq would send it at once.
+    timepoint start(timepoint now) {
+        timepoint earliest = txtime ? now : now - burst_ns;
+        return (next_departure < earliest) ? earliest : next_departure;
+    }
+};
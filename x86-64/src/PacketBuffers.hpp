@@ -0,0 +1,79 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include "Protocol.hpp"
+
+// count packet buffers of one stride, in a single anonymous mapping the window slots point into.
+//
+// Nothing is zeroed or faulted in up front: the kernel backs each page the first time a buffer on it is
+// written, so a window costs memory for the slots it has used rather than for its capacity. The stride
+// is the negotiated packet size rounded up to an odd number of cache lines, not sizeof(Packet), so small payloads don't
+// spread over 9 KB slots. Every access goes through the Packet header and stays within size bytes.
+//
+// Explicit huge pages (MAP_HUGETLB) are tried first, for fewer TLB misses across a large window. They
+// have to be reserved by the admin (vm.nr_hugepages), otherwise the mapping asks for transparent ones.
+class PacketBuffers {
+public:
+    static constexpr size_t HUGE_PAGE_SIZE = 2 << 20;
+
+    PacketBuffers() {}
+    PacketBuffers(const PacketBuffers&) = delete;
+    PacketBuffers& operator=(const PacketBuffers&) = delete;
+    ~PacketBuffers() { release(); }
+
+    // Maps count buffers that hold at least size bytes each, replacing any earlier ones
+    bool allocate(size_t count, size_t size) {
+        release();
+        stride = (size + 63) & ~(size_t) 63;
+        if ((stride / 64) % 2 == 0) stride += 64;   // odd in cache lines, or headers crowd into a few cache sets
+        bytes = count * stride;
+        if (bytes == 0) return false;
+#ifdef MAP_HUGETLB
+        if (bytes >= HUGE_PAGE_SIZE) {
+            size_t rounded = (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+            void* mem = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (mem != MAP_FAILED) {
+                base = static_cast<char*>(mem);
+                bytes = rounded;
+                backing_name = "hugetlb";
+                return true;
+            }
+        }
+#endif
+        void* mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+            perror("mmap packet buffers");
+            bytes = 0;
+            return false;
+        }
+        base = static_cast<char*>(mem);
+        backing_name = "4k";
+#ifdef MADV_HUGEPAGE
+        if (bytes >= HUGE_PAGE_SIZE && madvise(base, bytes, MADV_HUGEPAGE) == 0)
+            backing_name = "thp";
+#endif
+        return true;
+    }
+
+    inline Packet* operator[](size_t i) {
+        return reinterpret_cast<Packet*>(base + i * stride);
+    }
+
+    // "hugetlb", "thp" (if the kernel has them to give) or "4k"
+    const char* backing() { return backing_name; }
+    size_t bufferSize() { return stride; }
+
+private:
+    void release() {
+        if (base) munmap(base, bytes);
+        base = nullptr;
+        bytes = 0;
+    }
+
+    char* base = nullptr;
+    size_t stride = 0;
+    size_t bytes = 0;
+    const char* backing_name = "none";
+};
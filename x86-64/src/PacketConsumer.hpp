@@ -0,0 +1,73 @@
+#pragma once
+#include <atomic>
+#include <thread>
+#include <cstring>
+#include "SpscRing.hpp"
+#include "Protocol.hpp"
+
+// One in-order payload waiting for PacketConsumer
+struct DeliveredPayload {
+    uint32_t size;
+    char data[MAX_PAYLOAD_SIZE];
+};
+
+// Runs the DataProcessor on its own thread, so a slow disk or ZMQ peer doesn't stop the receive loop
+// from draining the socket.
+//
+// The receive loop keeps checksums, reordering, FEC and ACKs, and push()es each in-order payload into a
+// BlockingRing of `capacity` packets, allocated once. The processing thread calls processData() on them in the
+// same order. A full ring blocks push() until the thread catches up. Nothing is dropped, but reception stalls as
+// it would have without the thread. push() reports that, and depth() can be sampled to see how close the ring gets.
+template<typename DataProcessorType>
+class PacketConsumer {
+public:
+    PacketConsumer(DataProcessorType& processor, size_t capacity) : processor(processor), ring(capacity) {}
+
+    ~PacketConsumer() {
+        stop();
+    }
+
+    bool start() {
+        if (!ring.open()) return false;
+        thread = std::thread(&PacketConsumer::run, this);
+        return true;
+    }
+
+    // Processes everything queued so far, then joins the thread
+    void stop() {
+        if (thread.joinable()) {
+            ring.close();
+            thread.join();
+        }
+    }
+
+    // Receive loop: queue size bytes of data for processData(). False if it had to wait for a free slot.
+    bool push(const char* data, size_t size) {
+        bool waited = false;
+        DeliveredPayload* payload = ring.claim(&waited);
+        payload->size = size;
+        std::memcpy(payload->data, data, size);
+        ring.publish();
+        return !waited;
+    }
+
+    size_t depth() {
+        return ring.size();
+    }
+    size_t capacity() {
+        return ring.capacity();
+    }
+
+private:
+    DataProcessorType& processor;
+    BlockingRing<DeliveredPayload> ring;
+    std::thread thread;
+
+    void run() {
+        DeliveredPayload* payload;
+        while ((payload = ring.front()) != nullptr) {
+            processor.processData(payload->size, payload->data);
+            ring.release();
+        }
+    }
+};
@@ -0,0 +1,114 @@
+#pragma once
+#include <atomic>
+#include <thread>
+#include <cstring>
+#include <type_traits>
+#include "SpscRing.hpp"
+#include "Protocol.hpp"
+
+const int PRODUCER_POLL_US = 100;   // how often to look at an empty ring if the connection can't watch wakeFd()
+
+// One payload read ahead by PacketProducer
+struct ProducedPayload {
+    uint32_t size;          // bytes in data, 0 marks the end of the data
+    uint32_t sum;           // checksum_partial() of data, or with CAP_CRC32C its payload_crc(), for sealPacket()
+    char data[MAX_PAYLOAD_SIZE];
+};
+
+// Payloads another thread readies for StreamSender's send loop, which must never block on them, or it would stop
+// handling ACKs and retransmits: PacketProducer, or a shard's share of the data (ShardSource). ready() is false
+// until the next payload (or the end) is there; the loop then sleeps in NetworkConnection::wait() with wakeFd()
+// watched, between prepareWait() and endWait(), as on a BlockingRing.
+class PayloadSource {
+public:
+    virtual ~PayloadSource() {}
+
+    virtual bool ready() = 0;
+    // Copies the next payload into buffer and sets *sum to what sealPacket() takes for it: its checksum_partial(),
+    // or with crc (CAP_CRC32C) its payload_crc(). Returns its size, 0 at the end of the data, which stays.
+    virtual size_t take(char* buffer, bool crc, uint32_t* sum) = 0;
+
+    virtual int wakeFd() = 0;
+    virtual bool prepareWait() = 0;
+    virtual void endWait() = 0;
+};
+
+// The provider itself if it is a PayloadSource, nullptr if it is only a DataProvider
+template<typename T>
+PayloadSource* payloadSource(T& provider, std::true_type) {
+    return &provider;
+}
+template<typename T>
+PayloadSource* payloadSource(T&, std::false_type) {
+    return nullptr;
+}
+
+// Reads the DataProvider on its own thread, so file I/O and checksumming overlap with the send loop.
+//
+// The thread fills a BlockingRing of ProducedPayloads up to `capacity` packets ahead of StreamSender, which reads
+// it as a PayloadSource. The ring is allocated once, so the steady state makes no allocations.
+template<typename DataProviderType>
+class PacketProducer : public PayloadSource {
+public:
+    PacketProducer(DataProviderType& provider, size_t capacity, bool crc=false, size_t payload_size=PAYLOAD_SIZE)
+        : provider(provider), ring(capacity), crc(crc), payload_size(payload_size) {}
+
+    ~PacketProducer() {
+        stop();
+    }
+
+    bool start() {
+        if (!ring.open(true)) return false;
+        thread = std::thread(&PacketProducer::run, this);
+        return true;
+    }
+
+    void stop() {
+        if (thread.joinable()) {
+            ring.cancel();
+            thread.join();
+        }
+    }
+
+    bool ready() override {
+        return ring.poll() != nullptr;
+    }
+    // The thread already summed the payload, as the constructor's crc asked
+    size_t take(char* buffer, bool, uint32_t* sum) override {
+        ProducedPayload* payload = ring.poll();
+        size_t size = payload->size;
+        std::memcpy(buffer, payload->data, size);
+        *sum = payload->sum;
+        if (size > 0) ring.release();   // the end marker stays, so later calls see it too
+        return size;
+    }
+
+    int wakeFd() override {
+        return ring.wakeFd();
+    }
+    bool prepareWait() override {
+        return ring.prepareWait();
+    }
+    void endWait() override {
+        ring.endWait();
+    }
+
+private:
+    DataProviderType& provider;
+    BlockingRing<ProducedPayload> ring;
+    bool crc;               // CAP_CRC32C: compute payload_crc() instead of checksum_partial()
+    size_t payload_size;    // negotiated payload size, what each getData() asks for
+    std::thread thread;
+
+    void run() {
+        ProducedPayload* payload;
+        while ((payload = ring.claim()) != nullptr) {
+            int size = provider.getData(payload_size, payload->data);
+            payload->size = (size > 0) ? size : 0;
+            payload->sum = crc ? payload_crc(payload->data, payload->size) : checksum_partial(payload->data, payload->size);
+            bool done = (payload->size == 0);
+            ring.publish();
+            if (done) break;
+        }
+    }
+};
@@ -0,0 +1,47 @@
+#pragma once
+#include "Protocol.hpp"
+#include "Statistics.hpp"
+
+// Compile-time switches for StreamSender and StreamReceiver, so a build that doesn't need debug output, statistics
+// or checksum verification doesn't pay for them on every packet. A policy bundles one of each:
+//   Trace      whether the if (debug) branches are compiled in at all
+//   Stats      SenderStats, or NoStats, whose calls compile to nothing
+//   Integrity  how a received DATA packet or ACK is checked: Verified checks its checksum or CRC32C, Trusted
+//              relies on the UDP checksum the kernel already checked, and only checks the length and strips the trailer
+// The handshake and FIN exchange are always checked. MainStreamer and MainReceiver pick one of the
+// policies at the bottom at runtime, with --debug and --lean.
+
+struct Tracing {
+    static constexpr bool enabled = true;
+};
+
+struct Silent {
+    static constexpr bool enabled = false;
+};
+
+struct Verified {
+    static inline ssize_t check(void* packet, ssize_t len, bool crc) {
+        return checkPacket(packet, len, crc);
+    }
+};
+
+struct Trusted {
+    static inline ssize_t check(void* packet, ssize_t len, bool crc) {
+        (void) packet;
+        if (len < (ssize_t) (sizeof(PacketHeader) + (crc ? CRC32C_SIZE : 0))) {
+            return -1;
+        }
+        return crc ? len - CRC32C_SIZE : len;
+    }
+};
+
+template<typename TraceType, typename StatsType, typename IntegrityType>
+struct StreamPolicy {
+    typedef TraceType Trace;
+    typedef StatsType Stats;
+    typedef IntegrityType Integrity;
+};
+
+typedef StreamPolicy<Tracing, SenderStats, Verified> DebugPolicy;     // --debug
+typedef StreamPolicy<Silent, SenderStats, Verified> DefaultPolicy;
+typedef StreamPolicy<Silent, NoStats, Trusted> LeanPolicy;            // --lean
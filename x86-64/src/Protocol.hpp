@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <cstddef>
 #include <vector>
 #include <chrono>
 #include <arpa/inet.h>
@@ -11,25 +12,71 @@
 #include <iostream>
 #include <fstream>
 #include <cstdio>
+#include <cstring>
+#include "Checksum.hpp"
+#include "Crc32c.hpp"
 
 
-const int PAYLOAD_SIZE       = 2500;  // bytes of payload in DATA packets
+const int PAYLOAD_SIZE       = 2500;  // default bytes of payload in DATA packets, the sender can ask for others
 const int WINDOW_SIZE        = 10000;     // default sliding window size
-const int DEFAULT_MAX_PACKETS = 1000000;   // default number of packets in dummy mode
-const int TIMEOUT_MS         = 100;   // retransmission timeout (ms)
+const int MAX_WINDOW_SIZE    = 65535;     // DATA headers carry the window in 16 bits
+const int TIMEOUT_MS         = 100;   // initial retransmission timeout, before the first RTT sample (ms)
+const int MIN_RTO_US         = 1000;  // adaptive retransmission timeout bounds, see RttEstimator
+const int MAX_RTO_MS         = 1000;
 const int HANDSHAKE_TIMEOUT_MS = 1000; // handshake timeout (ms)
 
 const int BUFFER_SIZE = 1024;
+const int SEND_BATCH_SIZE = 64;      // max datagrams handed to the kernel per sendBatch() call
+const int RECV_BATCH_SIZE = 64;      // default and largest number of datagrams drained per receiveBatch() call
 
 constexpr char HANDSHAKE[13]  = "STREAM_START";
 constexpr size_t HANDSHAKE_SIZE = sizeof(HANDSHAKE);
 
+// Path MTU probe: before its HANDSHAKE a sender may send PROBE padded to the datagram size it wants to try,
+// with fragmentation disabled. The receiver answers PROBE followed by the received length (uint32_t, network
+// order). Older receivers drop probes as a malformed handshake, and the sender keeps its default payload size.
+constexpr char PROBE[13] = "STREAM_PROBE";
+constexpr size_t PROBE_SIZE = sizeof(PROBE);
+const int PROBE_REPLY_SIZE = PROBE_SIZE + sizeof(uint32_t);
+const int PROBE_TIMEOUT_MS = 100;   // wait for each probe's answer
+const int PROBE_ATTEMPTS = 3;       // unanswered probes of one size before it counts as too large
+
+// --- Capabilities ---
+// A sender appends the Capabilities it asks for to HANDSHAKE, and the receiver appends the ones both sides
+// will use to its negotiation packet. Older peers send the bare HANDSHAKE and the 4 byte negotiation packet,
+// which means no capabilities.
+const uint32_t CAP_SACK = 1 << 0;   // receiver reports holes with FLAG_SACK instead of one FLAG_NACK each
+const uint32_t CAP_FEC  = 1 << 1;   // sender adds FLAG_PARITY packets, see Fec.hpp
+const uint32_t CAP_CRC32C = 1 << 2; // every packet after the handshake ends in a CRC32C instead of the header checksum
+const uint32_t SUPPORTED_CAPS = CAP_SACK | CAP_FEC | CAP_CRC32C;
+
+#pragma pack(push, 1)
+struct Capabilities {
+    uint32_t flags;         // CAP_* bits (network order)
+    uint8_t fec_data;       // CAP_FEC: data packets per parity group
+    uint8_t fec_parity;     // CAP_FEC: most parity packets per group
+    uint32_t initial_seq;   // first DATA sequence number (network order). Only sent when it isn't 0,
+                            // or with payload_size, and a receiver that echoes it back starts there too
+    uint16_t payload_size;  // DATA payload bytes the sender asks for (network order). Only sent when it isn't
+                            // PAYLOAD_SIZE; the receiver echoes what it agreed to, which is also in the packet size
+};
+#pragma pack(pop)
+
+const int CAPS_SIZE = offsetof(Capabilities, initial_seq);     // Capabilities without initial_seq
+const int ISN_CAPS_SIZE = offsetof(Capabilities, payload_size); // ... without payload_size
+const int CAPS_HANDSHAKE_SIZE = HANDSHAKE_SIZE + CAPS_SIZE;
+const int ISN_HANDSHAKE_SIZE = HANDSHAKE_SIZE + ISN_CAPS_SIZE;
+const int PAYLOAD_HANDSHAKE_SIZE = HANDSHAKE_SIZE + sizeof(Capabilities);
+const int NEGOTIATION_SIZE = 2 * sizeof(uint16_t);
+const int CAPS_NEGOTIATION_SIZE = NEGOTIATION_SIZE + CAPS_SIZE;
+const int ISN_NEGOTIATION_SIZE = NEGOTIATION_SIZE + ISN_CAPS_SIZE;
+const int PAYLOAD_NEGOTIATION_SIZE = NEGOTIATION_SIZE + sizeof(Capabilities);
+const int CAPS_HANDSHAKE_ATTEMPTS = 3;  // unanswered extended handshakes before trying the bare one
+
 const int SENDER_ACK_WAIT_US = 1000;
 static_assert(SENDER_ACK_WAIT_US < 1000000, "timeval constructed with 1000*1000 us will fail.");
-const int SENDER_SUBSEQUENT_ACK_WAIT_US = std::max(SENDER_ACK_WAIT_US / 100, 1);        // Don't wait 0
 
-const int SENDER_STREAMING_WAIT_US = 10; // FIXME: Setting to zero breaks things..
-const int RETRY_MS = 1;
+const int RECEIVER_IDLE_WAIT_MS = 100;  // longest the receiver blocks on an idle socket before reporting stats
 const int RETRY_ACK_US = 100000;
 
 enum ExecutionMode {
@@ -44,7 +91,9 @@ enum ControlFlag {
     FLAG_ACK      = 1,
     FLAG_NACK     = 2,
     FLAG_FIN      = 3,
-    FLAG_FIN_ACK  = 4
+    FLAG_FIN_ACK  = 4,
+    FLAG_SACK     = 5,    // cumulative ACK in seq_num, followed by SackBlocks of missing packets
+    FLAG_PARITY   = 6     // FEC parity: seq_num is the group's first packet, window_size the parity row
 };
 
 // --- Packed packet header ---
@@ -57,39 +106,145 @@ struct PacketHeader {
 };
 #pragma pack(pop)
 
+const int CRC32C_SIZE = sizeof(uint32_t);
+
+// Largest payload a sender may ask for: a whole Packet, trailer included, fits one 9000 byte jumbo frame
+// after the IPv4 and UDP headers
+const int MAX_DATAGRAM_SIZE = 9000 - 20 - 8;
+const int MAX_PAYLOAD_SIZE = MAX_DATAGRAM_SIZE - sizeof(PacketHeader) - CRC32C_SIZE;
+
 #pragma pack(push, 1)
 struct Packet {
     PacketHeader header;
-    char data[PAYLOAD_SIZE];
+    char data[MAX_PAYLOAD_SIZE];    // the negotiated payload size is at most this
+    char trailer[CRC32C_SIZE];      // room for the CAP_CRC32C trailer after a full payload
+};
+#pragma pack(pop)
+
+// A header-only packet with room for its CAP_CRC32C trailer
+#pragma pack(push, 1)
+struct ControlPacket {
+    PacketHeader header;
+    char trailer[CRC32C_SIZE];
+};
+#pragma pack(pop)
+
+// FLAG_SACK payload: the missing range [start, end), network order. Blocks are in ascending order
+// and everything between them, up to the end of the last block, has been received.
+#pragma pack(push, 1)
+struct SackBlock {
+    uint32_t start;
+    uint32_t end;
 };
 #pragma pack(pop)
 
+const int MAX_SACK_BLOCKS = 64;     // per FLAG_SACK packet, any further holes go in the next one
+const int MIN_PAYLOAD_SIZE = MAX_SACK_BLOCKS * sizeof(SackBlock);   // smallest payload a sender may ask for
+static_assert(MIN_PAYLOAD_SIZE <= PAYLOAD_SIZE && PAYLOAD_SIZE <= MAX_PAYLOAD_SIZE, "default payload size out of range");
+
+// --- Sequence number arithmetic (RFC 1982) ---
+// Sequence numbers wrap around at 2^32, so a stream can run forever. They are only ever compared
+// through these: a is before b if b is less than 2^31 ahead of it.
+inline bool seqBefore(uint32_t a, uint32_t b) {
+    return (int32_t) (a - b) < 0;
+}
+inline uint32_t seqMax(uint32_t a, uint32_t b) {
+    return seqBefore(a, b) ? b : a;
+}
+inline uint32_t seqMin(uint32_t a, uint32_t b) {
+    return seqBefore(a, b) ? a : b;
+}
+
 const int HEADER_SIZE        = sizeof(PacketHeader);
 
-const int DATA_PACKET_SIZE   = HEADER_SIZE + PAYLOAD_SIZE;  // full DATA packet size
+const int DATA_PACKET_SIZE   = HEADER_SIZE + PAYLOAD_SIZE;  // full DATA packet size, with the default payload
 const int CTRL_PACKET_SIZE   = HEADER_SIZE;                 // control packets contain only header
 
 
 // --- Simple Internet checksum (RFC1071 style) ---
-inline uint16_t compute_checksum(const void* data, size_t len) {
-    uint32_t sum = 0;
-    const uint16_t* ptr = reinterpret_cast<const uint16_t*>(data);
-    while(len > 1) {
-        sum += *ptr++;
-        len -= 2;
-    }
-    if(len > 0)
-        sum += *(const uint8_t*)ptr;
+// The unfolded one's complement sum of data, the part of compute_checksum() that can be done ahead of time.
+// SIMD where the CPU has it, see Checksum.hpp.
+inline uint32_t checksum_partial(const void* data, size_t len) {
+    return csum::dispatch().sum(data, len);
+}
+
+// Copies len bytes from src to dst and returns their checksum_partial(), in one pass over the data
+inline uint32_t checksum_copy(void* dst, const void* src, size_t len) {
+    return csum::dispatch().copy_sum(dst, src, len);
+}
+
+inline uint16_t checksum_finish(uint32_t sum) {
     while(sum >> 16)
         sum = (sum & 0xFFFF) + (sum >> 16);
     return static_cast<uint16_t>(~sum);
 }
 
-inline bool verifyChecksum(Packet* packet, ssize_t length) {
-    uint16_t temp = packet->header.checksum;
-    packet->header.checksum = 0;
+inline uint16_t compute_checksum(const void* data, size_t len) {
+    return checksum_finish(checksum_partial(data, len));
+}
+
+// compute_checksum() of a DATA packet from its header (checksum field zeroed) and the checksum_partial()
+// of its payload. The payload starts at an odd offset, which swaps the bytes of its share of the sum.
+inline uint16_t packet_checksum(const PacketHeader* header, uint32_t payload_sum) {
+    static_assert(sizeof(PacketHeader) % 2 == 1, "payload sum is byte swapped for an odd header size");
+    while(payload_sum >> 16)
+        payload_sum = (payload_sum & 0xFFFF) + (payload_sum >> 16);
+    uint32_t swapped = ((payload_sum & 0xFF) << 8) | (payload_sum >> 8);
+    return checksum_finish(checksum_partial(header, sizeof(PacketHeader)) + swapped);
+}
+
+inline bool verifyChecksum(void* packet, ssize_t length) {
+    PacketHeader* header = static_cast<PacketHeader*>(packet);
+    uint16_t temp = header->checksum;
+    header->checksum = 0;
     uint16_t computed = htons(compute_checksum(packet, length));
     bool match = (temp == computed);
-    packet->header.checksum = temp;
+    header->checksum = temp;
     return match;
+}
+
+// --- CRC32C trailer (CAP_CRC32C) ---
+// Covers the payload, then the header with its checksum field 0, so the payload's share can be computed
+// before the header exists, as PacketProducer does. Sent in network order after the payload.
+inline uint32_t payload_crc(const void* data, size_t len) {
+    return crc32c::extend(~0u, data, len);
+}
+
+inline uint32_t packet_crc(const PacketHeader* header, uint32_t payload_crc) {
+    return ~crc32c::extend(payload_crc, header, sizeof(PacketHeader));
+}
+
+// Fills in the header checksum of a packet of len bytes, or with crc, appends its CRC32C trailer.
+// payload_sum is the payload's checksum_partial() or payload_crc(), if it is already known.
+// Returns the length to send.
+inline size_t sealPacket(void* packet, size_t len, bool crc, const uint32_t* payload_sum=nullptr) {
+    PacketHeader* header = static_cast<PacketHeader*>(packet);
+    const char* payload = static_cast<const char*>(packet) + sizeof(PacketHeader);
+    size_t payload_len = len - sizeof(PacketHeader);
+    header->checksum = 0;
+    if (crc) {
+        uint32_t sum = payload_sum ? *payload_sum : payload_crc(payload, payload_len);
+        uint32_t net_crc = htonl(packet_crc(header, sum));
+        std::memcpy(static_cast<char*>(packet) + len, &net_crc, CRC32C_SIZE);
+        return len + CRC32C_SIZE;
+    }
+    header->checksum = htons(payload_sum ? packet_checksum(header, *payload_sum) : compute_checksum(packet, len));
+    return len;
+}
+
+// Checks a received packet of len bytes. Returns its length without the trailer, or -1 if it is corrupted.
+inline ssize_t checkPacket(void* packet, ssize_t len, bool crc) {
+    if (!crc) {
+        return verifyChecksum(packet, len) ? len : -1;
+    }
+    len -= CRC32C_SIZE;
+    PacketHeader* header = static_cast<PacketHeader*>(packet);
+    if (len < (ssize_t) sizeof(PacketHeader) || header->checksum != 0) {
+        return -1;
+    }
+    uint32_t net_crc;
+    std::memcpy(&net_crc, static_cast<char*>(packet) + len, CRC32C_SIZE);
+    const char* payload = static_cast<const char*>(packet) + sizeof(PacketHeader);
+    uint32_t computed = packet_crc(header, payload_crc(payload, len - sizeof(PacketHeader)));
+    return (ntohl(net_crc) == computed) ? len : -1;
 }
\ No newline at end of file
@@ -0,0 +1,233 @@
+#pragma once
+#include <cstring>
+#include <string>
+#include <iostream>
+#include <algorithm>
+#include "NetworkConnection.hpp"
+
+// Raw Ethernet frames as emitted by the HLS data_proc packetizer (Vitis HLS codes/Packetizer):
+// 185 64-bit words per frame. The first two words are the header, [dst x6 | src x6 | ethertype 0xAEFE | 0 0],
+// and the remaining 183 words are payload.
+const uint16_t HLS_ETHERTYPE = 0xAEFE;
+const size_t HLS_FRAME_WORDS = 185;
+const size_t HLS_HEADER_SIZE = 16;      // 14 byte Ethernet header, padded to two words
+const size_t HLS_FRAME_SIZE = HLS_FRAME_WORDS * 8;
+const size_t HLS_PAYLOAD_SIZE = HLS_FRAME_SIZE - HLS_HEADER_SIZE;
+
+#ifdef __linux__
+#include <errno.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+// TPACKET_V3 receive ring: the kernel fills whole blocks with frames and hands each block over at once,
+// either when it is full or RAW_BLOCK_TIMEOUT_MS after its first frame.
+const unsigned RAW_BLOCK_SIZE = 1 << 20;
+const unsigned RAW_BLOCK_COUNT = 16;
+const unsigned RAW_FRAME_SIZE = 2048;   // only sizes tp_frame_nr, V3 packs frames by their real length
+const unsigned RAW_BLOCK_TIMEOUT_MS = 8;
+
+// NetworkConnection on an AF_PACKET socket that receives the frames of one ethertype on one interface,
+// through a TPACKET_V3 mmap ring. receive()/receiveBatch() copy frame payloads (everything after the 16 byte
+// HLS header) straight out of the ring, so there is no syscall per frame, only wait() when the ring is empty.
+// send() builds an HLS style frame around the payload, which is how frames are injected for testing.
+//
+// Needs CAP_NET_RAW. The frames' own headers are not checked beyond the ethertype the kernel filters on.
+class RawEthernetConnection : public NetworkConnection {
+public:
+    RawEthernetConnection() {}
+    RawEthernetConnection(const std::string& interface, uint16_t ethertype=HLS_ETHERTYPE) {
+        setup(interface, ethertype);
+    }
+
+    void setup(const std::string& interface, uint16_t ethertype=HLS_ETHERTYPE) {
+        this->interface = interface;
+        this->ethertype = ethertype;
+    }
+
+    bool open() override {
+        unsigned ifindex = if_nametoindex(interface.c_str());
+        if (ifindex == 0) {
+            perror(("no interface " + interface).c_str());
+            return false;
+        }
+        // Protocol 0 until the ring is set up, so nothing is queued outside of it
+        sockfd = socket(AF_PACKET, SOCK_RAW | SOCK_NONBLOCK, 0);
+        if (sockfd < 0) {
+            perror("AF_PACKET socket failed (needs CAP_NET_RAW)");
+            return false;
+        }
+        int version = TPACKET_V3;
+        if (setsockopt(sockfd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+            perror("PACKET_VERSION TPACKET_V3 failed");
+            close();
+            return false;
+        }
+#ifdef PACKET_IGNORE_OUTGOING
+        // Our own send()s, and on loopback everything sent, would otherwise show up twice
+        int ignore = 1;
+        setsockopt(sockfd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &ignore, sizeof(ignore));
+#endif
+        tpacket_req3 req = {};
+        req.tp_block_size = RAW_BLOCK_SIZE;
+        req.tp_block_nr = RAW_BLOCK_COUNT;
+        req.tp_frame_size = RAW_FRAME_SIZE;
+        req.tp_frame_nr = RAW_BLOCK_SIZE / RAW_FRAME_SIZE * RAW_BLOCK_COUNT;
+        req.tp_retire_blk_tov = RAW_BLOCK_TIMEOUT_MS;
+        if (setsockopt(sockfd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+            perror("PACKET_RX_RING failed");
+            close();
+            return false;
+        }
+        ring = (char*) mmap(nullptr, ring_size(), PROT_READ | PROT_WRITE, MAP_SHARED, sockfd, 0);
+        if (ring == MAP_FAILED) {
+            ring = nullptr;
+            perror("packet ring mmap failed");
+            close();
+            return false;
+        }
+        block = 0;
+        frame = nullptr;
+
+        sockaddr_ll addr = {};
+        addr.sll_family = AF_PACKET;
+        addr.sll_protocol = htons(ethertype);
+        addr.sll_ifindex = ifindex;
+        if (bind(sockfd, (sockaddr*) &addr, sizeof(addr)) < 0) {
+            perror("bind to interface failed");
+            close();
+            return false;
+        }
+        poller.open(sockfd);
+        std::cout << "Raw socket for ethertype 0x" << std::hex << ethertype << std::dec << " on " << interface << std::endl;
+        return true;
+    }
+
+    bool close() override {
+        if (ring) munmap(ring, ring_size());
+        ring = nullptr;
+        if (sockfd >= 0) {
+            poller.close();
+            ::close(sockfd);
+        }
+        sockfd = -1;
+        return true;
+    }
+
+    // Sends len bytes of payload (at most HLS_PAYLOAD_SIZE) in a broadcast frame laid out like data_proc's
+    ssize_t send(void* packet, size_t len) override {
+        len = std::min(len, HLS_PAYLOAD_SIZE);
+        std::memset(send_frame, 0, HLS_HEADER_SIZE);
+        std::memset(send_frame, 0xFF, ETH_ALEN);
+        send_frame[2 * ETH_ALEN] = ethertype >> 8;
+        send_frame[2 * ETH_ALEN + 1] = ethertype & 0xFF;
+        std::memcpy(send_frame + HLS_HEADER_SIZE, packet, len);
+        ssize_t sent = ::send(sockfd, send_frame, HLS_HEADER_SIZE + len, 0);
+        return (sent < 0) ? -1 : sent - (ssize_t) HLS_HEADER_SIZE;
+    }
+
+    ssize_t receive(void* buffer, size_t len) override {
+        iovec iov = {buffer, len};
+        ssize_t length;
+        return (receiveBatch(&iov, &length, 1) == 1) ? length : -1;
+    }
+
+    // Copies the payload of up to n frames out of the ring. -1 with errno EAGAIN if the ring is empty.
+    int receiveBatch(iovec* buffers, ssize_t* lengths, size_t n) override {
+        size_t received = 0;
+        while (received < n && nextFrame()) {
+            tpacket3_hdr* hdr = reinterpret_cast<tpacket3_hdr*>(frame);
+            if (hdr->tp_snaplen >= HLS_HEADER_SIZE) {
+                size_t length = std::min((size_t) hdr->tp_snaplen - HLS_HEADER_SIZE, buffers[received].iov_len);
+                std::memcpy(buffers[received].iov_base, frame + hdr->tp_mac + HLS_HEADER_SIZE, length);
+                lengths[received++] = length;
+            } else {
+                runts++;
+            }
+            advanceFrame();
+        }
+        if (received == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+        return received;
+    }
+
+    bool ready(timeval tv) override {
+        if (nextFrame()) return true;
+        return poller.wait(tv) & POLL_READABLE;
+    }
+    int wait(std::chrono::steady_clock::time_point deadline, bool writable=false) override {
+        if (!writable && nextFrame()) return POLL_READABLE;
+        return poller.wait(deadline, writable);
+    }
+    bool watch(int fd) override {
+        return poller.watch(fd);
+    }
+
+    // Frames the kernel dropped because the ring was full, since the last call
+    unsigned drops() {
+        tpacket_stats_v3 stats = {};
+        socklen_t len = sizeof(stats);
+        if (getsockopt(sockfd, SOL_PACKET, PACKET_STATISTICS, &stats, &len) < 0) return 0;
+        return stats.tp_drops;
+    }
+    // Frames too short to hold the HLS header, skipped
+    uint64_t runts = 0;
+
+protected:
+    std::string interface;
+    uint16_t ethertype = HLS_ETHERTYPE;
+    int sockfd = -1;
+    EventPoller poller;
+
+    char* ring = nullptr;
+    unsigned block = 0;         // block being read
+    char* frame = nullptr;      // next frame in that block, nullptr before the block is handed over
+    unsigned frames_left = 0;   // frames left in that block, including frame
+    char send_frame[HLS_FRAME_SIZE];
+
+    size_t ring_size() {
+        return (size_t) RAW_BLOCK_SIZE * RAW_BLOCK_COUNT;
+    }
+    tpacket_block_desc* blockDesc() {
+        return reinterpret_cast<tpacket_block_desc*>(ring + (size_t) block * RAW_BLOCK_SIZE);
+    }
+
+    // Points frame at the next frame to read, if the kernel has handed its block over
+    bool nextFrame() {
+        while (!frame) {
+            tpacket_block_desc* desc = blockDesc();
+            if (!(__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) return false;
+            frames_left = desc->hdr.bh1.num_pkts;
+            if (frames_left == 0) {
+                releaseBlock();
+                continue;
+            }
+            frame = reinterpret_cast<char*>(desc) + desc->hdr.bh1.offset_to_first_pkt;
+        }
+        return true;
+    }
+
+    void advanceFrame() {
+        tpacket3_hdr* hdr = reinterpret_cast<tpacket3_hdr*>(frame);
+        if (--frames_left == 0) {
+            releaseBlock();
+        } else {
+            frame += hdr->tp_next_offset;
+        }
+    }
+
+    // Hands the block back to the kernel and moves on to the next one
+    void releaseBlock() {
+        __atomic_store_n(&blockDesc()->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        block = (block + 1) % RAW_BLOCK_COUNT;
+        frame = nullptr;
+    }
+};
+
+#endif
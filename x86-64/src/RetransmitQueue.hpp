@@ -0,0 +1,88 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include "SlidingWindow.hpp"
+
+// Intrusive FIFO of in-flight packets, ordered by when they were last sent.
+// Every packet shares the same retransmission timeout, so send order is also deadline order:
+// only packets at the head can have expired, and the timeout scan never looks past the first live one.
+//
+// The links are sequence numbers stored in the InfoType slots themselves (prev_seq, next_seq, queued),
+// so queueing a packet never allocates. Packets must be removed before the window advances past them.
+template <typename InfoType>
+class RetransmitQueue {
+public:
+    RetransmitQueue(SlidingWindow<InfoType>& window) : window(window) {}
+
+    // Append seq_num at the tail, unlinking it first if it was already queued.
+    void push(uint32_t seq_num, InfoType* info) {
+        remove(seq_num, info);
+        if (count == 0) {
+            head = seq_num;
+        } else {
+            window.get(tail)->next_seq = seq_num;
+            info->prev_seq = tail;
+        }
+        tail = seq_num;
+        info->queued = true;
+        count++;
+    }
+
+    // Insert seq_num at the head, for packets whose deadline has already passed.
+    void pushFront(uint32_t seq_num, InfoType* info) {
+        remove(seq_num, info);
+        if (count == 0) {
+            tail = seq_num;
+        } else {
+            window.get(head)->prev_seq = seq_num;
+            info->next_seq = head;
+        }
+        head = seq_num;
+        info->queued = true;
+        count++;
+    }
+
+    void remove(uint32_t seq_num, InfoType* info) {
+        if (!info->queued) return;
+        if (count > 1) {
+            if (seq_num == head) {
+                head = info->next_seq;
+            } else if (seq_num == tail) {
+                tail = info->prev_seq;
+            } else {
+                window.get(info->prev_seq)->next_seq = info->next_seq;
+                window.get(info->next_seq)->prev_seq = info->prev_seq;
+            }
+        }
+        info->queued = false;
+        count--;
+    }
+
+    // Oldest in-flight packet, nullptr if nothing is in flight.
+    InfoType* front() {
+        return (count == 0) ? nullptr : window.get(head);
+    }
+    uint32_t frontSeq() {
+        return head;
+    }
+
+    InfoType* pop() {
+        InfoType* info = front();
+        if (info) remove(head, info);
+        return info;
+    }
+
+    size_t size() {
+        return count;
+    }
+
+    void clear() {
+        count = 0;
+    }
+
+private:
+    SlidingWindow<InfoType>& window;
+    uint32_t head = 0;
+    uint32_t tail = 0;
+    size_t count = 0;
+};
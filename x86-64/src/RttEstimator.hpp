@@ -0,0 +1,61 @@
+#pragma once
+#include <chrono>
+#include <algorithm>
+#include "Protocol.hpp"
+
+// Smoothed round trip time and retransmission timeout, following Jacobson/Karels (RFC 6298):
+//   first sample R:  SRTT = R, RTTVAR = R/2
+//   later samples:   RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|,  SRTT = 7/8 SRTT + 1/8 R
+//   RTO = SRTT + 4 RTTVAR, clamped to [MIN_RTO_US, MAX_RTO_MS]
+// Until the first sample the RTO is TIMEOUT_MS. Each timeout doubles it; as in Linux, any ACK for new data
+// undoes the back-off, since under heavy loss a sample that satisfies Karn's rule can take a long time to come.
+// Samples must come from packets that were only sent once (Karn's rule); that is up to the caller.
+class RttEstimator {
+public:
+    typedef std::chrono::microseconds usec;
+
+    void sample(usec rtt) {
+        if (rtt.count() <= 0) rtt = usec(1);
+        if (!has_sample) {
+            srtt = rtt;
+            rttvar = rtt / 2;
+            has_sample = true;
+        } else {
+            usec delta = (srtt > rtt) ? srtt - rtt : rtt - srtt;
+            rttvar = (3 * rttvar + delta) / 4;
+            srtt = (7 * srtt + rtt) / 8;
+        }
+        rto = computed();
+    }
+
+    // Exponential back-off after a retransmission timeout
+    void backoff() {
+        rto = clamp(2 * rto);
+    }
+    void resetBackoff() {
+        rto = computed();
+    }
+
+    usec timeout() {
+        return rto;
+    }
+    usec smoothed() {
+        return srtt;
+    }
+    bool sampled() {
+        return has_sample;
+    }
+
+private:
+    bool has_sample = false;
+    usec srtt{0};
+    usec rttvar{0};
+    usec rto{std::chrono::milliseconds(TIMEOUT_MS)};
+
+    usec computed() {
+        return has_sample ? clamp(srtt + 4 * rttvar) : usec(std::chrono::milliseconds(TIMEOUT_MS));
+    }
+    usec clamp(usec value) {
+        return std::min(usec(std::chrono::milliseconds(MAX_RTO_MS)), std::max(usec(MIN_RTO_US), value));
+    }
+};
@@ -0,0 +1,248 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include "SpscRing.hpp"
+#include "PacketConsumer.hpp"
+#include "StreamSender.hpp"
+#include "StreamReceiver.hpp"
+
+// One logical stream split over `shards` independent streams, each with its own port, thread, window and
+// ACK/NACK state, so the protocol work spreads over that many cores.
+//
+// Packets are striped round robin: packet g of the data goes to shard g % shards, on port port + g % shards.
+// On the sender a splitter reads the DataProvider and deals payloads out to one ShardSource per shard; on the
+// receiver every shard delivers into a ShardSink, and the merge takes one payload from each shard in turn,
+// which restores the original order. Both hand payloads between threads through a BlockingRing per shard.
+//
+// Every shard has to use the same payload size, as the splitter cuts the data up before the shards see it,
+// and each shard's receiver takes a short packet for the end of its stream. So shard 0 handshakes first,
+// probing the path if asked to, and the others then ask for exactly the payload size it got.
+
+const size_t SHARD_RING_SIZE = 1024;   // payloads buffered per shard between the threads
+const int MAX_SHARDS = 64;              // -shards: a thread and a port each
+
+// Source of one shard's StreamSender: the payloads the splitter dealt to it. The sender reads it as a PayloadSource,
+// so it never blocks on the ring: a shard that is waiting for the splitter keeps handling its ACKs and
+// retransmits, which is what lets the other shards' windows, and so the splitter, move on.
+class ShardSource : public DataProvider, public PayloadSource {
+public:
+    ShardSource(BlockingRing<DeliveredPayload>* ring) : ring(ring) {}
+
+    // For a plain DataProvider reader, which can wait for the splitter
+    int getData(size_t size, char* buffer) override {
+        DeliveredPayload* payload = ring->front();
+        if (!payload) return 0;     // the splitter reached the end of the data
+        size = std::min(size, (size_t) payload->size);
+        std::memcpy(buffer, payload->data, size);
+        ring->release();
+        return size;
+    }
+
+    bool ready() override {
+        return ring->poll() || ring->ended();
+    }
+    size_t take(char* buffer, bool crc, uint32_t* sum) override {
+        DeliveredPayload* payload = ring->poll();
+        if (!payload) {
+            *sum = 0;
+            return 0;   // the splitter reached the end of the data
+        }
+        // The splitter didn't sum the payload, so sum it on the way into the packet
+        size_t size = payload->size;
+        if (crc) {
+            std::memcpy(buffer, payload->data, size);
+            *sum = payload_crc(buffer, size);
+        } else {
+            *sum = checksum_copy(buffer, payload->data, size);
+        }
+        ring->release();
+        return size;
+    }
+
+    int wakeFd() override {
+        return ring->wakeFd();
+    }
+    bool prepareWait() override {
+        return ring->prepareWait();
+    }
+    void endWait() override {
+        ring->endWait();
+    }
+
+private:
+    BlockingRing<DeliveredPayload>* ring;
+};
+
+// DataProcessor for one shard's StreamReceiver: queues its in-order payloads for the merge
+class ShardSink : public DataProcessor {
+public:
+    ShardSink(BlockingRing<DeliveredPayload>* ring) : ring(ring) {}
+
+    int processData(size_t size, char* buffer) override {
+        DeliveredPayload* payload = ring->claim();
+        payload->size = size;
+        std::memcpy(payload->data, buffer, size);
+        ring->publish();
+        copied += size;
+        return size;
+    }
+
+    size_t takeCopied() override {
+        size_t bytes = copied;
+        copied = 0;
+        return bytes;
+    }
+
+private:
+    BlockingRing<DeliveredPayload>* ring;
+    size_t copied = 0;
+};
+
+
+template<typename DataProviderType, typename NetworkConnectionType, typename Policy=DefaultPolicy>
+class ShardedStreamSender : public StreamSenderInterface {
+public:
+    // makeConnection(i) returns shard i's connection, normally one to receiver_port + i
+    template<typename MakeConnection>
+    ShardedStreamSender(DataProviderType&& provider, MakeConnection makeConnection, size_t shards,
+                        uint32_t window_size=WINDOW_SIZE, bool csv=false, SenderOptions options=SenderOptions())
+            : provider(std::move(provider)) {
+        for (size_t i = 0; i < shards; i++) {
+            rings.emplace_back(new BlockingRing<DeliveredPayload>(SHARD_RING_SIZE));
+            senders.emplace_back(new StreamSender<ShardSource, NetworkConnectionType, Policy>(
+                ShardSource(rings[i].get()), makeConnection(i),
+                window_size, csv, options
+            ));
+        }
+    }
+
+    // Streams every shard on its own thread, FIN included, while this thread splits the data between them
+    int stream() override {
+        for (auto& ring : rings) {
+            if (!ring->open(true)) return -1;
+        }
+        std::vector<std::thread> threads;
+        auto start = [this, &threads](size_t i) {
+            StreamSender<ShardSource, NetworkConnectionType, Policy>* s = senders[i].get();
+            BlockingRing<DeliveredPayload>* ring = rings[i].get();
+            threads.emplace_back([s, ring]() {
+                s->stream();
+                s->teardown();
+                // A shard that failed leaves its payloads behind, keep taking them so the splitter isn't blocked
+                while (ring->front()) {
+                    ring->release();
+                }
+            });
+        };
+        start(0);
+        uint32_t payload_size;
+        while ((payload_size = senders[0]->payloadSize()) == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        for (size_t i = 1; i < senders.size(); i++) {
+            senders[i]->requestPayloadSize(payload_size);
+            start(i);
+        }
+        uint64_t count = 0;
+        for (size_t shard = 0; ; shard = (shard + 1) % rings.size()) {
+            DeliveredPayload* payload = rings[shard]->claim();
+            int size = provider.getData(payload_size, payload->data);
+            if (size <= 0) break;
+            payload->size = size;
+            rings[shard]->publish();
+            count++;
+        }
+        for (auto& ring : rings) {
+            ring->close();
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        return count;
+    }
+
+    // Each shard already finished with its own FIN in stream()
+    int teardown() override {
+        return 0;
+    }
+
+private:
+    DataProviderType provider;
+    std::vector<std::unique_ptr<BlockingRing<DeliveredPayload>>> rings;
+    std::vector<std::unique_ptr<StreamSender<ShardSource, NetworkConnectionType, Policy>>> senders;
+};
+
+
+template<typename DataProcessorType, typename NetworkConnectionType, typename Policy=DefaultPolicy>
+class ShardedStreamReceiver : public StreamReceiverInterface {
+public:
+    // makeConnection(i) returns shard i's connection, normally one on receiver_port + i
+    template<typename MakeConnection>
+    ShardedStreamReceiver(DataProcessorType&& processor, MakeConnection makeConnection, size_t shards,
+                          uint32_t window_size=WINDOW_SIZE, bool csv=false, ReceiverOptions options=ReceiverOptions())
+            : processor(std::move(processor)) {
+        options.process_ring = 0;   // the merge already takes processData() off the shards' threads
+        for (size_t i = 0; i < shards; i++) {
+            rings.emplace_back(new BlockingRing<DeliveredPayload>(SHARD_RING_SIZE));
+            receivers.emplace_back(new StreamReceiver<ShardSink, NetworkConnectionType, Policy>(
+                ShardSink(rings[i].get()), makeConnection(i),
+                window_size, csv, options
+            ));
+        }
+    }
+
+    // Receives every shard on its own thread while this thread merges their payloads back in order
+    int receiveData() override {
+        for (auto& ring : rings) {
+            if (!ring->open()) return -1;
+        }
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < receivers.size(); i++) {
+            StreamReceiver<ShardSink, NetworkConnectionType, Policy>* r = receivers[i].get();
+            BlockingRing<DeliveredPayload>* ring = rings[i].get();
+            threads.emplace_back([r, ring]() {
+                r->receiveData();
+                ring->close();
+            });
+        }
+        // Packet g is the next one from shard g % shards, so the first shard to run dry ends the stream
+        uint64_t count = 0;
+        DeliveredPayload* payload;
+        for (size_t shard = 0; (payload = rings[shard]->front()) != nullptr; shard = (shard + 1) % rings.size()) {
+            processor.processData(payload->size, payload->data);
+            rings[shard]->release();
+            count++;
+        }
+        // If a shard ended early (its receiver failed), the others can be blocked in claim() on full rings.
+        // Drain every ring until its shard closes it, so they all run to their FIN and can be joined.
+        uint64_t dropped = 0;
+        for (auto& ring : rings) {
+            while (ring->front()) {
+                ring->release();
+                dropped++;
+            }
+        }
+        if (dropped > 0) {
+            std::cerr << "A shard ended early, dropped " << dropped << " payloads of the others" << std::endl;
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        return count;
+    }
+
+    int teardown() override {
+        for (auto& receiver : receivers) {
+            receiver->teardown();
+        }
+        return 0;
+    }
+
+private:
+    DataProcessorType processor;
+    std::vector<std::unique_ptr<BlockingRing<DeliveredPayload>>> rings;
+    std::vector<std::unique_ptr<StreamReceiver<ShardSink, NetworkConnectionType, Policy>>> receivers;
+};
@@ -1,77 +1,220 @@
 #pragma once
 #include <stdlib.h>
 #include <cassert>
+#include <vector>
+#include <algorithm>
 #include "Protocol.hpp"
+#include "PacketBuffers.hpp"
+#include "GapTracker.hpp"
 
+// Ring of slots for the sequence numbers [base_seq, base_seq + window_size).
+//
+// The ring has a power of two slots, at least window_size, so seq_num lives in slot seq_num & mask. 2^32 is a
+// multiple of the capacity, so that holds across the wrap too, and everything is compared with serial arithmetic
+// (seqBefore()). The sequence number each slot holds is kept in its own dense array next to the slots: contains()
+// and the tag check in get() read 16 tags per cache line and never touch the slot itself. An empty slot is tagged
+// with a sequence number that has already left the window, which advanceTo() renews for every slot it passes,
+// so no stale tag can come back into bounds after a wrap.
 template <typename PacketType>
 class SlidingWindow {
 public:
-    SlidingWindow(size_t window_size) : window_size(window_size) {
-        assert(window_size <= WINDOW_SIZE);
+    SlidingWindow(size_t window_size) :
+            window_size(window_size), mask(ringSize(window_size) - 1), tags(mask + 1), slots(mask + 1) {
+        assert(window_size > 0 && window_size <= MAX_WINDOW_SIZE);
         clear();
     }
     ~SlidingWindow() {};
     
     PacketType* reserve(uint32_t seq_num) {
         if (!inBounds(seq_num)) return nullptr;
-        NumberedPacket& packet = arr[indexOf(seq_num)];
-        packet.seq_num = seq_num;
-        return &packet.packet;
+        tags[seq_num & mask] = seq_num;
+        return &slots[seq_num & mask];
     }
 
     bool contains(uint32_t seq_num) {
-        return inBounds(seq_num) && arr[indexOf(seq_num)].seq_num == seq_num;
+        return inBounds(seq_num) && tags[seq_num & mask] == seq_num;
     }
 
     PacketType* get(uint32_t seq_num) {
-        if (!inBounds(seq_num)) return nullptr;
-        NumberedPacket& packet = arr[indexOf(seq_num)];
-        if (packet.seq_num == seq_num) return &packet.packet;
-        return nullptr;
+        if (!contains(seq_num)) return nullptr;
+        return &slots[seq_num & mask];
     }
 
     bool erase(uint32_t seq_num) {
         if (!inBounds(seq_num)) return false;
-        arr[indexOf(seq_num)].seq_num = -1;
+        tags[seq_num & mask] = seq_num - capacity();     // same slot, before base_seq
         return true;
     }
     
     bool advanceTo(uint32_t seq_num) {
-        if (seq_num <= base_seq) return false;  // cannot advance backwards.
+        if (!seqBefore(base_seq, seq_num)) return false;  // cannot advance backwards.
+        uint32_t passed = std::min<uint32_t>(seq_num - base_seq, capacity());
+        for (uint32_t seq = seq_num - passed; seq != seq_num; seq++) {
+            tags[seq & mask] = seq;
+        }
         base_seq = seq_num;
-        base = indexOf(base_seq);
         return true;
     }
 
-    void clear() {
-        base = 0;
-        base_seq = 0;
-        // for (int i = 0; i < window_size; i++) {
-        //     arr[i].seq_num = -1;
-        // }
-        arr[0].seq_num = -1;
+    // Empties the window, which then starts at seq_num
+    void clear(uint32_t seq_num=0) {
+        base_seq = seq_num;
+        for (uint32_t seq = seq_num - capacity(); seq != seq_num; seq++) {
+            tags[seq & mask] = seq;
+        }
     }
 
     inline bool inBounds(uint32_t seq_num) {
         // All currently stored elements must have seq_num in bounds!
-        return (seq_num >= base_seq) && (seq_num - base_seq < window_size);
+        // Anything before base_seq wraps around to a distance of at least window_size.
+        return seq_num - base_seq < window_size;
     }
 
-protected:
-    struct NumberedPacket {
-        PacketType packet;
-        uint32_t seq_num;
-    };
+    // Slots in the ring, and each one by index, for setting them up before use
+    inline uint32_t capacity() { return mask + 1; }
+    inline PacketType& slot(size_t i) { return slots[i]; }
 
-    inline size_t indexOf(uint32_t seq_num) {
-        return seq_num % window_size;
-    }
-    inline uint32_t highestSeq() {
-        return base_seq + window_size - 1;
+protected:
+    static uint32_t ringSize(size_t window_size) {
+        uint32_t size = 1;
+        while (size < window_size) size <<= 1;
+        return size;
     }
 
-    size_t base = 0;
     uint32_t base_seq = 0;
     size_t window_size;
-    NumberedPacket arr[WINDOW_SIZE] = {};
+    uint32_t mask;
+    std::vector<uint32_t> tags;         // sequence number held by each slot
+    std::vector<PacketType> slots;
+};
+
+
+// One slot of the receiver's window: its packet buffer, and the NACK state of the last sequence number
+// NACK'd in it. The slot's tag says whether the packet has arrived, so contains() stays a check of the
+// dense tag array, and the NACK state carries its own sequence number: advanceTo() never visits either.
+struct ReceiverSlot {
+    Packet* packet = nullptr;   // the slot's buffer, which holds the packet once the slot is tagged with it
+    uint32_t nack_seq = 0;      // the sequence number nack_tick and nacks are about
+    uint32_t nack_tick = 0;     // when nack_seq was last NACK'd, in wrapping 32-bit microseconds
+    uint32_t nacks = 0;         // NACKs sent for nack_seq
+};
+static_assert(sizeof(ReceiverSlot) <= 24, "receiver slot grew");
+
+
+// The receiver's window: out-of-order packets, stored by pointer so a received datagram can move in
+// without a copy, and the NACK state of the holes between them, in the same record.
+//
+// Every slot owns one Packet buffer, from PacketBuffers once allocate() knows the negotiated packet size.
+// adopt() swaps a full receive buffer into a slot and hands the slot's old buffer back to the caller, who
+// posts it for the next receive. Buffers only ever change places, so the window and the receive batch
+// together always own exactly capacity() + batch buffers.
+//
+// A GapTracker mirrors the tags as one bit per slot, so the holes can be listed with nextMissing()
+// and nextArrived() without testing every sequence number in between.
+class PacketWindow : public SlidingWindow<ReceiverSlot> {
+public:
+    PacketWindow(size_t window_size) : SlidingWindow<ReceiverSlot>(window_size), arrived(capacity()) {}
+
+    // Gives every slot a buffer of packet_size bytes, before the first reserve()
+    bool allocate(size_t packet_size) {
+        if (!buffers.allocate(capacity(), packet_size)) return false;
+        for (uint32_t i = 0; i < capacity(); i++) {
+            slots[i].packet = buffers[i];
+        }
+        return true;
+    }
+
+    Packet* get(uint32_t seq_num) {
+        ReceiverSlot* slot = SlidingWindow<ReceiverSlot>::get(seq_num);
+        return slot ? slot->packet : nullptr;
+    }
+
+    // The slot's own buffer, for seq_num's packet to be written in place
+    Packet* reserve(uint32_t seq_num) {
+        ReceiverSlot* slot = SlidingWindow<ReceiverSlot>::reserve(seq_num);
+        if (!slot) return nullptr;
+        arrived.set(seq_num);
+        return slot->packet;
+    }
+
+    // Store buffer as seq_num. Returns the buffer the slot had, which now belongs to the caller,
+    // or nullptr if seq_num is out of bounds and buffer stays with the caller.
+    Packet* adopt(uint32_t seq_num, Packet* buffer) {
+        ReceiverSlot* slot = SlidingWindow<ReceiverSlot>::reserve(seq_num);
+        if (!slot) return nullptr;
+        arrived.set(seq_num);
+        Packet* old = slot->packet;
+        slot->packet = buffer;
+        return old;
+    }
+
+    bool erase(uint32_t seq_num) {
+        if (!SlidingWindow<ReceiverSlot>::erase(seq_num)) return false;
+        arrived.clear(seq_num);
+        return true;
+    }
+
+    bool advanceTo(uint32_t seq_num) {
+        uint32_t from = base_seq;
+        if (!SlidingWindow<ReceiverSlot>::advanceTo(seq_num)) return false;
+        arrived.clear(from, seq_num);
+        return true;
+    }
+
+    void clear(uint32_t seq_num=0) {
+        SlidingWindow<ReceiverSlot>::clear(seq_num);
+        arrived.reset();
+    }
+
+    // First sequence number in [from, to) that hasn't arrived, or to if they all have.
+    // Nothing outside the window is stored, so anything there counts as missing.
+    uint32_t nextMissing(uint32_t from, uint32_t to) {
+        if (!seqBefore(from, to) || !inBounds(from)) return from;
+        return arrived.nextMissing(from, seqMin(to, base_seq + (uint32_t) window_size));
+    }
+
+    // First sequence number in [from, to) that has arrived, or to: where a hole starting at from ends
+    uint32_t nextArrived(uint32_t from, uint32_t to) {
+        if (!seqBefore(from, to) || !inBounds(from)) return to;
+        uint32_t last = seqMin(to, base_seq + (uint32_t) window_size);
+        uint32_t seq = arrived.nextArrived(from, last);
+        return seq == last ? to : seq;
+    }
+
+    // True if seq_num is missing and wasn't NACK'd within the last RETRY_ACK_US, and stamps it as NACK'd at now.
+    // Out of bounds, there's nothing to go on, so the NACK goes out.
+    bool nack(uint32_t seq_num, uint32_t now) {
+        if (!inBounds(seq_num)) return true;
+        if (tags[seq_num & mask] == seq_num) return false;      // arrived
+        ReceiverSlot& slot = slots[seq_num & mask];
+        if (slot.nack_seq != seq_num) {
+            slot.nack_seq = seq_num;
+            slot.nacks = 0;
+        } else if (slot.nacks > 0 && now - slot.nack_tick <= (uint32_t) RETRY_ACK_US) {
+            return false;
+        }
+        slot.nack_tick = now;
+        slot.nacks++;
+        return true;
+    }
+
+    // Lets seq_num be NACK'd again right away, e.g. after its retransmit arrived corrupted
+    void forgetNack(uint32_t seq_num) {
+        ReceiverSlot& slot = slots[seq_num & mask];
+        if (inBounds(seq_num) && slot.nack_seq == seq_num) {
+            slot.nack_tick = slot.nack_tick - RETRY_ACK_US - 1;
+        }
+    }
+
+    // NACKs sent for seq_num so far
+    uint32_t nacks(uint32_t seq_num) {
+        ReceiverSlot& slot = slots[seq_num & mask];
+        return (inBounds(seq_num) && slot.nack_seq == seq_num) ? slot.nacks : 0;
+    }
+
+    const char* backing() { return buffers.backing(); }
+
+private:
+    PacketBuffers buffers;
+    GapTracker arrived;
 };
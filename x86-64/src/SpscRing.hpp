@@ -0,0 +1,279 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+// Fixed size ring passing slots from exactly one producer thread to exactly one consumer thread.
+//
+// Slots are allocated once and reused: the producer fills the slot from claim() in place and publish()es it,
+// the consumer reads front() in place and release()s it. Neither side takes a lock or allocates. Each side
+// caches the other's index and only reloads it (a cache miss on the other core) when the ring looks full
+// or empty.
+template<typename T>
+class SpscRing {
+public:
+    // capacity is rounded up to a power of two
+    explicit SpscRing(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    size_t capacity() {
+        return slots.size();
+    }
+    // Slots published and not yet released. Reads both indices, so it costs a cache miss: sample it, don't poll it.
+    size_t size() {
+        size_t t = tail.load(std::memory_order_acquire);   // first, head can only have moved further since
+        return head.load(std::memory_order_acquire) - t;
+    }
+
+    // Producer: the next free slot, nullptr if the ring is full
+    T* claim() {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - cached_tail == slots.size()) {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (h - cached_tail == slots.size()) return nullptr;
+        }
+        return &slots[h & mask];
+    }
+    // Producer: hand the claimed slot to the consumer
+    void publish() {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Consumer: the oldest published slot, nullptr if the ring is empty
+    T* front() {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == cached_head) {
+            cached_head = head.load(std::memory_order_acquire);
+            if (t == cached_head) return nullptr;
+        }
+        return &slots[t & mask];
+    }
+    // Consumer: give the front slot back to the producer
+    void release() {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+    std::vector<T> slots;
+    size_t mask;
+    // Producer and consumer state on separate cache lines, so they don't bounce between the cores.
+    // Padded rather than alignas(64), which plain new doesn't honour before C++17.
+    char pad0[64];
+    std::atomic<size_t> head{0};    // next slot to publish, written by the producer
+    size_t cached_tail = 0;
+    char pad1[64];
+    std::atomic<size_t> tail{0};    // next slot to release, written by the consumer
+    size_t cached_head = 0;
+    char pad2[64];
+};
+
+
+// Lets one thread wake another that sleeps in read() or in an EventPoller. An eventfd on Linux, a pipe elsewhere.
+// signal() may be called any number of times before the sleeper runs, drain() clears them all.
+class Wakeup {
+public:
+    bool open(bool nonblocking) {
+        this->nonblocking = nonblocking;
+#ifdef __linux__
+        read_fd = write_fd = eventfd(0, nonblocking ? EFD_NONBLOCK : 0);
+        if (read_fd < 0) {
+            perror("eventfd failed");
+            return false;
+        }
+#else
+        int fds[2];
+        if (pipe(fds) < 0) {
+            perror("pipe failed");
+            return false;
+        }
+        read_fd = fds[0];
+        write_fd = fds[1];
+        fcntl(write_fd, F_SETFL, O_NONBLOCK);   // a full pipe already holds a wakeup
+        if (nonblocking) fcntl(read_fd, F_SETFL, O_NONBLOCK);
+#endif
+        return true;
+    }
+
+    void close() {
+        if (read_fd >= 0) ::close(read_fd);
+        if (write_fd >= 0 && write_fd != read_fd) ::close(write_fd);
+        read_fd = write_fd = -1;
+    }
+
+    int fd() {
+        return read_fd;
+    }
+
+    void signal() {
+#ifdef __linux__
+        uint64_t one = 1;
+        ssize_t r = write(write_fd, &one, sizeof(one));
+#else
+        char one = 1;
+        ssize_t r = write(write_fd, &one, sizeof(one));
+#endif
+        (void) r;
+    }
+
+    // Blocks until signalled if the fd was opened blocking, then clears all pending signals
+    void drain() {
+#ifdef __linux__
+        uint64_t count;
+        ssize_t r = read(read_fd, &count, sizeof(count));
+#else
+        char buf[64];
+        ssize_t r = read(read_fd, buf, sizeof(buf));
+#endif
+        (void) r;
+    }
+
+    // Blocks until signalled, even if the fd was opened nonblocking, then clears all pending signals
+    void wait() {
+        if (nonblocking) {
+            pollfd pfd = {read_fd, POLLIN, 0};
+            poll(&pfd, 1, -1);
+        }
+        drain();
+    }
+
+private:
+    int read_fd = -1;
+    int write_fd = -1;
+    bool nonblocking = false;
+};
+
+
+// SpscRing where the producer sleeps while the ring is full and the consumer while it is empty.
+//
+// Either side only sleeps when it can't go on, after setting its waiting flag. Publishing or releasing a slot
+// reads the other side's flag behind a fence, so a side that is busy costs the other nothing: the wakeup
+// syscall is only paid for a sleeper. A consumer that has other work, like a send loop handling ACKs, doesn't
+// block in front(): it open(true)s the ring, poll()s it, and sleeps in its EventPoller with wakeFd() watched,
+// between prepareWait() and endWait().
+template<typename T>
+class BlockingRing {
+public:
+    explicit BlockingRing(size_t capacity) : ring(capacity) {}
+
+    ~BlockingRing() {
+        data_ready.close();
+        space_ready.close();
+    }
+
+    // consumer_polls: the consumer sleeps on wakeFd() itself, so it is nonblocking
+    bool open(bool consumer_polls=false) {
+        return data_ready.open(consumer_polls) && space_ready.open(false);
+    }
+
+    // Producer: the next free slot, after waiting for one if the ring is full. Sets *waited if it had to.
+    // nullptr once the consumer cancel()led.
+    T* claim(bool* waited=nullptr) {
+        if (cancelled.load(std::memory_order_relaxed)) return nullptr;
+        T* slot;
+        while ((slot = ring.claim()) == nullptr) {
+            if (cancelled.load()) return nullptr;
+            if (waited) *waited = true;
+            producer_waiting.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!ring.claim() && !cancelled.load()) {
+                space_ready.wait();
+            }
+            producer_waiting.store(false, std::memory_order_relaxed);
+        }
+        return slot;
+    }
+    void publish() {
+        ring.publish();
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (consumer_waiting.load(std::memory_order_relaxed)) {
+            data_ready.signal();
+        }
+    }
+    // Producer: nothing more is coming, front() returns nullptr once the ring is drained
+    void close() {
+        closed.store(true);
+        data_ready.signal();
+    }
+
+    // Consumer: the oldest published slot, after waiting for one if the ring is empty. nullptr once closed and drained.
+    T* front() {
+        T* slot;
+        while ((slot = ring.front()) == nullptr) {
+            if (ended()) return nullptr;
+            consumer_waiting.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!ring.front() && !closed.load()) {
+                data_ready.wait();
+            }
+            consumer_waiting.store(false, std::memory_order_relaxed);
+        }
+        return slot;
+    }
+    void release() {
+        ring.release();
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (producer_waiting.load(std::memory_order_relaxed)) {
+            space_ready.signal();
+        }
+    }
+    // Consumer: stop taking slots, so a producer waiting in claim() gets nullptr instead
+    void cancel() {
+        cancelled.store(true);
+        space_ready.signal();
+    }
+
+    // Consumer that doesn't block: the oldest published slot, nullptr if there is none yet or ended()
+    T* poll() {
+        return ring.front();
+    }
+    // Closed and drained. close() comes after the last publish(), so once it is seen an empty ring stays empty.
+    bool ended() {
+        return closed.load() && !ring.front();
+    }
+    // Readable while the consumer should wake up for new slots, watch it with NetworkConnection::watch()
+    int wakeFd() {
+        return data_ready.fd();
+    }
+    // Consumer: call before sleeping on an empty ring. False if a slot or close() came meanwhile, so don't sleep.
+    bool prepareWait() {
+        consumer_waiting.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (ring.front() || closed.load()) {
+            consumer_waiting.store(false, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+    // Consumer: after the sleep, however it ended
+    void endWait() {
+        consumer_waiting.store(false, std::memory_order_relaxed);
+        data_ready.drain();
+    }
+
+    size_t size() {
+        return ring.size();
+    }
+    size_t capacity() {
+        return ring.capacity();
+    }
+
+private:
+    SpscRing<T> ring;
+    Wakeup data_ready;      // producer -> consumer
+    Wakeup space_ready;     // consumer -> producer
+    std::atomic<bool> closed{false};
+    std::atomic<bool> cancelled{false};
+    std::atomic<bool> consumer_waiting{false};
+    std::atomic<bool> producer_waiting{false};
+};
@@ -3,6 +3,9 @@
 #include <stdint.h>
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <string>
+#include <algorithm>
 #include "Protocol.hpp"
 
 using namespace std::chrono;
@@ -14,6 +17,7 @@ public:
         this->csv_mode = csv_mode;
         this->report_percent = csv_mode ? false : report_percent;
         senderText = sender ? "sent" : "received";
+        this->sender = sender;
     };
     ~SenderStats() = default;
 
@@ -24,6 +28,11 @@ public:
         nacks = 0;
         corrupted_packets = 0;
         ignored = 0;
+        recovered = 0;
+        queue_hw = 0;
+        queue_stalls = 0;
+        copied_bytes = 0;
+        rtt_samples.clear();
     }
     void record_packet(uint32_t bytes) {
         data_packets++;
@@ -32,7 +41,7 @@ public:
     void record_ack(uint8_t flag=FLAG_ACK) {
         if (flag == FLAG_ACK) {
             acks++;
-        } else if (flag == FLAG_NACK) {
+        } else if (flag == FLAG_NACK || flag == FLAG_SACK) {
             nacks++;
         }
     }
@@ -42,6 +51,30 @@ public:
     void record_ignored() {
         ignored++;
     }
+    void record_recovered(uint32_t packets) {
+        recovered += packets;
+    }
+    // Receiver processing ring: depth samples, and times it was full and stalled reception
+    void record_queue(uint32_t depth, uint32_t capacity) {
+        queue_hw = std::max(queue_hw, depth);
+        queue_capacity = capacity;
+    }
+    void record_queue_full() {
+        queue_stalls++;
+    }
+    // Payload bytes the receiver copied on their way to the DataProcessor
+    void record_copied(uint32_t bytes) {
+        copied_bytes += bytes;
+    }
+    void record_cwnd(uint32_t window) {
+        cwnd = window;      // a gauge, reported as is and not reset
+    }
+    void record_rto(uint32_t us) {
+        rto_us = us;        // a gauge, like cwnd
+    }
+    void record_rtt(uint32_t us) {
+        rtt_samples.push_back(us);
+    }
     void report(bool final=false) {
         auto now = steady_clock::now();
         auto elapsed = duration_cast<milliseconds>(now - last_stats_time).count();
@@ -59,23 +92,34 @@ public:
             if (csv_mode) {
                 stream << "STATS," << mbps << "," << elapsed << "," 
                         << data_packets << "," << acks << "," << nacks << ","
-                        << corrupted_packets << "," << ignored << std::endl;
+                        << corrupted_packets << "," << ignored;
+                if (sender) {
+                    stream << "," << cwnd << "," << rto_us << "," << rttPercentile(50)
+                           << "," << rttPercentile(90) << "," << rttPercentile(99);
+                } else {
+                    stream << "," << recovered << "," << queue_hw << "," << queue_stalls << "," << copiedPerByte();
+                }
+                stream << std::endl;
             } else if (report_percent) {
                 stream << "[STATISTICS] Throughput: " << mbps << " Mbps, "
                             << "Packets " << senderText << ": " << data_packets 
                             << " ACKS%: " << percent(acks, data_packets)
                             << " NACKS%: " << percent(nacks, data_packets) 
                             << " Corrupted%: " << percent(corrupted_packets, data_packets) 
-                            << " Ignored%: " << percent(ignored, data_packets) 
-                            << std::endl;
+                            << " Ignored%: " << percent(ignored, data_packets);
+                if (sender) reportSender();
+                else stream << " Recovered%: " << percent(recovered, data_packets) << " Copied/B: " << copiedPerByte() << queueText();
+                stream << std::endl;
             } else {
                 stream << "[STATISTICS] Throughput: " << mbps << " Mbps, "
                             << "Packets " << senderText << ": " << data_packets 
                             << " ACKS: " << acks 
                             << " NACKS: " << nacks 
                             << " Corrupted: " << corrupted_packets 
-                            << " Ignored: " << ignored 
-                            << std::endl;
+                            << " Ignored: " << ignored;
+                if (sender) reportSender();
+                else stream << " Recovered: " << recovered << " Copied/B: " << copiedPerByte() << queueText();
+                stream << std::endl;
             }
             last_stats_time = now;
             reset();
@@ -88,19 +132,73 @@ public:
     uint32_t nacks;
     uint32_t corrupted_packets;
     uint32_t ignored;
+    uint32_t recovered;     // packets rebuilt from FEC parity (receiver)
+    uint32_t queue_hw;      // fullest the processing ring was seen this interval (receiver)
+    uint32_t queue_stalls;  // pushes that found the processing ring full (receiver)
+    uint32_t queue_capacity = 0;    // 0 without a processing thread
+    uint64_t copied_bytes;  // see record_copied() (receiver)
+    uint32_t cwnd = 0;
+    uint32_t rto_us = 0;
+    std::vector<uint32_t> rtt_samples;     // RTT samples this interval (us)
     steady_clock::time_point last_stats_time;
 
 private:
     bool report_percent = true;
     bool csv_mode = false;
+    bool sender = true;
     std::string senderText = "";
     std::ostream& stream;
 
+    // Gauges and RTT percentiles (us) that only the sender has
+    void reportSender() {
+        stream << " CWND: " << cwnd << " RTO: " << rto_us
+               << " RTT p50/p90/p99: " << rttPercentile(50) << "/" << rttPercentile(90) << "/" << rttPercentile(99);
+    }
+
+    // Processing ring high watermark, only when the receiver has a processing thread
+    std::string queueText() {
+        if (queue_capacity == 0) return "";
+        return " Queue HW: " + std::to_string(queue_hw) + "/" + std::to_string(queue_capacity) +
+               " Stalls: " + std::to_string(queue_stalls);
+    }
+
+    double copiedPerByte() {
+        return data_bytes ? (double) copied_bytes / data_bytes : 0;
+    }
+
+    // p-th percentile of this interval's RTT samples, 0 if there were none
+    uint32_t rttPercentile(int p) {
+        if (rtt_samples.empty()) return 0;
+        size_t k = std::min(rtt_samples.size() - 1, rtt_samples.size() * p / 100);
+        std::nth_element(rtt_samples.begin(), rtt_samples.begin() + k, rtt_samples.end());
+        return rtt_samples[k];
+    }
+
     float percent(uint32_t stat, uint32_t total) {
         return (float)((stat * 10000) / total) / 100.0;
     } 
 };
 
+// SenderStats' interface with nothing behind it, for builds that don't report (see LeanPolicy)
+class NoStats {
+public:
+    NoStats(bool sender=true, bool csv_mode=false, bool report_percent=true, std::ostream& stream=std::cout) {
+        (void) sender; (void) csv_mode; (void) report_percent; (void) stream;
+    }
+    void record_packet(uint32_t) {}
+    void record_ack(uint8_t=FLAG_ACK) {}
+    void record_corrupted() {}
+    void record_ignored() {}
+    void record_recovered(uint32_t) {}
+    void record_queue(uint32_t, uint32_t) {}
+    void record_queue_full() {}
+    void record_copied(uint32_t) {}
+    void record_cwnd(uint32_t) {}
+    void record_rto(uint32_t) {}
+    void record_rtt(uint32_t) {}
+    void report(bool=false) {}
+};
+
 /*
 
 data_proc(out_stream) {
@@ -1,7 +1,12 @@
 #pragma once
 #include <unordered_map>
+#include <vector>
+#include <memory>
 #include "SlidingWindow.hpp"
 #include "Statistics.hpp"
+#include "Policies.hpp"
+#include "Fec.hpp"
+#include "PacketConsumer.hpp"
 
 // - class StreamReceiver
 //   - setup()
@@ -9,12 +14,31 @@
 //     - Main receive streaming loop
 //     - receivePacket
 //   - receiveData()
-//     - Receive a data packet. Process if in order. Store it in DataWindow if out of order
+//     - Drain a batch of datagrams, then ACK and report stats once per batch
+//   - processReceived()
+//     - Handle one datagram. Process if in order. Store it in DataWindow if out of order,
+//       by swapping its receive buffer with the window slot's
 //   - sendNACK()
+//   - sendSACK()
+//     - With CAP_SACK, one packet per batch listing every hole instead of a NACK per missing seq
+//   - recoverFEC()
+//     - With CAP_FEC, rebuild missing packets from parity instead of asking for them
 //   - sendACK()
+//   - processPacket()
+//     - Deliver one in-order payload to the DataProcessor, or with process_ring, queue it for
+//       the PacketConsumer thread that calls the DataProcessor
 //   - teardown()
 
 
+struct ReceiverOptions {
+    uint32_t batch_size = RECV_BATCH_SIZE;  // max datagrams drained per receiveBatch() call
+    bool sack = true;                       // offer FLAG_SACK in the handshake
+    bool fec = true;                        // accept FEC parity if the sender asks for it
+    uint32_t process_ring = 0;              // in-order packets queued for a processing thread, 0 processes inline
+    bool gro = true;                        // take coalesced datagrams from the kernel if it can
+    bool crc32c = true;                     // accept CRC32C trailers if the sender asks for them
+};
+
 // Small abstraction to allow us to hold a reference to any (templated) StreamReceiver
 class StreamReceiverInterface {
 public:
@@ -23,13 +47,14 @@ public:
     virtual int teardown() = 0;
 };
 
-template<typename DataProcessorType, typename NetworkConnectionType>
+template<typename DataProcessorType, typename NetworkConnectionType, typename Policy=DefaultPolicy>
 class StreamReceiver : public StreamReceiverInterface {
 
 public:
     StreamReceiver(
         DataProcessorType&& processor, NetworkConnectionType&& conn,
-        bool debug, uint32_t window_size=WINDOW_SIZE, bool csv=false
+        uint32_t window_size=WINDOW_SIZE, bool csv=false,
+        ReceiverOptions options=ReceiverOptions()
     );
     ~StreamReceiver();
 
@@ -40,27 +65,53 @@ public:
     DataProcessorType processor;
 
 protected:
-    SlidingWindow<Packet> window;
+    PacketWindow window;        // out-of-order packets, swapped in from recv_buffers without a copy, and NACK state
 
-    typedef std::chrono::time_point<std::chrono::steady_clock> timepoint;
-    SlidingWindow<timepoint> ackTimes;
-    SlidingWindow<timepoint> nackTimes;
+    // ACKs are cumulative and expected_seq only grows, so only the newest one can be a repeat
+    bool ack_sent = false;
+    uint32_t ack_seq = 0;       // seq of the last cumulative ACK sent
+    uint32_t ack_tick = 0;      // and when, in tick()s
 
-    SenderStats stats;
+    typename Policy::Stats stats;
     
-    bool debug = false;
+    static constexpr bool debug = Policy::Trace::enabled;     // the if (debug) branches are only compiled in with Tracing
+    uint32_t initial_seq = 0;   // first sequence number, from the handshake
     uint32_t base = 0;      // lowest unacknowledged sequence number
     uint32_t expected_seq = 0;  // next sequence number to send
     uint32_t window_size;
-    uint32_t lastSeq = -1;
-    uint32_t lastSeqLen = -1;
+    uint32_t lastSeq = 0;
+    uint32_t lastSeqLen = 0;    // 0 until the short last packet arrives out of order
+    uint16_t ack_window = 1;    // cumulative ACK cadence, from the sender's window_size header field, capped at window_size / 4
+    uint32_t last_acked = 0;    // expected_seq carried by the last cumulative ACK
+    bool ack_pending = false;   // a duplicate arrived during this batch, re-ACK after it
+    uint32_t offered_caps;      // capabilities this receiver supports
+    bool sack = false;          // the sender negotiated CAP_SACK
+    bool sack_pending = false;  // a packet arrived out of order during this batch, SACK after it
+    bool crc = false;           // CAP_CRC32C: packets carry a CRC32C trailer instead of the header checksum
+    uint32_t payload_size = PAYLOAD_SIZE;   // negotiated, every DATA packet but the last has this much
+    uint32_t highest_seen = 0;  // one past the highest sequence number received
+    FecDecoder fec;
+    uint32_t process_ring;
+    std::unique_ptr<PacketConsumer<DataProcessorType>> consumer;   // with process_ring
+    bool gro;                   // ask the connection for coalesced datagrams
+
+    size_t batch_size;
+    std::vector<Packet> recv_storage;
+    std::vector<Packet*> recv_buffers; // where the next batch lands, buffers traded with window as packets are stored
 
     int handshake();
+    void answerProbe(const char* probe, ssize_t len);
     int sendACK(uint32_t seq_num, uint8_t flag=FLAG_ACK, bool checkPastACKs=true);
+    int sendSACK(uint32_t end);
+    void reportHoles(uint32_t end);
+    uint32_t holeLimit();
+    int recoverFEC(uint32_t seq_num);
+    bool markSent(uint32_t seq_num, uint8_t flag, uint32_t now);
+    static uint32_t tick();
     bool sendFINACK(uint32_t seq_num);
     int processOutOfOrder(); 
-    bool advanceAllWindows(uint32_t seq_num); 
     bool processPacket(Packet* packet, ssize_t size); 
+    bool processReceived(Packet*& packet, ssize_t recv_len, uint64_t& count);
 };
 
 #include "StreamReceiver_impl.hpp"
\ No newline at end of file
@@ -1,169 +1,344 @@
 #pragma once
-#include <thread>
 #include <cstring>
 #include <cassert>
+#include <vector>
+#include <algorithm>
 #include "StreamReceiver.hpp"
 #include "NetworkConnection.hpp"
 #include "cmn.h"
 
-template<typename DataProcessorType, typename NetworkConnectionType>
-StreamReceiver<DataProcessorType, NetworkConnectionType>::StreamReceiver(
-        DataProcessorType&& processor, NetworkConnectionType&& conn, bool debug, uint32_t window_size, bool csv) :
+template<typename DataProcessorType, typename NetworkConnectionType, typename Policy>
+StreamReceiver<DataProcessorType, NetworkConnectionType, Policy>::StreamReceiver(
+        DataProcessorType&& processor, NetworkConnectionType&& conn, uint32_t window_size, bool csv,
+        ReceiverOptions options) :
             conn(std::move(conn)), processor(std::move(processor)), 
-            window(window_size), ackTimes(window_size), nackTimes(window_size),
-            stats(false, csv, false), debug(debug), window_size(window_size) {
+            window(window_size),
+            stats(false, csv, false), window_size(window_size), process_ring(options.process_ring), gro(options.gro),
+            batch_size(std::max<uint32_t>(options.batch_size, 1)), recv_storage(batch_size), recv_buffers(batch_size) {
+    for (size_t i = 0; i < batch_size; i++) {
+        recv_buffers[i] = &recv_storage[i];
+    }
+    offered_caps = (options.sack ? CAP_SACK : 0) | (options.fec ? CAP_FEC : 0) | (options.crc32c ? CAP_CRC32C : 0);
     static_assert(std::is_base_of<DataProcessorType, DataProcessorType>::value, "type parameter of this class must derive from DataProcessorType");
     static_assert(std::is_base_of<NetworkConnection, NetworkConnectionType>::value, "type parameter of this class must derive from NetworkConnection");
 }
 
-template<typename DataProcessorType, typename NetworkConnectionType>
-StreamReceiver<DataProcessorType, NetworkConnectionType>::~StreamReceiver() {}
+template<typename DataProcessorType, typename NetworkConnectionType, typename Policy>
+StreamReceiver<DataProcessorType, NetworkConnectionType, Policy>::~StreamReceiver() {}
 
-template<typename DataProcessorType, typename NetworkConnectionType>
-int StreamReceiver<DataProcessorType, NetworkConnectionType>::StreamReceiver::receiveData() {
+template<typename DataProcessorType, typename NetworkConnectionType, typename Policy>
+int StreamReceiver<DataProcessorType, NetworkConnectionType, Policy>::StreamReceiver::receiveData() {
     conn.open();
     handshake();
+    // Receive a full DATA packet into each buffer, so coalesced ones are split up without a copy
+    size_t packet_size = HEADER_SIZE + payload_size + (crc ? CRC32C_SIZE : 0);
+    if (gro && !conn.enableCoalescing(batch_size, packet_size) && debug) {
+        std::cout << "No receive coalescing, receiving packets one by one" << std::endl;
+    }
+    // Out-of-order buffers are only mapped now that their size is known, and only faulted in as they fill
+    if (!window.allocate(packet_size)) {
+        std::cerr << "Could not allocate the receive window" << std::endl;
+        return -1;
+    }
+    if (debug) std::cout << "Receive window buffers on " << window.backing() << " pages" << std::endl;
+    if (process_ring > 0) {
+        consumer.reset(new PacketConsumer<DataProcessorType>(processor, process_ring));
+        if (!consumer->start()) {
+            std::cerr << "Could not start the processing thread, processing in the receive loop instead" << std::endl;
+            consumer.reset();
+        }
+    }
 
+    // Sequence numbers wrap around, the stream runs until the sender's FIN
     bool running = true;
-    int count = 0;
-    base = 0;
-    expected_seq = 0;
-    // auto last_nack = steady_clock::now();
-    while (running) {
-        stats.report();
-
-        Packet packet;
-        PacketHeader& header = packet.header;
-        ssize_t recv_len = conn.receive(&packet, sizeof(packet));
+    uint64_t count = 0;
+    base = expected_seq = last_acked = highest_seen = initial_seq;
+    window.clear(initial_seq);
+
+    std::vector<iovec> iov(batch_size);
+    std::vector<ssize_t> lengths(batch_size);
+    for (size_t i = 0; i < batch_size; i++) {
+        iov[i].iov_len = packet_size;
+    }
 
-        if(recv_len < 0) {
-            std::this_thread::sleep_for(microseconds(SENDER_STREAMING_WAIT_US));
-            continue;
+    while (running) {
+        for (size_t i = 0; i < batch_size; i++) {
+            iov[i].iov_base = recv_buffers[i];  // processReceived() may have traded it for a window slot's
         }
-        if(recv_len < HEADER_SIZE) {
-            if(debug)
-                std::cerr << "Received packet too small, ignoring." << std::endl;
+        int received = conn.receiveBatch(iov.data(), lengths.data(), batch_size);
+        if (received < 0) {
+            // The socket is drained: ACK what has arrived so far instead of leaving a partial window to time out
+            // and report the holes that were held back for FEC, no more parity is coming for now
+            if (fec.enabled() && seqBefore(expected_seq, highest_seen)) {
+                reportHoles(highest_seen);
+            }
+            if (expected_seq != last_acked) {
+                last_acked = expected_seq;
+                sendACK(expected_seq);
+            }
+            stats.report();
+            conn.wait(steady_clock::now() + milliseconds(RECEIVER_IDLE_WAIT_MS));
             continue;
         }
 
-        uint32_t seq_num = ntohl(header.seq_num);
-        uint16_t pkt_window = ntohs(header.window_size);
-        uint8_t ctrl_flag = header.control_flags;
+        for (size_t i = 0; i < batch_size; i++) {
+            recv_buffers[i] = static_cast<Packet*>(iov[i].iov_base);   // receiveBatch() may have reordered them
+        }
+        stats.record_copied(conn.takeCopied());
 
-        if (!verifyChecksum(&packet, recv_len)) {
-            if(debug)
-                std::cerr << "Invalid checksum for packet seq " << seq_num << " Len: " << recv_len << ", discarding." << std::endl;
-            stats.record_corrupted();
-            nackTimes.erase(seq_num);  // might want to re-nack this guy!
-            continue;
+        // Process the whole batch first, then send at most one cumulative ACK or SACK for it.
+        ack_pending = false;
+        sack_pending = false;
+        for (int i = 0; i < received && running; i++) {
+            running = processReceived(recv_buffers[i], lengths[i], count);
         }
 
-        bool didntIgnore = false;
+        // A SACK carries the cumulative ACK too, so it replaces the ACK below if it had anything to report
+        if (running && sack_pending && sendSACK(holeLimit())) {
+            if (debug) std::cout << "Sent SACK, cumulative " << expected_seq << std::endl;
+        }
+        // --- Send cumulative ACK once ack_window packets arrived since the last one ---
+        // Counted from the last ACK rather than at multiples of ack_window, which the sender changes
+        // as its congestion window moves.
+        else if (running && (ack_pending || expected_seq - last_acked >= ack_window)) {  // ack_window may not be best
+            last_acked = expected_seq;
+            if (sendACK(expected_seq)) {
+                if (debug) std::cout << "End of window, sending ACK for " << expected_seq << std::endl;
+            }
+        }
 
-        if (ctrl_flag == FLAG_DATA) {
-            if (seq_num == expected_seq) {
-                if(debug)
-                    std::cout << "Processing exp seq " << seq_num << std::endl; 
-                count += processPacket(&packet, recv_len - sizeof(packet.header));
-                count += processOutOfOrder();    // maybe we should send an ACK here if we process many packets?
-
-                assert(advanceAllWindows(expected_seq));
-                didntIgnore = true;
-
-            } else if (seq_num > expected_seq) {
-                if (!window.contains(seq_num)) {
-                    if (recv_len != sizeof(Packet)) {
-                        // This is the last packet, need to save the length to process correctly
-                        lastSeqLen = recv_len;
-                        lastSeq = seq_num;
-                    }
-
-                    Packet* windowPacketInfo = window.reserve(seq_num);
-                    if (windowPacketInfo) {
-                        memcpy(windowPacketInfo, (void*)&packet, sizeof(Packet));  // May want to change algo here to avoid memcpy...
-                        if(debug)
-                            std::cout << "Stored out-of-order packet seq: " << seq_num << " (exp " << expected_seq << ")" << std::endl;
-                        didntIgnore = true;
-                    } else {
-                        if (debug) std::cout << seq_num << " out of bounds of Window!" << std::endl;
-                    }
-                }
+        if (consumer) {
+            stats.record_queue(consumer->depth(), consumer->capacity());
+        }
+        stats.report();
+        assert(window.inBounds(expected_seq));
+    }
+    consumer.reset();   // finishes processing what is queued
+    return count;
+}
+
+template<typename DataProcessorType, typename NetworkConnectionType, typename Policy>
+bool StreamReceiver<DataProcessorType, NetworkConnectionType, Policy>::StreamReceiver::processReceived(
+        Packet*& packet, ssize_t recv_len, uint64_t& count) {
+    PacketHeader& header = packet->header;
+    if(recv_len < HEADER_SIZE) {
+        if(debug)
+            std::cerr << "Received packet too small, ignoring." << std::endl;
+        return true;
+    }
+
+    uint32_t seq_num = ntohl(header.seq_num);
+    uint16_t pkt_window = ntohs(header.window_size);
+    uint8_t ctrl_flag = header.control_flags;
+
+    // From here on recv_len leaves out the CRC32C trailer
+    ssize_t checked_len = Policy::Integrity::check(packet, recv_len, crc);
+    if (checked_len < 0) {
+        if(debug)
+            std::cerr << "Invalid checksum for packet seq " << seq_num << " Len: " << recv_len << ", discarding." << std::endl;
+        stats.record_corrupted();
+        window.forgetNack(seq_num);  // might want to re-nack this guy!
+        return true;
+    }
+    recv_len = checked_len;
 
-                for(uint32_t missing = expected_seq; missing < seq_num; missing++) {
-                    if (!window.contains(missing)) {
-                        if (sendACK(missing, FLAG_NACK)) {
-                            if(debug) std::cout << "Sent NACK for missing seq: " << missing << std::endl;
-                        }
-                    }
+    bool didntIgnore = false;
+
+    if (ctrl_flag == FLAG_DATA) {
+        // At most a quarter of our window between ACKs: a sender whose whole window is in flight waits for one,
+        // and under loss a full window of in-order packets may never come together before the socket drains
+        ack_window = std::max<uint32_t>(std::min<uint32_t>(pkt_window, window_size / 4), 1);
+        if (seq_num == expected_seq) {
+            if(debug)
+                std::cout << "Processing exp seq " << seq_num << std::endl; 
+            count += processPacket(packet, recv_len - sizeof(packet->header));
+            count += processOutOfOrder();    // maybe we should send an ACK here if we process many packets?
+
+            window.advanceTo(expected_seq);
+            didntIgnore = true;
+            count += recoverFEC(seq_num);
+
+        } else if (seqBefore(expected_seq, seq_num)) {
+            if (!window.contains(seq_num)) {
+                if (recv_len != (ssize_t) (HEADER_SIZE + payload_size)) {
+                    // This is the last packet, need to save the length to process correctly
+                    lastSeqLen = recv_len;
+                    lastSeq = seq_num;
                 }
-            } else {
-                // seq_num < expected_seq
-                // We got a sequence number we've already seen
-                if (sendACK(expected_seq)) {
-                    if (debug) std::cout << "Already seen " << seq_num << " , sent ACK for " << expected_seq << std::endl;
+
+                // Hand the receive buffer to the window and receive into the slot's old one instead of copying
+                Packet* spare = window.adopt(seq_num, packet);
+                if (spare) {
+                    packet = spare;
+                    if(debug)
+                        std::cout << "Stored out-of-order packet seq: " << seq_num << " (exp " << expected_seq << ")" << std::endl;
+                    didntIgnore = true;
+                    count += recoverFEC(seq_num);
+                } else {
+                    if (debug) std::cout << seq_num << " out of bounds of Window!" << std::endl;
                 }
             }
 
-            if (!didntIgnore) {
-                stats.record_ignored();
+            highest_seen = seqMax(highest_seen, seq_num + 1);
+            if (sack) {
+                sack_pending = true;
+            } else {
+                reportHoles(seqMin(seq_num, holeLimit()));
             }
+        } else {
+            // seq_num before expected_seq
+            // We got a sequence number we've already seen, re-ACK once the batch is done
+            if (debug) std::cout << "Already seen " << seq_num << " , will ACK " << expected_seq << std::endl;
+            ack_pending = true;
+        }
 
-            // --- Send cumulative ACK only at end of sliding window ---
-            if(expected_seq > 0 && (expected_seq % pkt_window == 0)) {  // % pkt_window may not be best
-                if (sendACK(expected_seq)) {
-                    if (debug) std::cout << "End of window, sending ACK for " << expected_seq << std::endl;
-                }
-            }
-        } else if (ctrl_flag == FLAG_FIN) {
-            sendFINACK(seq_num);
-            running = false;
+        if (!didntIgnore) {
+            stats.record_ignored();
+        }
+    } else if (ctrl_flag == FLAG_PARITY) {
+        if (fec.enabled()) {
+            fec.addParity(seq_num, pkt_window, packet->data, expected_seq);
+            count += recoverFEC(seq_num);
         }
+    } else if (ctrl_flag == FLAG_FIN) {
+        sendFINACK(seq_num);
+        return false;
+    }
+    return true;
+}
 
-        assert(window.inBounds(expected_seq));
+template<typename DataProcessorType, typename NetworkConnectionType, typename Policy>
+int StreamReceiver<DataProcessorType, NetworkConnectionType, Policy>::StreamReceiver::recoverFEC(uint32_t seq_num) {
+    // Rebuild what parity allows in seq_num's group, then deliver it. If that reaches a later group,
+    // its parity may already be here too.
+    if (!fec.enabled()) return 0;
+    int count = 0;
+    int recovered = fec.recover(seq_num, expected_seq, window);
+    while (recovered > 0) {
+        stats.record_recovered(recovered);
+        if(debug) std::cout << "Recovered " << recovered << " packets in group of " << seq_num << std::endl;
+        if (window.contains(expected_seq)) {
+            count += processOutOfOrder();
+            window.advanceTo(expected_seq);
+        }
+        recovered = fec.recover(expected_seq, expected_seq, window);
     }
     return count;
 }
 
+template<typename DataProcessorType, typename NetworkConnectionType, typename Policy>
+uint32_t StreamReceiver<DataProcessorType, NetworkConnectionType, Policy>::StreamReceiver::holeLimit() {
+    // With FEC, holes in the newest group wait for its parity, which follows the group's last packet
+    return fec.enabled() ? seqMax(expected_seq, fec.groupStart(highest_seen - 1)) : highest_seen;
+}
+
+template<typename DataProcessorType, typename NetworkConnectionType, typename Policy>
+void StreamReceiver<DataProcessorType, NetworkConnectionType, Policy>::StreamReceiver::reportHoles(uint32_t end) {
+    if (sack) {
+        sendSACK(end);
+        return;
+    }
+    // Only the holes are visited, not the packets stored between them
+    for (uint32_t missing = window.nextMissing(expected_seq, end); seqBefore(missing, end);
+            missing = window.nextMissing(missing + 1, end)) {
+        if (sendACK(missing, FLAG_NACK)) {
+            if(debug) std::cout << "Sent NACK for missing seq: " << missing << " (" << window.nacks(missing) << ")" << std::endl;
+        }
+    }
+}
+
 
-template<typename DataProcessorType, typename NetworkConnectionType>
-int StreamReceiver<DataProcessorType, NetworkConnectionType>::StreamReceiver::sendACK(
+template<typename DataProcessorType, typename NetworkConnectionType, typename Policy>
+int StreamReceiver<DataProcessorType, NetworkConnectionType, Policy>::StreamReceiver::sendACK(
         uint32_t seq_num, uint8_t flag, bool checkPastACKs) {
     
     if (flag == FLAG_ACK || flag == FLAG_NACK) {
         // Don't care if FINACK
-        auto& ack_window = (flag == FLAG_ACK) ? ackTimes : nackTimes;
-        bool sentBefore = ack_window.contains(seq_num);
-        timepoint* time = ack_window.reserve(seq_num);
-        if (!time) {
-            std::cerr << "ACK Window was out of range for " << flag << " " << seq_num << std::endl;
-        }
-        timepoint now = std::chrono::steady_clock::now();
-        if (checkPastACKs) {
-            bool shouldSend = (
-                !sentBefore || //Short circuiting getting an invalid time
-                std::chrono::duration_cast<microseconds>(now - *time).count() > RETRY_ACK_US
-            );
-            if (!shouldSend) return 0;
+        if (!markSent(seq_num, flag, tick()) && checkPastACKs) {
+            return 0;
         }
-        *time = now;
     }
     
-    PacketHeader ack_hdr;
-    ack_hdr.seq_num = htonl(seq_num);
-    ack_hdr.window_size = htons(window_size);
-    ack_hdr.control_flags = flag;
-    ack_hdr.checksum = 0;
-
-    uint16_t ack_chksum = compute_checksum(&ack_hdr, sizeof(ack_hdr));
-    ack_hdr.checksum = htons(ack_chksum);
+    ControlPacket ack;
+    ack.header.seq_num = htonl(seq_num);
+    ack.header.window_size = htons(window_size);
+    ack.header.control_flags = flag;
+    size_t len = sealPacket(&ack, CTRL_PACKET_SIZE, crc);
 
     stats.record_ack(flag);
 
-    return conn.send(&ack_hdr, sizeof(ack_hdr));
+    return conn.send(&ack, len);
+}
+
+template<typename DataProcessorType, typename NetworkConnectionType, typename Policy>
+bool StreamReceiver<DataProcessorType, NetworkConnectionType, Policy>::StreamReceiver::markSent(
+        uint32_t seq_num, uint8_t flag, uint32_t now) {
+    // Stamp seq_num as (N)ACK'd now. False if it already was within the last RETRY_ACK_US,
+    // and then the stamp stays, so duplicates keep being let through every RETRY_ACK_US.
+    if (flag == FLAG_NACK) {
+        if (debug && !window.inBounds(seq_num))
+            std::cout << "NACK out of the window for " << seq_num << std::endl;
+        return window.nack(seq_num, now);
+    }
+    bool due = !ack_sent || seq_num != ack_seq || now - ack_tick > (uint32_t) RETRY_ACK_US;
+    if (due) {
+        ack_sent = true;
+        ack_seq = seq_num;
+        ack_tick = now;
+    }
+    return due;
+}
+
+template<typename DataProcessorType, typename NetworkConnectionType, typename Policy>
+uint32_t StreamReceiver<DataProcessorType, NetworkConnectionType, Policy>::StreamReceiver::tick() {
+    // Microseconds, truncated to 32 bits: enough to tell RETRY_ACK_US apart, compared with wrapping subtraction
+    return std::chrono::duration_cast<microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
-template<typename DataProcessorType, typename NetworkConnectionType>
-int StreamReceiver<DataProcessorType, NetworkConnectionType>::StreamReceiver::processOutOfOrder() {
+template<typename DataProcessorType, typename NetworkConnectionType, typename Policy>
+int StreamReceiver<DataProcessorType, NetworkConnectionType, Policy>::StreamReceiver::sendSACK(uint32_t end) {
+    // Cumulative ACK plus every hole below end, as ranges. Like NACKs, a missing seq is only
+    // reported again after RETRY_ACK_US, or right away if its retransmit arrived corrupted.
+    Packet sack;
+    SackBlock* blocks = reinterpret_cast<SackBlock*>(sack.data);
+    size_t num_blocks = 0;
+    uint32_t now = tick();
+    uint32_t seq = window.nextMissing(expected_seq, end);
+    while (seqBefore(seq, end) && num_blocks < MAX_SACK_BLOCKS) {
+        // Walk the hole [seq, hole_end), skipping what was reported too recently, then jump to the next one
+        uint32_t hole_end = window.nextArrived(seq, end);
+        while (seqBefore(seq, hole_end) && num_blocks < MAX_SACK_BLOCKS) {
+            if (!window.nack(seq, now)) {
+                seq++;
+                continue;
+            }
+            uint32_t start = seq++;
+            while (seqBefore(seq, hole_end) && window.nack(seq, now)) {
+                seq++;
+            }
+            blocks[num_blocks].start = htonl(start);
+            blocks[num_blocks].end = htonl(seq);
+            num_blocks++;
+        }
+        seq = window.nextMissing(hole_end, end);
+    }
+    if (num_blocks == 0) {
+        return 0;
+    }
+
+    size_t len = HEADER_SIZE + num_blocks * sizeof(SackBlock);
+    sack.header.seq_num = htonl(expected_seq);
+    sack.header.window_size = htons(window_size);
+    sack.header.control_flags = FLAG_SACK;
+    len = sealPacket(&sack, len, crc);
+
+    last_acked = expected_seq;
+    stats.record_ack(FLAG_SACK);
+    return conn.send(&sack, len);
+}
+
+template<typename DataProcessorType, typename NetworkConnectionType, typename Policy>
+int StreamReceiver<DataProcessorType, NetworkConnectionType, Policy>::StreamReceiver::processOutOfOrder() {
     // while(out_of_order.count(expected_seq)) {
     //     if(debug)
     //         std::cout << "Processing buffered packet seq: " << expected_seq << std::endl;
@@ -173,8 +348,8 @@ int StreamReceiver<DataProcessorType, NetworkConnectionType>::StreamReceiver::pr
     Packet* packet = window.get(expected_seq);
     int count = 0;
     while (packet) {
-        ssize_t s = sizeof(packet->data);
-        if (expected_seq == lastSeq) {
+        ssize_t s = payload_size;
+        if (expected_seq == lastSeq && lastSeqLen > 0) {
             // We received the last packet (with incomplete recv_len) out of order,
             // Need to process with correct size
             s = lastSeqLen - sizeof(PacketHeader);
@@ -189,46 +364,116 @@ int StreamReceiver<DataProcessorType, NetworkConnectionType>::StreamReceiver::pr
 }
 
 
-template<typename DataProcessorType, typename NetworkConnectionType>
-int StreamReceiver<DataProcessorType, NetworkConnectionType>::StreamReceiver::handshake() {
+template<typename DataProcessorType, typename NetworkConnectionType, typename Policy>
+int StreamReceiver<DataProcessorType, NetworkConnectionType, Policy>::StreamReceiver::handshake() {
     // === Negotiation Handshake ===
+    bool extended = false;      // the sender sent its capabilities
+    size_t caps_size = 0;       // how much of them
+    Capabilities agreed = {};
+    char handshake_buf[sizeof(Packet)];     // large enough for any path MTU probe
     while (true) {
-        char handshake_buf[64];
         ssize_t n = conn.receive(handshake_buf, sizeof(handshake_buf));
         if(n < 0) {
-            std::this_thread::sleep_for(milliseconds(RETRY_MS));
-            if (debug) std::cout << "No handshake received" << std::endl;
+            if (!(conn.wait(steady_clock::now() + milliseconds(HANDSHAKE_TIMEOUT_MS)) & POLL_READABLE)) {
+                if (debug) std::cout << "No handshake received" << std::endl;
+            }
+            continue;
+        }
+        if (n >= (ssize_t) PROBE_SIZE && !memcmp(handshake_buf, PROBE, PROBE_SIZE)) {
+            answerProbe(handshake_buf, n);
             continue;
         }
-        if(n != sizeof(HANDSHAKE) || strcmp(handshake_buf, HANDSHAKE)) {
+        if((n != HANDSHAKE_SIZE && n != CAPS_HANDSHAKE_SIZE && n != ISN_HANDSHAKE_SIZE && n != PAYLOAD_HANDSHAKE_SIZE) ||
+                memcmp(handshake_buf, HANDSHAKE, HANDSHAKE_SIZE)) {
+            handshake_buf[std::min<size_t>(n, 63)] = 0;
             std::cerr << "Error: Unexpected handshake message: " << handshake_buf << std::endl;
             continue;
         }
+        // Capabilities both sides support. A bare HANDSHAKE is an older sender that has none.
+        // They end with the initial sequence number if the sender doesn't start at 0, which we echo,
+        // and the payload size if it wants another than PAYLOAD_SIZE, which we echo as far as we can take it.
+        caps_size = n - HANDSHAKE_SIZE;
+        extended = (caps_size > 0);
+        if (extended) {
+            std::memcpy(&agreed, handshake_buf + HANDSHAKE_SIZE, caps_size);
+        }
         break;
     }
+    uint32_t caps = ntohl(agreed.flags) & offered_caps;
+    if ((caps & CAP_FEC) && (agreed.fec_data < 1 || agreed.fec_data > FEC_MAX_DATA ||
+                             agreed.fec_parity < 1 || agreed.fec_parity > FEC_MAX_PARITY)) {
+        caps &= ~CAP_FEC;
+    }
+    initial_seq = ntohl(agreed.initial_seq);
+    payload_size = PAYLOAD_SIZE;
+    if (caps_size == sizeof(Capabilities)) {
+        payload_size = std::min<uint32_t>(std::max<uint32_t>(ntohs(agreed.payload_size), MIN_PAYLOAD_SIZE), MAX_PAYLOAD_SIZE);
+    }
+    agreed.payload_size = htons(payload_size);
+    // The sender picks the group shape, but we pay for its sums: take fewer parity rows, or none, if they don't fit
+    if (caps & CAP_FEC) {
+        int parity = agreed.fec_parity;
+        while (parity > 0 && FecDecoder::sumsBytes(agreed.fec_data, parity, window_size, payload_size) > FEC_MAX_SUMS_BYTES) {
+            parity--;
+        }
+        if (parity < agreed.fec_parity) {
+            std::cerr << "FEC " << (int) agreed.fec_data << ":" << (int) agreed.fec_parity << " needs more than "
+                      << (FEC_MAX_SUMS_BYTES >> 20) << " MB of sums, agreeing to " << parity << " parity packets" << std::endl;
+            agreed.fec_parity = parity;
+        }
+        if (parity == 0 || !fec.configure(agreed.fec_data, parity, window_size, payload_size)) {
+            caps &= ~CAP_FEC;
+        }
+    }
+    if (!(caps & CAP_FEC)) {
+        agreed.fec_data = agreed.fec_parity = 0;
+        fec.configure(0, 0, window_size, payload_size);
+    }
+    agreed.flags = htonl(caps);
+    sack = caps & CAP_SACK;
+    crc = caps & CAP_CRC32C;
 
     if(debug)
         std::cout << "Received handshake from sender. Sending negotiation packet..." << std::endl;
-    // Prepare negotiation packet: two shorts (buffer size and packet size) in network order.
+    // Prepare negotiation packet: two shorts (buffer size and packet size) in network order,
+    // then the agreed capabilities if the sender offered any.
     const uint16_t negotiated_buffer_size = 1024;           // example buffer size
-    const uint16_t negotiated_packet_size   = DATA_PACKET_SIZE;
-    char negotiation_packet[4];
+    const uint16_t negotiated_packet_size   = HEADER_SIZE + payload_size;
+    char negotiation_packet[PAYLOAD_NEGOTIATION_SIZE];
     uint16_t net_buffer_size = htons(negotiated_buffer_size);
     uint16_t net_packet_size = htons(negotiated_packet_size);
     std::memcpy(negotiation_packet, &net_buffer_size, sizeof(uint16_t));
     std::memcpy(negotiation_packet + sizeof(uint16_t), &net_packet_size, sizeof(uint16_t));
-    size_t s = conn.send(negotiation_packet, sizeof(negotiation_packet));
+    std::memcpy(negotiation_packet + NEGOTIATION_SIZE, &agreed, sizeof(agreed));
+    ssize_t s = conn.send(negotiation_packet, NEGOTIATION_SIZE + caps_size);
     if(s < 0) {
         perror("sendto negotiation packet failed");
         return 1;
     } else if(debug) {
-        std::cout << "Negotiation packet sent to sender." << std::endl;
+        std::cout << "Negotiation packet sent to sender. SACK: " << (sack ? "on" : "off")
+                  << ", FEC: " << (fec.enabled() ? "on" : "off")
+                  << ", integrity: " << (crc ? "CRC32C" : "checksum")
+                  << ", payload: " << payload_size << " bytes" << std::endl;
     }
     return 0;
 }
 
-template<typename DataProcessorType, typename NetworkConnectionType>
-bool StreamReceiver<DataProcessorType, NetworkConnectionType>::StreamReceiver::sendFINACK(uint32_t seq_num) {
+template<typename DataProcessorType, typename NetworkConnectionType, typename Policy>
+void StreamReceiver<DataProcessorType, NetworkConnectionType, Policy>::StreamReceiver::answerProbe(const char* probe, ssize_t len) {
+    // Tell the sender how much of its path MTU probe arrived
+    char reply[PROBE_REPLY_SIZE];
+    uint32_t net_len = htonl(len);
+    std::memcpy(reply, probe, PROBE_SIZE);
+    std::memcpy(reply + PROBE_SIZE, &net_len, sizeof(net_len));
+    if (conn.send(reply, sizeof(reply)) < 0) {
+        perror("sendto probe reply failed");
+    } else if (debug) {
+        std::cout << "Answered a " << len << " byte path MTU probe" << std::endl;
+    }
+}
+
+template<typename DataProcessorType, typename NetworkConnectionType, typename Policy>
+bool StreamReceiver<DataProcessorType, NetworkConnectionType, Policy>::StreamReceiver::sendFINACK(uint32_t seq_num) {
     stats.report(true);
     Packet packet;
     for (int i = 0; i < 5; i++) {
@@ -236,7 +481,7 @@ bool StreamReceiver<DataProcessorType, NetworkConnectionType>::StreamReceiver::s
 
         if (conn.ready({0, SENDER_ACK_WAIT_US * 1000})) {
             ssize_t recv_len = conn.receive(&packet, sizeof(packet));
-            if (recv_len >= HEADER_SIZE && packet.header.control_flags == FLAG_ACK && verifyChecksum(&packet, recv_len)) {
+            if (recv_len >= HEADER_SIZE && packet.header.control_flags == FLAG_ACK && checkPacket(&packet, recv_len, crc) >= 0) {
 
                 if(debug)
                     std::cout << "Received final ACK." << std::endl;
@@ -247,26 +492,31 @@ bool StreamReceiver<DataProcessorType, NetworkConnectionType>::StreamReceiver::s
     return false;
 }
 
-template<typename DataProcessorType, typename NetworkConnectionType>
-int StreamReceiver<DataProcessorType, NetworkConnectionType>::StreamReceiver::teardown() {
+template<typename DataProcessorType, typename NetworkConnectionType, typename Policy>
+int StreamReceiver<DataProcessorType, NetworkConnectionType, Policy>::StreamReceiver::teardown() {
     window.clear();
-    ackTimes.clear();
-    nackTimes.clear();
+    ack_sent = false;
 
     conn.close();
     return 0;
 }
 
 
-template<typename DataProcessorType, typename NetworkConnectionType>
-bool StreamReceiver<DataProcessorType, NetworkConnectionType>::StreamReceiver::advanceAllWindows(uint32_t seq_num) {
-    return window.advanceTo(seq_num) && ackTimes.advanceTo(seq_num) && nackTimes.advanceTo(seq_num);
-}
-
-template<typename DataProcessorType, typename NetworkConnectionType>
-bool StreamReceiver<DataProcessorType, NetworkConnectionType>::StreamReceiver::processPacket(Packet* packet, ssize_t size) {
-    processor.processData(size, packet->data);
+template<typename DataProcessorType, typename NetworkConnectionType, typename Policy>
+bool StreamReceiver<DataProcessorType, NetworkConnectionType, Policy>::StreamReceiver::processPacket(Packet* packet, ssize_t size) {
+    if (consumer) {
+        if (!consumer->push(packet->data, size)) {
+            stats.record_queue_full();
+        }
+        stats.record_copied(size);     // into the processing ring
+    } else {
+        processor.processData(size, packet->data);
+        stats.record_copied(processor.takeCopied());
+    }
     stats.record_packet(size);
+    if (fec.enabled()) {
+        fec.addDelivered(expected_seq, packet->data, size);
+    }
     expected_seq++;
     return true;
 }
@@ -1,10 +1,19 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 #include <string>
+#include <atomic>
 #include "Statistics.hpp"
+#include "Policies.hpp"
 #include "DataProcessing.hpp"
 #include "SlidingWindow.hpp"
+#include "RetransmitQueue.hpp"
+#include "Pacer.hpp"
+#include "CongestionController.hpp"
+#include "RttEstimator.hpp"
+#include "Fec.hpp"
+#include "PacketProducer.hpp"
 #include "NetworkUtils.hpp"
 #include "Protocol.hpp"
 #include "NetworkConnection.hpp"
@@ -13,6 +22,7 @@
 //   - This class should contain all protocol specific logic, and delegate data reading and buffering to DataProvider and DataWindow
 //   - setup()
 //     - Set up connection and negotiation handshake
+//     - the payload size is negotiated there, optionally after probePayloadSize() found the largest the path carries
 //   - stream()
 //     - Main streaming loop
 //     - Send window of packets: calls sendData()
@@ -22,21 +32,59 @@
 //     - Send one packet on socket.
 //     - Gets data from DataWindow
 //       - If not in buffer, gets data from DataProvider
+//       - or, with producer_ring, from the PacketProducer thread that reads and checksums payloads ahead
+//       - or from the provider itself, if it is a PayloadSource (a shard's ShardSource)
+//   - sendPackets(infos, n)
+//     - Send a run of prepared packets with a single NetworkConnection::sendBatch() call
+//     - New data and retransmits both take their send budget from the Pacer
+//   - sendParity()
+//     - With CAP_FEC, send the FecEncoder's parity packets after the last packet of each group
+//     - with CAP_CRC32C, every packet ends in a CRC32C of it instead of carrying the header checksum
 //   - processACKs()
-//     - handles ACK/NACK logic
+//     - handles ACK/NACK/SACK logic, draining the socket without blocking
+//     - a SACK is a cumulative ACK plus ranges of missing packets, each resent like a NACK'd one
+//     - feeds ACK progress and NACKs to the CongestionController, which sets how much of the window is used
+//   - nextDeadline()
+//     - when the oldest in-flight packet times out; stream() sleeps on the connection until then
+//     - the timeout is the RTO computed by RttEstimator from ACKs of packets sent only once
 //   - getTimedOut()
-//     - gets the first timed out packet if one is available
+//     - pops timed out packets from the head of the RetransmitQueue
 //   - teardown()
 //     - FIN/FINACK logic
 
+struct SenderOptions {
+    double pace_mbps = 0;                   // target send rate, 0 sends as fast as the window allows
+    uint32_t pace_burst = SEND_BATCH_SIZE;  // DATA packets the pacer lets out back-to-back
+    bool txtime = false;                    // let the kernel space packets (SO_TXTIME, needs the fq qdisc)
+    CongestionMode congestion = CC_FIXED;   // how much of the window to keep in flight
+    uint8_t fec_data = 0;                   // FEC group size in DATA packets, 0 for no FEC
+    uint8_t fec_parity = 0;                 // parity packets per group (the most, with fec_adapt)
+    bool fec_adapt = false;                 // vary parity per group with the loss the receiver reports
+    uint32_t producer_ring = 0;             // payloads a reader thread prepares ahead, 0 reads in the send loop
+    bool gso = true;                        // send runs of DATA packets as one super-datagram if the kernel can
+    uint32_t initial_seq = 0;               // first sequence number, if the receiver agrees (to exercise wraparound)
+    bool crc32c = false;                    // ask for CRC32C trailers instead of the 16 bit header checksum
+    uint16_t payload_size = PAYLOAD_SIZE;   // DATA payload bytes to ask for, up to MAX_PAYLOAD_SIZE
+    bool pmtu_probe = false;                // ask for the largest payload that reaches the receiver unfragmented instead
+};
+
+// Per-slot state of the sender's window. The payload itself lives in a PacketBuffers buffer of its own,
+// so walking the window's timestamps and links doesn't drag whole packets through the cache.
 struct PacketInfo {
-    Packet packet;
+    Packet* packet = nullptr;
     size_t data_size;
-    bool retried = false;
+    size_t wire_size;           // packet_size() plus the CRC32C trailer, if any
+    bool retried = false;       // retransmitted at least once, so ACKs for it give no RTT sample (Karn's rule)
+    std::chrono::steady_clock::time_point first_sent;
     std::chrono::steady_clock::time_point last_sent;
 
+    // RetransmitQueue links (sequence numbers of the neighbouring in-flight packets)
+    uint32_t prev_seq = 0;
+    uint32_t next_seq = 0;
+    bool queued = false;
+
     inline size_t packet_size() {
-        return data_size + sizeof(packet.header);
+        return data_size + sizeof(PacketHeader);
     }
 };
 
@@ -48,33 +96,75 @@ public:
     virtual int teardown() = 0;
 };
 
-template<typename DataProviderType, typename NetworkConnectionType>
+template<typename DataProviderType, typename NetworkConnectionType, typename Policy=DefaultPolicy>
 class StreamSender : public StreamSenderInterface {   
 private:
     SlidingWindow<PacketInfo> window;
-    SenderStats stats;
+    PacketBuffers buffers;                      // one per window slot, mapped once the packet size is negotiated
+    RetransmitQueue<PacketInfo> in_flight;     // in-flight packets, oldest send first
+    std::vector<PacketInfo*> expired;           // scratch for sendTimedOut()
+    typename Policy::Stats stats;
+    Pacer pacer;
+    SenderOptions options;
+    std::unique_ptr<CongestionController> cc;
+    RttEstimator rtt;               // ACK round trip, including the receiver's once-per-window ACK delay: the RTO
+    RttEstimator path_rtt;          // newest packet an ACK covers, no ACK delay: gates NACK retries
+    uint32_t rtt_sample_seq = 0;    // next RTT sample once an ACK passes this, so one per round trip
+    std::chrono::steady_clock::time_point last_progress;   // last ACK that moved the base
+    uint32_t highest_nack = 0;      // the receiver has everything below this that it didn't NACK
+    uint32_t caps = 0;              // capabilities negotiated in the handshake
+    bool crc = false;               // CAP_CRC32C: packets carry a CRC32C trailer instead of the header checksum
+    uint32_t payload_size = PAYLOAD_SIZE;   // negotiated in the handshake, every DATA packet but the last has this much
+    std::atomic<uint32_t> negotiated{0};    // payload_size once the handshake is done, for other threads
+    FecEncoder fec;
+    bool parity_pending = false;    // preparePacket() completed an FEC group, send its parity next
+    std::unique_ptr<PacketProducer<DataProviderType>> producer;     // with options.producer_ring
+    PayloadSource* source = nullptr;    // the producer or the provider, if payloads are readied on another thread
+    bool source_wakes = false;      // conn wakes us when the source has data, otherwise poll for it
     
-    bool debug = false;
+    static constexpr bool debug = Policy::Trace::enabled;     // the if (debug) branches are only compiled in with Tracing
+    uint32_t initial_seq = 0;   // first sequence number, as agreed in the handshake
     uint32_t base = 0;      // lowest unacknowledged sequence number
-    uint32_t next_seq = 0;  // next sequence number to send
-    uint32_t max_packets = DEFAULT_MAX_PACKETS;
+    uint32_t next_seq = 0;  // next sequence number to send, the end of the stream once it is done
     uint32_t window_size;
+    bool send_blocked = false;  // last send hit a full socket buffer, wait for POLL_WRITABLE
 
     int handshake();
+    uint32_t probePayloadSize();
+    bool probe(size_t size);
     PacketInfo* preparePacket(uint32_t seq_num);
     int sendPacket(PacketInfo* info);
+    int sendPackets(PacketInfo** infos, size_t n);
+    void sendParity();
+    int sendControl(ControlPacket* packet);
     int processACKs();
-    void prepareFINPacket(PacketHeader* header, ControlFlag flag);
+    void processCumulativeACK(uint32_t pkt_seq);
+    void retransmitNACKd(uint32_t seq_num, PacketInfo** retransmits, size_t& num_retransmits);
+    void sendTimedOut();
+    std::chrono::steady_clock::time_point nextDeadline();
+    std::chrono::steady_clock::time_point deadline(PacketInfo* info);
+    void prepareFINPacket(ControlPacket* packet, ControlFlag flag);
 public:
     StreamSender(
         DataProviderType&& provider, NetworkConnectionType&& conn,
-        bool debug, uint32_t window_size=WINDOW_SIZE, bool csv=false
+        uint32_t window_size=WINDOW_SIZE, bool csv=false,
+        SenderOptions options=SenderOptions()
     );
     ~StreamSender();
 
     int stream() override;
     int teardown() override;
 
+    // Payload size agreed in the handshake, 0 until stream() has done it. Safe to call from other threads.
+    uint32_t payloadSize() {
+        return negotiated.load();
+    }
+    // Ask for exactly size bytes of payload in the handshake, without probing. Call before stream().
+    void requestPayloadSize(uint16_t size) {
+        options.payload_size = size;
+        options.pmtu_probe = false;
+    }
+
     NetworkConnectionType conn;
     DataProviderType provider;
 };
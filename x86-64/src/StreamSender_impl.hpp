@@ -5,28 +5,63 @@
 #include "NetworkUtils.hpp"
 #include "cmn.h"
 #include <chrono>
-#include <thread>
 #include <cassert>
+#include <cerrno>
+#include <algorithm>
 
 using namespace std::chrono;
 
-template<typename DataProviderType, typename NetworkConnectionType>
-StreamSender<DataProviderType, NetworkConnectionType>::StreamSender(
-        DataProviderType&& provider, NetworkConnectionType&& conn, bool debug, uint32_t window_size, bool csv) 
-            : window(window_size), stats(true, csv, false), debug(debug), window_size(window_size), conn(std::move(conn)), provider(std::move(provider)) {
+template<typename DataProviderType, typename NetworkConnectionType, typename Policy>
+StreamSender<DataProviderType, NetworkConnectionType, Policy>::StreamSender(
+        DataProviderType&& provider, NetworkConnectionType&& conn, uint32_t window_size, bool csv, SenderOptions options) 
+            : window(window_size), in_flight(window), stats(true, csv, false), options(options), window_size(window_size), conn(std::move(conn)), provider(std::move(provider)) {
+    expired.reserve(window_size);
+    this->options.pace_burst = std::max(options.pace_burst, (uint32_t) 1);
+    pacer.configure(options.pace_mbps, this->options.pace_burst * DATA_PACKET_SIZE, options.txtime);
+    cc = makeCongestionController(options.congestion, window_size);
     static_assert(std::is_base_of<DataProvider, DataProviderType>::value, "type parameter of this class must derive from DataProvider");
     static_assert(std::is_base_of<NetworkConnection, NetworkConnectionType>::value, "type parameter of this class must derive from NetworkConnection");
 }
 
-template<typename DataProviderType, typename NetworkConnectionType>
-StreamSender<DataProviderType, NetworkConnectionType>::~StreamSender() {
+template<typename DataProviderType, typename NetworkConnectionType, typename Policy>
+StreamSender<DataProviderType, NetworkConnectionType, Policy>::~StreamSender() {
     
 }
 
-template<typename DataProviderType, typename NetworkConnectionType>
-int StreamSender<DataProviderType, NetworkConnectionType>::handshake() {
+template<typename DataProviderType, typename NetworkConnectionType, typename Policy>
+int StreamSender<DataProviderType, NetworkConnectionType, Policy>::handshake() {
+    // Probe first, so the handshake can ask for the largest payload the path carries
+    uint32_t requested = std::min<uint32_t>(options.payload_size, MAX_PAYLOAD_SIZE);
+    if (options.pmtu_probe) {
+        uint32_t probed = probePayloadSize();
+        if (probed > 0) {
+            requested = probed;
+        } else {
+            std::cerr << "Path MTU probe failed, asking for " << requested << " byte payloads" << std::endl;
+        }
+    }
+    requested = std::max<uint32_t>(requested, MIN_PAYLOAD_SIZE);
+
+    // HANDSHAKE followed by our capabilities. A receiver that predates them drops this as malformed,
+    // so after CAPS_HANDSHAKE_ATTEMPTS unanswered tries, fall back to the bare HANDSHAKE.
+    Capabilities offer = {};
+    uint32_t offered = SUPPORTED_CAPS;
+    if (options.fec_data == 0) offered &= ~CAP_FEC;
+    if (!options.crc32c) offered &= ~CAP_CRC32C;
+    offer.flags = htonl(offered);
+    offer.fec_data = options.fec_data;
+    offer.fec_parity = options.fec_parity;
+    offer.initial_seq = htonl(options.initial_seq);
+    offer.payload_size = htons(requested);
+    size_t handshake_size = (requested != PAYLOAD_SIZE) ? PAYLOAD_HANDSHAKE_SIZE
+                          : options.initial_seq ? ISN_HANDSHAKE_SIZE : CAPS_HANDSHAKE_SIZE;
+    char handshake_msg[PAYLOAD_HANDSHAKE_SIZE];
+    std::memcpy(handshake_msg, HANDSHAKE, HANDSHAKE_SIZE);
+    std::memcpy(handshake_msg + HANDSHAKE_SIZE, &offer, sizeof(offer));
+    int attempts = 1;
+
     auto last_handshake_time = steady_clock::now();
-    ssize_t s = conn.send((void*) HANDSHAKE, HANDSHAKE_SIZE);
+    ssize_t s = conn.send(handshake_msg, handshake_size);
 
     if(s < 0) {
         perror("handshake send failed");
@@ -37,25 +72,29 @@ int StreamSender<DataProviderType, NetworkConnectionType>::handshake() {
         std::cout << "Sent handshake message. Waiting for negotiation packet..." << std::endl;
 
     bool handshake_received = false;
-    char neg_buf[4];
+    char neg_buf[PAYLOAD_NEGOTIATION_SIZE];
+    ssize_t n = 0;
     while (!handshake_received) {
         auto now = steady_clock::now();
         auto elapsed = duration_cast<milliseconds>(now - last_handshake_time).count();
         if(elapsed >= HANDSHAKE_TIMEOUT_MS) {
-            ssize_t s = conn.send((void*) HANDSHAKE, HANDSHAKE_SIZE);
+            size_t len = (attempts++ < CAPS_HANDSHAKE_ATTEMPTS) ? handshake_size : HANDSHAKE_SIZE;
+            ssize_t s = conn.send(handshake_msg, len);
             if(s < 0)
                 perror("handshake resend failed");
             else if(debug)
                 std::cout << "Resent handshake message..." << std::endl;
             last_handshake_time = now;
         }
-        // ssize_t n = recvfrom(sockfd, neg_buf, sizeof(neg_buf), 0, nullptr, nullptr);
-        ssize_t n = conn.receive(neg_buf, sizeof(neg_buf)); // ?
-        if(n == 4) {
+        // Wait for the negotiation packet, at most until the next resend is due.
+        if (!(conn.wait(last_handshake_time + milliseconds(HANDSHAKE_TIMEOUT_MS)) & POLL_READABLE)) {
+            continue;
+        }
+        n = conn.receive(neg_buf, sizeof(neg_buf));
+        if(n == NEGOTIATION_SIZE || n == CAPS_NEGOTIATION_SIZE || n == ISN_NEGOTIATION_SIZE || n == PAYLOAD_NEGOTIATION_SIZE) {
             handshake_received = true;
             break;
         }
-        std::this_thread::sleep_for(milliseconds(RETRY_MS));
     }
     // Parse negotiation packet: two shorts (buffer size, packet size) in network order.
     uint16_t net_buffer_size, net_packet_size;
@@ -63,179 +102,607 @@ int StreamSender<DataProviderType, NetworkConnectionType>::handshake() {
     std::memcpy(&net_packet_size, neg_buf + sizeof(uint16_t), sizeof(uint16_t));
     uint16_t negotiated_buffer_size = ntohs(net_buffer_size);
     uint16_t negotiated_packet_size = ntohs(net_packet_size);
+    // Followed by the capabilities the receiver agreed to, absent if it predates them,
+    // and the initial sequence number if we asked for one and it knows about them
+    Capabilities agreed = {};
+    if (n > NEGOTIATION_SIZE) {
+        std::memcpy(&agreed, neg_buf + NEGOTIATION_SIZE, n - NEGOTIATION_SIZE);
+    }
+    caps = ntohl(agreed.flags) & ntohl(offer.flags);
+    initial_seq = ntohl(agreed.initial_seq);
+    if (initial_seq != options.initial_seq) {
+        std::cerr << "Receiver does not support an initial sequence number, starting at " << initial_seq << std::endl;
+    }
+    // The packet size is a full DATA packet's: the payload size we asked for, or less if the receiver wants,
+    // or PAYLOAD_SIZE's from a receiver that predates the request
+    if (negotiated_packet_size < HEADER_SIZE + MIN_PAYLOAD_SIZE || negotiated_packet_size > HEADER_SIZE + MAX_PAYLOAD_SIZE) {
+        std::cerr << "Receiver negotiated an unusable packet size of " << negotiated_packet_size << std::endl;
+        conn.close();
+        exit(EXIT_FAILURE);
+    }
+    payload_size = negotiated_packet_size - HEADER_SIZE;
+    if (payload_size != requested) {
+        std::cerr << "Receiver does not support " << requested << " byte payloads, using " << payload_size << std::endl;
+    }
+    crc = caps & CAP_CRC32C;
+    if (options.crc32c && !crc) {
+        std::cerr << "Receiver does not support CRC32C, using the header checksum" << std::endl;
+    }
+    if (caps & CAP_FEC) {
+        // The receiver may agree to fewer parity packets than we asked for, to bound its memory
+        int parity = options.fec_parity;
+        if (agreed.fec_parity >= 1 && agreed.fec_parity < parity) {
+            std::cerr << "Receiver takes at most " << (int) agreed.fec_parity << " parity packets per group" << std::endl;
+            parity = agreed.fec_parity;
+        }
+        fec.configure(options.fec_data, parity, options.fec_adapt, payload_size);
+    } else if (options.fec_data > 0) {
+        std::cerr << "Receiver does not support FEC, relying on retransmissions only" << std::endl;
+    }
     if(debug)
         std::cout << "Negotiation completed: Buffer size = " << negotiated_buffer_size
-                  << ", Packet size = " << negotiated_packet_size << std::endl;
+                  << ", Packet size = " << negotiated_packet_size
+                  << ", SACK: " << ((caps & CAP_SACK) ? "on" : "off")
+                  << ", FEC: " << ((caps & CAP_FEC) ? "on" : "off")
+                  << " (GF(256) " << gf256::dispatch().name << ")"
+                  << ", integrity: " << (crc ? "CRC32C (" : "checksum (")
+                  << (crc ? crc32c::dispatch().name : csum::dispatch().name) << ")" << std::endl;
     
     assert(negotiated_buffer_size == BUFFER_SIZE);
-    assert(negotiated_packet_size == DATA_PACKET_SIZE);
+    negotiated.store(payload_size);
     return 0;
 }
 
-template<typename DataProviderType, typename NetworkConnectionType>
-int StreamSender<DataProviderType, NetworkConnectionType>::stream() {
+template<typename DataProviderType, typename NetworkConnectionType, typename Policy>
+uint32_t StreamSender<DataProviderType, NetworkConnectionType, Policy>::probePayloadSize() {
+    // Binary search for the largest DATA packet that reaches the receiver with fragmentation off. The largest
+    // is tried first, as on jumbo frame paths (and loopback) that is the answer, then the smallest, as no
+    // answer to that is a receiver that predates probes. Returns the payload size, 0 if the probe failed.
+    if (!conn.setDontFragment(true)) {
+        return 0;
+    }
+    size_t overhead = HEADER_SIZE + (options.crc32c ? CRC32C_SIZE : 0);
+    uint32_t lo = MIN_PAYLOAD_SIZE;
+    uint32_t hi = MAX_PAYLOAD_SIZE;
+    uint32_t best = 0;
+    if (probe(overhead + hi)) {
+        best = hi;
+    } else if (probe(overhead + lo)) {
+        best = lo++;
+        hi--;
+        while (lo <= hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (probe(overhead + mid)) {
+                best = mid;
+                lo = mid + 1;
+            } else {
+                hi = mid - 1;
+            }
+        }
+    }
+    conn.setDontFragment(false);
+    if (best > 0) {
+        std::cout << "Path MTU probe: " << overhead + best << " byte DATA packets arrive unfragmented" << std::endl;
+    }
+    return best;
+}
+
+template<typename DataProviderType, typename NetworkConnectionType, typename Policy>
+bool StreamSender<DataProviderType, NetworkConnectionType, Policy>::probe(size_t size) {
+    // PROBE padded to size bytes, true once the receiver answers that all of them arrived.
+    // A datagram larger than the first hop's MTU fails right away with EMSGSIZE.
+    Packet buf = {};
+    std::memcpy(&buf, PROBE, PROBE_SIZE);
+    for (int attempt = 0; attempt < PROBE_ATTEMPTS; attempt++) {
+        if (conn.send(&buf, size) < 0) {
+            if (errno != EMSGSIZE)
+                perror("probe send failed");
+            return false;
+        }
+        auto deadline = steady_clock::now() + milliseconds(PROBE_TIMEOUT_MS);
+        while (conn.wait(deadline) & POLL_READABLE) {
+            char reply[PROBE_REPLY_SIZE];
+            if (conn.receive(reply, sizeof(reply)) != PROBE_REPLY_SIZE || std::memcmp(reply, PROBE, PROBE_SIZE)) {
+                continue;
+            }
+            uint32_t net_len;
+            std::memcpy(&net_len, reply + PROBE_SIZE, sizeof(net_len));
+            if (ntohl(net_len) == size) {
+                if (debug) std::cout << "Probe of " << size << " bytes arrived" << std::endl;
+                return true;    // answers to earlier, smaller probes are ignored
+            }
+        }
+    }
+    if (debug) std::cout << "Probe of " << size << " bytes got no answer" << std::endl;
+    return false;
+}
+
+template<typename DataProviderType, typename NetworkConnectionType, typename Policy>
+int StreamSender<DataProviderType, NetworkConnectionType, Policy>::stream() {
     conn.open();
+    if (pacer.txtimeEnabled() && !conn.enableTxTime()) {
+        std::cerr << "SO_TXTIME not supported, pacing with the token bucket instead" << std::endl;
+        pacer.configure(options.pace_mbps, options.pace_burst * DATA_PACKET_SIZE, false);
+    }
+    if (options.gso && !conn.enableSegmentation() && debug) {
+        std::cout << "No segmentation offload, sending packets one by one" << std::endl;
+    }
     handshake();
+    // The pacer's burst is counted in DATA packets, whose size the handshake just settled
+    const size_t data_packet_size = HEADER_SIZE + payload_size;
+    pacer.configure(options.pace_mbps, options.pace_burst * data_packet_size, pacer.txtimeEnabled());
+    // Packet buffers are only mapped now that their size is known, and only faulted in as the window fills
+    if (!buffers.allocate(window.capacity(), data_packet_size + (crc ? CRC32C_SIZE : 0))) {
+        std::cerr << "Could not allocate the send window" << std::endl;
+        return -1;
+    }
+    for (uint32_t i = 0; i < window.capacity(); i++) {
+        window.slot(i).packet = buffers[i];
+    }
+    if (debug) std::cout << "Send window buffers on " << buffers.backing() << " pages" << std::endl;
+
+    source = payloadSource(provider, std::is_base_of<PayloadSource, DataProviderType>());
+    if (options.producer_ring > 0 && !source) {
+        producer.reset(new PacketProducer<DataProviderType>(provider, options.producer_ring, crc, payload_size));
+        if (producer->start()) {
+            source = producer.get();
+        } else {
+            std::cerr << "Could not start the producer thread, reading in the send loop instead" << std::endl;
+            producer.reset();
+        }
+    }
+    if (source) {
+        source_wakes = conn.watch(source->wakeFd());
+    }
+
+    // Sequence numbers wrap around, so the stream only ends when the DataProvider runs out
+    base = next_seq = highest_nack = rtt_sample_seq = initial_seq;
+    window.clear(initial_seq);
+    cc->start(initial_seq);
 
     int count = 0;
     uint32_t final_seq = 0;
     bool done_streaming = false;
-    while (base < max_packets) {
-        while (next_seq < base + window_size && next_seq < max_packets && !done_streaming) {
+    PacketInfo* batch[SEND_BATCH_SIZE];
+    while (true) {
+        processACKs();
+
+        // Retransmits go first, so they get the pacer's budget ahead of new data
+        sendTimedOut();
+
+        // Only prepare what the pacer will let out, so new data never has to be requeued
+        size_t budget = pacer.available(data_packet_size, window_size);
+        uint32_t cwnd = cc->cwnd();
+        size_t batched = 0;
+        bool starved = false;   // the source hasn't readied the next payload yet
+        while (!send_blocked && budget > 0 && next_seq - base < cwnd && !done_streaming) {
+            if (source && !source->ready()) {
+                starved = true;
+                break;
+            }
             PacketInfo* info = preparePacket(next_seq);
             if (info == nullptr) {
                 done_streaming = true;
                 final_seq = next_seq;
                 break;  // No data left, done streaming!
             }
-            sendPacket(info);
+            batch[batched++] = info;
             next_seq++;
-        }
-
-        processACKs();
-
-        // Send all timed out packets
-        auto now = steady_clock::now();
-        for (uint32_t i = base; i < base + window_size; i++) {
-            PacketInfo* info = window.get(i);
-            if (info) {
-                auto elapsed = std::chrono::duration_cast<milliseconds>(now - info->last_sent);
-                if (elapsed.count() >= TIMEOUT_MS) {
-                    sendPacket(info);
-                }
-            } else {
-                if (debug) std::cout << "WARNING Didn't find " << i << " in window, base=" << base << std::endl;
-                break;
+            budget--;
+            if (batched == SEND_BATCH_SIZE || parity_pending) {
+                sendPackets(batch, batched);
+                batched = 0;
+            }
+            if (parity_pending) {
+                sendParity();   // right behind its group, so the receiver has it before the next group's data
             }
         }
+        if (batched > 0) {
+            sendPackets(batch, batched);
+        }
 
         if (base == final_seq && done_streaming) {
             // We have received an ACK for final seq, and we don't have any data left to stream.
             break;
         }
-        
-        std::this_thread::sleep_for(microseconds(SENDER_STREAMING_WAIT_US));
 
+        // Nothing left to send right now: sleep until an ACK arrives, the socket drains,
+        // the pacer has budget again, or the oldest in-flight packet times out.
+        bool window_open = next_seq - base < cc->cwnd() && !done_streaming;
+        bool paced = !pacer.ready(data_packet_size);
+        if (starved && !source->prepareWait()) {
+            starved = false;    // it caught up after all, go round again
+            continue;
+        }
+        if (send_blocked || paced || !window_open || starved) {
+            steady_clock::time_point deadline;
+            if (send_blocked) {
+                deadline = steady_clock::now() + milliseconds(TIMEOUT_MS);  // POLL_WRITABLE comes first
+            } else if (paced) {
+                deadline = pacer.nextRelease(data_packet_size);
+            } else {
+                deadline = nextDeadline();
+            }
+            if (starved && !source_wakes) {
+                deadline = std::min(deadline, steady_clock::now() + microseconds(PRODUCER_POLL_US));
+            }
+            int events = conn.wait(deadline, send_blocked);
+            if (events & POLL_WRITABLE) {
+                send_blocked = false;
+            }
+            if (starved || (events & POLL_WAKEUP)) {
+                source->endWait();
+            }
+        }
+
+        stats.record_cwnd(cc->cwnd());
+        stats.record_rto(rtt.timeout().count());
         stats.report();
     }
+    source = nullptr;
+    producer.reset();   // joins the thread, and closes its wakeup fd before teardown() waits on conn
     return count;
 }
 
-template<typename DataProviderType, typename NetworkConnectionType>
-PacketInfo* StreamSender<DataProviderType, NetworkConnectionType>::preparePacket(uint32_t seq_num) {
+template<typename DataProviderType, typename NetworkConnectionType, typename Policy>
+void StreamSender<DataProviderType, NetworkConnectionType, Policy>::sendTimedOut() {
+    // in_flight is ordered by last_sent and every packet shares the current RTO,
+    // so stop at the first packet that hasn't timed out yet.
+    // When paced, only take what the pacer can let out soon; the rest stays expired at the head.
+    auto now = steady_clock::now();
+    size_t limit = pacer.enabled() ? options.pace_burst : window_size;
+    PacketInfo* info;
+    expired.clear();
+    while (!send_blocked && expired.size() < limit && (info = in_flight.front()) != nullptr &&
+            deadline(info) <= now) {
+        expired.push_back(in_flight.pop());
+    }
+    if (expired.empty()) return;
+
+    // Resend oldest sequence numbers first. Recently NACK'd packets sit at the tail of in_flight,
+    // and the end of a large burst is what a full receiver socket drops.
+    std::sort(expired.begin(), expired.end(), [](PacketInfo* a, PacketInfo* b) {
+        return seqBefore(ntohl(a->packet->header.seq_num), ntohl(b->packet->header.seq_num));
+    });
+
+    // Packets the pacer or a full socket held back were never sent: send them all, they are not a timeout.
+    // Of the ones that did time out, resend the base, anything NACK'd, and anything above the highest NACK.
+    // The receiver NACKs every gap below the highest packet it has, so the others below that have arrived
+    // and are only waiting behind a hole; resending them would just be dropped as duplicates. Their timer
+    // is restarted instead. Only the oldest unacknowledged packet timing out backs off the RTO.
+    bool first_timeout = true;
+    size_t to_send = 0;
+    for (size_t i = 0; i < expired.size(); i++) {
+        PacketInfo* info = expired[i];
+        uint32_t seq_num = ntohl(info->packet->header.seq_num);
+        if (info->last_sent == steady_clock::time_point()) {
+            expired[to_send++] = info;
+        } else if (seq_num == base || info->retried || !seqBefore(seq_num, highest_nack)) {
+            if (first_timeout) {
+                cc->onTimeout(seq_num, next_seq);
+                first_timeout = false;
+            }
+            if (seq_num == base) {
+                rtt.backoff();
+            }
+            info->retried = true;
+            expired[to_send++] = info;
+        } else {
+            info->last_sent = now;
+            in_flight.push(seq_num, info);
+        }
+    }
+    expired.resize(to_send);
+
+    for (size_t i = 0; i < expired.size(); i += SEND_BATCH_SIZE) {
+        size_t n = std::min(expired.size() - i, (size_t) SEND_BATCH_SIZE);
+        sendPackets(&expired[i], n);    // Re-queues them at the tail with a fresh last_sent
+    }
+}
+
+template<typename DataProviderType, typename NetworkConnectionType, typename Policy>
+steady_clock::time_point StreamSender<DataProviderType, NetworkConnectionType, Policy>::nextDeadline() {
+    PacketInfo* oldest = in_flight.front();
+    if (oldest) {
+        return deadline(oldest);
+    }
+    return steady_clock::now() + rtt.timeout();
+}
+
+template<typename DataProviderType, typename NetworkConnectionType, typename Policy>
+steady_clock::time_point StreamSender<DataProviderType, NetworkConnectionType, Policy>::deadline(PacketInfo* info) {
+    // Packets the pacer or a full socket held back were never sent and are due right away.
+    // Otherwise, as TCP restarts its timer on every ACK for new data, nothing times out while the window keeps
+    // moving: holes above the base are repaired by NACKs, timeouts are for when the ACKs stall for an RTO.
+    if (info->last_sent == steady_clock::time_point()) {
+        return info->last_sent;
+    }
+    return std::max(info->last_sent, last_progress) + rtt.timeout();
+}
+
+template<typename DataProviderType, typename NetworkConnectionType, typename Policy>
+PacketInfo* StreamSender<DataProviderType, NetworkConnectionType, Policy>::preparePacket(uint32_t seq_num) {
     PacketInfo* info = window.reserve(seq_num);
-    Packet* packet = &info->packet;
+    info->retried = false;      // Slots are reused, don't inherit the previous seq's NACK state
+    info->first_sent = steady_clock::time_point();
+    Packet* packet = info->packet;
     PacketHeader* header = &packet->header;
     char* dataBuffer = packet->data;
 
     header->seq_num = htonl(seq_num);
-    header->window_size = htons(window_size);
+    header->window_size = htons(cc->cwnd());    // the window actually in use, the receiver ACKs once per window
     header->control_flags = FLAG_DATA;
-    header->checksum = 0;
 
-    size_t size = provider.getData(PAYLOAD_SIZE, dataBuffer);
+    size_t size;
+    if (source) {
+        // Already read by another thread, only the header is left to add.
+        // The copy frees the ring slot right away; it is far cheaper than the read.
+        uint32_t sum;
+        size = source->take(dataBuffer, crc, &sum);
+        info->wire_size = sealPacket(packet, size + sizeof(PacketHeader), crc, &sum);
+    } else {
+        size = provider.getData(payload_size, dataBuffer);
+        info->wire_size = sealPacket(packet, size + sizeof(PacketHeader), crc);
+    }
     if (size == 0) {
         window.erase(seq_num);
         return nullptr; // No data left! Done streaming.
     }
     info->data_size = size;
 
-    uint16_t chksum = compute_checksum(packet, info->packet_size());
-    uint16_t net_chksum = htons(chksum);
-    header->checksum = net_chksum;
+    parity_pending = fec.add(seq_num, dataBuffer, size) || parity_pending;
 
     return info;
 }
 
-template<typename DataProviderType, typename NetworkConnectionType>
-int StreamSender<DataProviderType, NetworkConnectionType>::sendPacket(PacketInfo* info) {
-    ssize_t sent = conn.send(&info->packet, info->packet_size());
+template<typename DataProviderType, typename NetworkConnectionType, typename Policy>
+int StreamSender<DataProviderType, NetworkConnectionType, Policy>::sendPacket(PacketInfo* info) {
+    return sendPackets(&info, 1);
+}
+
+template<typename DataProviderType, typename NetworkConnectionType, typename Policy>
+int StreamSender<DataProviderType, NetworkConnectionType, Policy>::sendPackets(PacketInfo** infos, size_t n) {
+    iovec iov[SEND_BATCH_SIZE];
+    assert(n <= SEND_BATCH_SIZE);
+    for (size_t i = 0; i < n; i++) {
+        iov[i].iov_base = infos[i]->packet;
+        iov[i].iov_len = infos[i]->wire_size;
+    }
 
+    // The pacer may hold back the tail of the batch, which is then requeued like an unsent packet
+    uint64_t txtimes[SEND_BATCH_SIZE];
+    uint64_t* departures = pacer.txtimeEnabled() ? txtimes : nullptr;
+    size_t admitted = pacer.admit(iov, n, departures);
+
+    int sent = (admitted > 0) ? conn.sendBatch(iov, admitted, departures) : 0;
     if(sent < 0) {
-        perror("sendto failed");
-    } else {
-        if(debug)
-            std::cout << "Sent DATA packet seq: " << ntohl(info->packet.header.seq_num) << " Len: " << sent << std::endl;
-        stats.record_packet(sent);
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS)
+            perror("sendBatch failed");
+        sent = 0;
+    }
+    if ((size_t) sent < admitted) {
+        send_blocked = true;    // Socket buffer is full, wait for it to drain before sending more
+        pacer.refund(iov + sent, admitted - sent);
     }
 
-    info->last_sent = steady_clock::now();
-    return info->packet_size();
+    int bytes = 0;
+    auto now = steady_clock::now();
+    for (size_t i = 0; i < (size_t) sent; i++) {
+        if (infos[i]->first_sent == steady_clock::time_point()) {
+            infos[i]->first_sent = now;
+        }
+        infos[i]->last_sent = now;
+        uint32_t seq_num = ntohl(infos[i]->packet->header.seq_num);
+        if (window.contains(seq_num)) {
+            in_flight.push(seq_num, infos[i]);  // A NACK'd retransmit may have been ACK'd since it was queued
+        }
+        if(debug)
+            std::cout << "Sent DATA packet seq: " << seq_num << " Len: " << iov[i].iov_len << std::endl;
+        stats.record_packet(iov[i].iov_len);
+        bytes += iov[i].iov_len;
+    }
+    // Packets the pacer or the kernel didn't take go to the head of the queue as already expired,
+    // so sendTimedOut() retries them as soon as there is budget and the socket is writable again.
+    for (size_t i = n; i-- > (size_t) sent; ) {
+        infos[i]->last_sent = steady_clock::time_point();
+        uint32_t seq_num = ntohl(infos[i]->packet->header.seq_num);
+        if (window.contains(seq_num)) {
+            in_flight.pushFront(seq_num, infos[i]);
+        }
+    }
+    return bytes;
 }
 
 
-template<typename DataProviderType, typename NetworkConnectionType>
-int StreamSender<DataProviderType, NetworkConnectionType>::processACKs() {
-    // Process incoming ACK/NACK responses.
-    timeval delay = {0, SENDER_ACK_WAIT_US}; // Wait long for the first ACK.
-    while (conn.ready(delay)) {
-        Packet packet;
-        ssize_t recv_len = conn.receive(&packet, sizeof(packet));
+template<typename DataProviderType, typename NetworkConnectionType, typename Policy>
+void StreamSender<DataProviderType, NetworkConnectionType, Policy>::sendParity() {
+    // Parity is best effort: it isn't windowed, ACK'd or retransmitted,
+    // and whatever the pacer or the socket won't take right now is dropped.
+    parity_pending = false;
+    iovec iov[FEC_MAX_PARITY];
+    size_t n = fec.parityCount();
+    for (size_t i = 0; i < n; i++) {
+        iov[i].iov_base = &fec.parity()[i];
+        iov[i].iov_len = sealPacket(&fec.parity()[i], fec.paritySize(), crc);
+    }
+    uint64_t txtimes[FEC_MAX_PARITY];
+    uint64_t* departures = pacer.txtimeEnabled() ? txtimes : nullptr;
+    size_t admitted = pacer.admit(iov, n, departures);
+
+    int sent = (admitted > 0) ? conn.sendBatch(iov, admitted, departures) : 0;
+    if (sent < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS)
+            perror("sendBatch parity failed");
+        sent = 0;
+    }
+    if ((size_t) sent < admitted) {
+        send_blocked = true;
+        pacer.refund(iov + sent, admitted - sent);
+    }
+    if (debug)
+        std::cout << "Sent " << sent << " PARITY packets for group " << ntohl(fec.parity()[0].header.seq_num) << std::endl;
+}
+
+template<typename DataProviderType, typename NetworkConnectionType, typename Policy>
+int StreamSender<DataProviderType, NetworkConnectionType, Policy>::processACKs() {
+    // Process incoming ACK/NACK/SACK responses.
+    // The socket is non-blocking: drain whatever has arrived, the caller waits for readiness.
+    PacketInfo* retransmits[SEND_BATCH_SIZE];
+    size_t num_retransmits = 0;
+    Packet packet;
+    ssize_t recv_len;
+    while ((recv_len = conn.receive(&packet, sizeof(packet))) >= 0) {
         if(recv_len >= HEADER_SIZE) {
             uint32_t pkt_seq = ntohl(packet.header.seq_num);
             uint8_t ctrl_flag = packet.header.control_flags;
-            // Verify checksum.
-            if(!verifyChecksum(&packet, recv_len)) {
+            // Verify checksum, and drop the CRC32C trailer if there is one
+            recv_len = Policy::Integrity::check(&packet, recv_len, crc);
+            if(recv_len < 0) {
                 if(debug) std::cerr << "Received control packet with invalid checksum, discarding." << std::endl;
                 stats.record_corrupted();
+                continue;
             }
 
             if(ctrl_flag == FLAG_ACK) {
                 if(debug) std::cout << "Received ACK for seq: " << pkt_seq << std::endl;
                 stats.record_ack();
-                if(pkt_seq >= base) {
-                    window.advanceTo(pkt_seq);
-                    base = pkt_seq;
+                // Only base..next_seq can be ACKed, anything else is stale or bogus
+                if(!seqBefore(pkt_seq, base) && !seqBefore(next_seq, pkt_seq)) {
+                    processCumulativeACK(pkt_seq);
                 } else {
                     stats.record_ignored();
                 }
             } else if(ctrl_flag == FLAG_NACK) {
                 if(debug) std::cout << "Received NACK for seq: " << pkt_seq << std::endl;
                 stats.record_ack(FLAG_NACK);
-                PacketInfo* info = window.get(pkt_seq);
-                if (info) {
-                    auto now = steady_clock::now();
-                    auto elapsed = duration_cast<milliseconds>(now - info->last_sent).count();
-                    if (!info->retried || elapsed > RETRY_MS) {     
-                        // If we haven't retried this packet from a NACK already OR we did a while ago, resend it.
-                        sendPacket(info);
-                        info->retried = true;
-                    } else {
-                        if (debug) std::cout << "Not retrying yet..." << std::endl;
-                        stats.record_ignored();
-                    }
+                cc->onLoss(pkt_seq, next_seq);
+                fec.onLoss(1);
+                highest_nack = seqMax(highest_nack, pkt_seq);
+                if (window.get(pkt_seq)) {
+                    retransmitNACKd(pkt_seq, retransmits, num_retransmits);
                 } else {
                     std::cerr << "FATAL ERROR: Window did not have NACKd packet " << pkt_seq << std::endl;
                 }
+            } else if(ctrl_flag == FLAG_SACK) {
+                // Cumulative ACK first, then every hole it lists in one pass.
+                // An ACK outside base..next_seq, or holes below the new base or past next_seq,
+                // can only come from a stale or bogus SACK.
+                stats.record_ack(FLAG_SACK);
+                if(!seqBefore(pkt_seq, base) && !seqBefore(next_seq, pkt_seq)) {
+                    processCumulativeACK(pkt_seq);
+                }
+                size_t num_blocks = (recv_len - HEADER_SIZE) / sizeof(SackBlock);
+                SackBlock* blocks = reinterpret_cast<SackBlock*>(packet.data);
+                for (size_t i = 0; i < num_blocks; i++) {
+                    uint32_t start = seqMax(ntohl(blocks[i].start), base);
+                    uint32_t end = seqMin(ntohl(blocks[i].end), next_seq);
+                    if (!seqBefore(start, end)) continue;
+                    if(debug) std::cout << "Received SACK hole [" << start << ", " << end << ")" << std::endl;
+                    cc->onLoss(start, next_seq);
+                    fec.onLoss(end - start);
+                    highest_nack = seqMax(highest_nack, end - 1);
+                    for (uint32_t seq_num = start; seq_num != end; seq_num++) {
+                        if (window.get(seq_num)) {
+                            retransmitNACKd(seq_num, retransmits, num_retransmits);
+                        }
+                    }
+                }
             } else {
                 if (debug) {
                     std::cout << "Unexpected Flag" << std::endl;
                 }
             }
         }
-        delay = {0, SENDER_SUBSEQUENT_ACK_WAIT_US};  // Don't wait long for subsequent ACKs
+    }
+    if (num_retransmits > 0) {
+        sendPackets(retransmits, num_retransmits);
     }
     return true;
 }
 
-template<typename DataProviderType, typename NetworkConnectionType>
-int StreamSender<DataProviderType, NetworkConnectionType>::teardown() {
+template<typename DataProviderType, typename NetworkConnectionType, typename Policy>
+void StreamSender<DataProviderType, NetworkConnectionType, Policy>::processCumulativeACK(uint32_t pkt_seq) {
+    // RTT sample from the oldest packet this ACK covers: the receiver ACKs at most once per batch,
+    // so that is how long a packet really waits for its ACK, which is what the RTO has to cover.
+    // Only if nothing it covers was retransmitted: Karn's rule for the sampled packet, and for the
+    // rest the ACK was held back waiting for the retransmit, which would count as delay.
+    bool clean = true;
+    PacketInfo* oldest = window.get(base);
+    PacketInfo* newest = window.get(pkt_seq - 1);
+    auto first_sent = oldest ? oldest->first_sent : steady_clock::time_point();
+    bool progress = seqBefore(base, pkt_seq);
+    if (progress && newest && !newest->retried && newest->first_sent != steady_clock::time_point()) {
+        path_rtt.sample(duration_cast<microseconds>(steady_clock::now() - newest->first_sent));
+    }
+    for (uint32_t acked = base; acked != pkt_seq; acked++) {
+        PacketInfo* info = window.get(acked);
+        if (info) {
+            clean = clean && !info->retried;
+            in_flight.remove(acked, info);
+        }
+    }
+    if (progress) {
+        last_progress = steady_clock::now();
+        rtt.resetBackoff();
+    }
+    microseconds sample(0);
+    if (clean && progress && first_sent != steady_clock::time_point()) {
+        sample = duration_cast<microseconds>(steady_clock::now() - first_sent);
+        stats.record_rtt(sample.count());
+        // Feed the estimator once per round trip. Back-to-back ACKs for one window give nearly
+        // identical samples that would shrink RTTVAR, and with it the RTO, far below the real spread.
+        if (seqBefore(rtt_sample_seq, pkt_seq)) {
+            rtt.sample(sample);
+            rtt_sample_seq = next_seq;
+        }
+    }
+    cc->onAck(pkt_seq - base, sample);
+    window.advanceTo(pkt_seq);
+    base = pkt_seq;
+}
+
+template<typename DataProviderType, typename NetworkConnectionType, typename Policy>
+void StreamSender<DataProviderType, NetworkConnectionType, Policy>::retransmitNACKd(
+        uint32_t seq_num, PacketInfo** retransmits, size_t& num_retransmits) {
+    PacketInfo* info = window.get(seq_num);
+    auto now = steady_clock::now();
+    // Until the path RTT has a sample, a round trip is only known as far as the RTO goes
+    microseconds round_trip = path_rtt.sampled() ? path_rtt.smoothed() : rtt.timeout();
+    if (!info->retried || now - info->last_sent > round_trip) {
+        // If we haven't retried this packet already OR a NACK sent after our retransmit got there
+        // could be back by now (one round trip), resend it. Otherwise it is a stale duplicate.
+        // Stamp it now so a duplicate NACK in this same drain is gated too.
+        info->last_sent = now;
+        info->retried = true;
+        retransmits[num_retransmits++] = info;
+        if (num_retransmits == SEND_BATCH_SIZE) {
+            sendPackets(retransmits, num_retransmits);
+            num_retransmits = 0;
+        }
+    } else {
+        if (debug) std::cout << "Not retrying yet..." << std::endl;
+        stats.record_ignored();
+    }
+}
+
+template<typename DataProviderType, typename NetworkConnectionType, typename Policy>
+int StreamSender<DataProviderType, NetworkConnectionType, Policy>::teardown() {
     stats.report(true);
-    PacketHeader header;
-    prepareFINPacket(&header, FLAG_FIN);
+    ControlPacket fin;
+    prepareFINPacket(&fin, FLAG_FIN);
 
     bool fin_ack_received = false;
     // counter for retransmission of FIN-ACK
     int fin_ack_retransmissions = 0;
     while(!fin_ack_received && fin_ack_retransmissions < 5) {
-        ssize_t s = conn.send(&header, sizeof(header));
+        int s = sendControl(&fin);
         if(s < 0)
             perror("sendto FIN failed");
         else if(debug)
             std::cout << "Sent FIN packet" << std::endl;
         
         if (conn.ready({1, 0})) {
-            char ack_buf[DATA_PACKET_SIZE];
+            char ack_buf[sizeof(Packet)];
             ssize_t r = conn.receive(ack_buf, sizeof(ack_buf));
             if(r >= HEADER_SIZE) {
                 PacketHeader* ack_hdr = reinterpret_cast<PacketHeader*>(ack_buf);
@@ -246,12 +713,11 @@ int StreamSender<DataProviderType, NetworkConnectionType>::teardown() {
                 }
             }
         }
-        std::this_thread::sleep_for(milliseconds(RETRY_MS));
         fin_ack_retransmissions++;
     }
-    PacketHeader finHeader;
-    prepareFINPacket(&finHeader, FLAG_ACK);
-    ssize_t s2 = conn.send(&finHeader, sizeof(PacketHeader));
+    ControlPacket final_ack;
+    prepareFINPacket(&final_ack, FLAG_ACK);
+    int s2 = sendControl(&final_ack);
     if(s2 < 0)
         perror("sendto final ACK failed");
     else if(debug)
@@ -261,14 +727,19 @@ int StreamSender<DataProviderType, NetworkConnectionType>::teardown() {
     return 0;
 }
 
-template<typename DataProviderType, typename NetworkConnectionType>
-void StreamSender<DataProviderType, NetworkConnectionType>::prepareFINPacket(
-        PacketHeader* header, ControlFlag flag) {
-    header->seq_num = htonl(max_packets);
-    header->window_size = htons(window_size);
-    header->control_flags = flag;
-    header->checksum = 0;
-    
-    uint16_t chksum = compute_checksum(header, CTRL_PACKET_SIZE);
-    header->checksum = htons(chksum);
+template<typename DataProviderType, typename NetworkConnectionType, typename Policy>
+int StreamSender<DataProviderType, NetworkConnectionType, Policy>::sendControl(ControlPacket* packet) {
+    // Control packets share the batched transmit path as single-datagram batches.
+    size_t len = CTRL_PACKET_SIZE + (crc ? CRC32C_SIZE : 0);
+    iovec iov = {packet, len};
+    return conn.sendBatch(&iov, 1);
+}
+
+template<typename DataProviderType, typename NetworkConnectionType, typename Policy>
+void StreamSender<DataProviderType, NetworkConnectionType, Policy>::prepareFINPacket(
+        ControlPacket* packet, ControlFlag flag) {
+    packet->header.seq_num = htonl(next_seq);
+    packet->header.window_size = htons(window_size);
+    packet->header.control_flags = flag;
+    sealPacket(packet, CTRL_PACKET_SIZE, crc);
 }
\ No newline at end of file
@@ -1,10 +1,23 @@
 #pragma once
 #include <cstring>
 #include <string>
+#include <vector>
+#include <memory>
 #include <random>
 #include <stdio.h>
+#include <algorithm>
+#include "Protocol.hpp"
 #include "NetworkUtils.hpp"
 #include "NetworkConnection.hpp"
+#ifdef __linux__
+#include <netinet/udp.h>
+#include <linux/net_tstamp.h>
+#endif
+
+#ifdef UDP_SEGMENT
+const size_t GSO_MAX_SEGMENTS = 64;     // UDP_MAX_SEGMENTS in the kernel
+const size_t GSO_MAX_BYTES = 65507;     // payload of the largest IPv4 UDP datagram, which a super-datagram still is
+#endif
 
 
 class UDPNetworkConnection : public NetworkConnection {
@@ -15,19 +28,116 @@ public:
     ssize_t send(void* packet, size_t len) override {
         return sendto(sockfd, packet, len, 0, (sockaddr*)&receiver_addr, sizeof(receiver_addr));
     }
+#ifdef __linux__
+    bool enableTxTime() override {
+#ifdef SO_TXTIME
+        // Departure times are only honoured by the fq (or etf) qdisc on the outgoing interface,
+        // and fq compares them against CLOCK_MONOTONIC, which is what steady_clock reads.
+        sock_txtime config = {};
+        config.clockid = CLOCK_MONOTONIC;
+        config.flags = 0;
+        if (setsockopt(sockfd, SOL_SOCKET, SO_TXTIME, &config, sizeof(config)) == 0) {
+            return true;
+        }
+        perror("SO_TXTIME unavailable");
+#endif
+        return false;
+    }
+
+    bool enableSegmentation() override {
+#ifdef UDP_SEGMENT
+        // Probe for Linux 4.18+: set a socket wide segment size, then clear it again so only sendBatch() segments
+        int size = DATA_PACKET_SIZE;
+        if (setsockopt(sockfd, SOL_UDP, UDP_SEGMENT, &size, sizeof(size)) == 0) {
+            size = 0;
+            setsockopt(sockfd, SOL_UDP, UDP_SEGMENT, &size, sizeof(size));
+            gso = true;
+            return true;
+        }
+        perror("UDP_SEGMENT unavailable");
+#endif
+        return false;
+    }
+
+    bool setDontFragment(bool on) override {
+        // IP_PMTUDISC_PROBE sets DF but ignores the kernel's cached path MTU, which the probe is there to find.
+        // Turning it off puts back whatever the socket had before.
+        if (on) {
+            socklen_t len = sizeof(pmtu_mode);
+            if (getsockopt(sockfd, IPPROTO_IP, IP_MTU_DISCOVER, &pmtu_mode, &len) < 0) {
+                perror("IP_MTU_DISCOVER unavailable");
+                return false;
+            }
+        }
+        int mode = on ? IP_PMTUDISC_PROBE : pmtu_mode;
+        if (setsockopt(sockfd, IPPROTO_IP, IP_MTU_DISCOVER, &mode, sizeof(mode)) < 0) {
+            perror("IP_MTU_DISCOVER unavailable");
+            return false;
+        }
+        return true;
+    }
+
+    int sendBatch(iovec* packets, size_t n, const uint64_t* txtimes=nullptr) override {
+#ifdef UDP_SEGMENT
+        // A super-datagram leaves at once, so with departure times every datagram goes on its own
+        if (gso && !txtimes) {
+            return sendSegmented(packets, n);
+        }
+#endif
+        // One sendmmsg() syscall per SEND_BATCH_SIZE datagrams instead of one sendto() each.
+        mmsghdr msgs[SEND_BATCH_SIZE];
+#ifdef SO_TXTIME
+        char control[SEND_BATCH_SIZE][CMSG_SPACE(sizeof(uint64_t))];
+#endif
+        int total = 0;
+        while (n > 0) {
+            size_t chunk = std::min(n, (size_t) SEND_BATCH_SIZE);
+            std::memset(msgs, 0, chunk * sizeof(mmsghdr));
+            for (size_t i = 0; i < chunk; i++) {
+                msgs[i].msg_hdr.msg_name = &receiver_addr;
+                msgs[i].msg_hdr.msg_namelen = sizeof(receiver_addr);
+                msgs[i].msg_hdr.msg_iov = &packets[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+#ifdef SO_TXTIME
+                if (txtimes) {
+                    msgs[i].msg_hdr.msg_control = control[i];
+                    msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+                    cmsghdr* cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr);
+                    cmsg->cmsg_level = SOL_SOCKET;
+                    cmsg->cmsg_type = SCM_TXTIME;
+                    cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+                    std::memcpy(CMSG_DATA(cmsg), &txtimes[total + i], sizeof(uint64_t));
+                }
+#endif
+            }
+            int sent = sendmmsg(sockfd, msgs, chunk, 0);
+            if (sent < 0) {
+                return (total == 0) ? -1 : total;
+            }
+            total += sent;
+            if ((size_t) sent < chunk) break;   // Socket buffer full, caller decides what to do with the rest
+            packets += chunk;
+            n -= chunk;
+        }
+        return total;
+    }
+#endif
     ssize_t receive(void* buffer, size_t len) override {
         sockaddr_in ack_addr;
         socklen_t ack_addr_len = sizeof(ack_addr);
         return recvfrom(sockfd, buffer, len, 0, (sockaddr*)&ack_addr, &ack_addr_len);
     }
     bool ready(timeval tv) override {
-        fd_set readfds;
-        FD_ZERO(&readfds);
-        FD_SET(sockfd, &readfds);
-        int ret = select(sockfd+1, &readfds, nullptr, nullptr, &tv);
-        return (ret > 0 && FD_ISSET(sockfd, &readfds));
+        return poller.wait(tv) & POLL_READABLE;
+    }
+    int wait(std::chrono::steady_clock::time_point deadline, bool writable=false) override {
+        return poller.wait(deadline, writable);
+    }
+    bool watch(int fd) override {
+        return poller.watch(fd);
     }
     bool close() override {
+        poller.close();
         int success = ::close(sockfd);  // :: scope resolution to call std close()
         sockfd = -1;
         return success;
@@ -36,6 +146,72 @@ protected:
     int sockfd = -1;
     int receiver_port = -1;
     sockaddr_in receiver_addr;
+    EventPoller poller;     // epoll + timerfd on sockfd, set up by open()
+    bool gso = false;       // sendBatch() sends UDP_SEGMENT super-datagrams
+#ifdef __linux__
+    int pmtu_mode = IP_PMTUDISC_WANT;   // IP_MTU_DISCOVER from before setDontFragment(true)
+#endif
+
+#ifdef UDP_SEGMENT
+    // sendBatch() with GSO: each run of datagrams the size of its first (the last may be shorter) becomes one
+    // message with a UDP_SEGMENT cmsg, and all the runs go out in one sendmmsg(). A run is sent or not as a whole.
+    int sendSegmented(iovec* packets, size_t n) {
+        mmsghdr msgs[SEND_BATCH_SIZE];
+        char control[SEND_BATCH_SIZE][CMSG_SPACE(sizeof(uint16_t))];
+        size_t counts[SEND_BATCH_SIZE];
+        int total = 0;
+        while (n > 0) {
+            size_t runs = 0;
+            size_t taken = 0;
+            std::memset(msgs, 0, sizeof(msgs));
+            while (taken < n && runs < (size_t) SEND_BATCH_SIZE) {
+                iovec* run = &packets[taken];
+                size_t segment = run[0].iov_len;
+                size_t count = 1;
+                size_t bytes = segment;
+                while (taken + count < n && count < GSO_MAX_SEGMENTS && run[count - 1].iov_len == segment &&
+                        run[count].iov_len <= segment && bytes + run[count].iov_len <= GSO_MAX_BYTES) {
+                    bytes += run[count++].iov_len;
+                }
+                msghdr& hdr = msgs[runs].msg_hdr;
+                hdr.msg_name = &receiver_addr;
+                hdr.msg_namelen = sizeof(receiver_addr);
+                hdr.msg_iov = run;
+                hdr.msg_iovlen = count;
+                if (count > 1) {
+                    hdr.msg_control = control[runs];
+                    hdr.msg_controllen = sizeof(control[runs]);
+                    cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+                    cmsg->cmsg_level = SOL_UDP;
+                    cmsg->cmsg_type = UDP_SEGMENT;
+                    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                    uint16_t size = segment;
+                    std::memcpy(CMSG_DATA(cmsg), &size, sizeof(size));
+                }
+                counts[runs++] = count;
+                taken += count;
+            }
+            int sent = sendmmsg(sockfd, msgs, runs, 0);
+            if (sent < 0) {
+                if ((errno == EIO || errno == EMSGSIZE || errno == EINVAL) && total == 0) {
+                    // The route's device can't checksum the segments (EIO), or a segment is larger than its MTU
+                    // and would need IP fragmentation, which GSO doesn't do (EMSGSIZE, or EINVAL on older kernels)
+                    std::cerr << "UDP GSO rejected by the route (" << strerror(errno) << "), sending datagrams one by one" << std::endl;
+                    gso = false;
+                    return sendBatch(packets, n);
+                }
+                return (total == 0) ? -1 : total;
+            }
+            for (int i = 0; i < sent; i++) {
+                total += counts[i];
+            }
+            if (sent < (int) runs) break;   // Socket buffer full, caller decides what to do with the rest
+            packets += taken;
+            n -= taken;
+        }
+        return total;
+    }
+#endif
 };
 
 class UDPStreamSender : public UDPNetworkConnection {
@@ -53,6 +229,7 @@ public:
     bool open() override {
         sockfd = createUDPSocket();
         receiver_addr = setupReceiver(sockfd, receiver_port, receiver_ip);
+        poller.open(sockfd);
         std::cout << "Sender Bound to " << receiver_ip << " " << receiver_port << std::endl;
         return true;
     }
@@ -87,6 +264,7 @@ public:
             ::close(sockfd);
             exit(EXIT_FAILURE);
         }
+        poller.open(sockfd);
         std::cout << "Receiver listening on port " << receiver_port << std::endl;
         
         return true;
@@ -99,39 +277,350 @@ public:
         receiver_addr = ack_addr;   // Different for StreamReceiver ?
         return ret;
     }
+#ifdef __linux__
+    bool enableCoalescing(size_t batch, size_t buffer_size) override {
+#ifdef UDP_GRO
+        // A smaller batch could only take coalesced datagrams apart by copying every segment,
+        // which costs more than the kernel splitting them up
+        if (batch < groBuffers(buffer_size)) {
+            return false;
+        }
+        int on = 1;
+        if (setsockopt(sockfd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0) {
+            // Address space for a coalesced datagram behind every batch buffer, only faulted in if one arrives
+            overflow_size = GSO_MAX_BYTES - std::min(buffer_size, GSO_MAX_BYTES);
+            overflow.reset(new char[RECV_BATCH_SIZE * overflow_size]);
+            coalesced_layout = false;
+            gro = true;
+            return true;
+        }
+        perror("UDP_GRO unavailable");
+#endif
+        return false;
+    }
+
+    size_t takeCopied() override {
+        size_t bytes = copied;
+        copied = 0;
+        return bytes;
+    }
+
+    int receiveBatch(iovec* buffers, ssize_t* lengths, size_t n) override {
+#ifdef UDP_GRO
+        if (gro) {
+            if (pending_next < pending_lengths.size()) {
+                return receivePending(buffers, lengths, n);
+            }
+            return coalesced_layout ? receiveCoalesced(buffers, lengths, n) : receiveDeep(buffers, lengths, n);
+        }
+#endif
+        // Drain up to n queued datagrams with a single recvmmsg() syscall.
+        n = std::min(n, (size_t) RECV_BATCH_SIZE);
+        mmsghdr msgs[RECV_BATCH_SIZE];
+        sockaddr_in addrs[RECV_BATCH_SIZE];
+        std::memset(msgs, 0, n * sizeof(mmsghdr));
+        for (size_t i = 0; i < n; i++) {
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            msgs[i].msg_hdr.msg_iov = &buffers[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int received = recvmmsg(sockfd, msgs, n, MSG_DONTWAIT, nullptr);
+        if (received <= 0) {
+            return -1;
+        }
+        for (int i = 0; i < received; i++) {
+            lengths[i] = msgs[i].msg_len;
+        }
+        receiver_addr = addrs[received - 1];
+        return received;
+    }
+#endif
+
+protected:
+    bool gro = false;       // receiveBatch() splits up UDP_GRO coalesced datagrams
+    size_t copied = 0;      // bytes receiveBatch() copied, see takeCopied()
+
+#ifdef UDP_GRO
+    // With GRO on, a datagram from a peer that doesn't send with GSO still arrives on its own, and so do all of them
+    // from older senders or after a GSO fallback. receiveBatch() starts out with one message per buffer, the depth
+    // of a plain recvmmsg(), and only lays batches out for coalesced datagrams once the peer is seen to send them.
+    bool coalesced_layout = false;      // batches are laid out by receiveCoalesced(), else by receiveDeep()
+    size_t overflow_size = 0;           // room behind each buffer in receiveDeep() for the rest of a coalesced datagram
+    std::unique_ptr<char[]> overflow;
+    std::vector<char> pending;          // segments receiveDeep() had no buffer left for, one buffer_size slot each
+    std::vector<size_t> pending_lengths;
+    size_t pending_next = 0;
+
+    // Buffers it takes to hold the largest coalesced datagram
+    static size_t groBuffers(size_t buffer_size) {
+        return (GSO_MAX_BYTES + buffer_size - 1) / buffer_size;
+    }
+
+    // Segment size of a received datagram, its length if the kernel didn't coalesce it
+    static size_t groSegment(msghdr& hdr, size_t len) {
+        size_t segment = len;
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+            if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                int gso_size;
+                std::memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+                segment = gso_size;
+            }
+        }
+        return segment;
+    }
+
+    // receiveBatch() with GRO while the peer's datagrams arrive one by one: a message per buffer like plain recvmmsg(),
+    // each followed by an overflow area in case the kernel coalesced it after all. The segments of such a datagram
+    // are copied to the buffers this batch didn't use, and what doesn't fit to pending for the next call.
+    // Batches are laid out for coalesced datagrams from then on.
+    int receiveDeep(iovec* buffers, ssize_t* lengths, size_t n) {
+        size_t size = buffers[0].iov_len;
+        n = std::min(n, (size_t) RECV_BATCH_SIZE);
+        mmsghdr msgs[RECV_BATCH_SIZE];
+        sockaddr_in addrs[RECV_BATCH_SIZE];
+        iovec iovs[RECV_BATCH_SIZE][2];
+        char control[RECV_BATCH_SIZE][CMSG_SPACE(sizeof(int))];
+        std::memset(msgs, 0, n * sizeof(mmsghdr));
+        for (size_t j = 0; j < n; j++) {
+            iovs[j][0] = buffers[j];
+            iovs[j][1].iov_base = overflow.get() + j * overflow_size;
+            iovs[j][1].iov_len = overflow_size;
+            msgs[j].msg_hdr.msg_name = &addrs[j];
+            msgs[j].msg_hdr.msg_namelen = sizeof(addrs[j]);
+            msgs[j].msg_hdr.msg_iov = iovs[j];
+            msgs[j].msg_hdr.msg_iovlen = (overflow_size > 0) ? 2 : 1;
+            msgs[j].msg_hdr.msg_control = control[j];
+            msgs[j].msg_hdr.msg_controllen = sizeof(control[j]);
+        }
+        int received = recvmmsg(sockfd, msgs, n, MSG_DONTWAIT, nullptr);
+        if (received <= 0) {
+            return -1;
+        }
+        receiver_addr = addrs[received - 1];
+
+        // Fast path: nothing coalesced or cut short, every datagram is already in its own buffer
+        bool single = true;
+        for (int j = 0; j < received && single; j++) {
+            lengths[j] = msgs[j].msg_len;
+            single = groSegment(msgs[j].msg_hdr, msgs[j].msg_len) == msgs[j].msg_len && msgs[j].msg_len <= size;
+        }
+        if (single) {
+            return received;
+        }
+
+        // Otherwise rebuild the batch in order: each datagram's own buffer, then a spare one per further segment
+        coalesced_layout = true;
+        iovec spare[RECV_BATCH_SIZE];
+        size_t spares = 0;
+        for (size_t j = received; j < n; j++) {
+            spare[spares++] = buffers[j];
+        }
+        iovec out[RECV_BATCH_SIZE];
+        size_t count = 0;
+        for (int j = 0; j < received; j++) {
+            size_t len = msgs[j].msg_len;
+            size_t segment = groSegment(msgs[j].msg_hdr, len);
+            if (segment > size || (segment == 0 && len > 0)) {
+                spare[spares++] = iovs[j][0];   // Larger than a buffer, so it was cut short like recvmmsg() would have
+                continue;
+            }
+            size_t segments = (len == 0) ? 1 : (len + segment - 1) / segment;
+            for (size_t s = 0; s < segments; s++) {
+                size_t length = std::min(segment, len - s * segment);
+                if (s == 0 && pending_lengths.empty()) {
+                    lengths[count] = length;
+                    out[count++] = iovs[j][0];
+                } else if (s > 0 && spares > 0 && pending_lengths.empty()) {
+                    copySegment(spare[spares - 1].iov_base, iovs[j], s * segment, length);
+                    copied += length;
+                    lengths[count] = length;
+                    out[count++] = spare[--spares];
+                } else {
+                    // Past the end of the batch, in order behind whatever is pending already
+                    pending.resize((pending_lengths.size() + 1) * size);
+                    copySegment(&pending[pending_lengths.size() * size], iovs[j], s * segment, length);
+                    copied += length;
+                    pending_lengths.push_back(length);
+                    if (s == 0) spare[spares++] = iovs[j][0];
+                }
+            }
+        }
+        // Hand every buffer back, the unused ones behind the batch
+        for (size_t i = 0; i < count; i++) {
+            buffers[i] = out[i];
+        }
+        for (size_t i = count; i < n; i++) {
+            buffers[i] = spare[--spares];
+        }
+        if (count == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+        return count;
+    }
+
+    // Copy length bytes at offset of a datagram received into a buffer and its overflow area
+    static void copySegment(void* dst, const iovec* iov, size_t offset, size_t length) {
+        if (offset < iov[0].iov_len) {
+            size_t head = std::min(length, iov[0].iov_len - offset);
+            std::memcpy(dst, (char*) iov[0].iov_base + offset, head);
+            dst = (char*) dst + head;
+            length -= head;
+            offset += head;
+        }
+        std::memcpy(dst, (char*) iov[1].iov_base + (offset - iov[0].iov_len), length);
+    }
+
+    // receiveBatch() while receiveDeep() left segments behind: deliver those first, in order, without a syscall
+    int receivePending(iovec* buffers, ssize_t* lengths, size_t n) {
+        size_t size = buffers[0].iov_len;
+        size_t count = 0;
+        for (; count < n && pending_next < pending_lengths.size(); count++, pending_next++) {
+            std::memcpy(buffers[count].iov_base, &pending[pending_next * size], pending_lengths[pending_next]);
+            copied += pending_lengths[pending_next];
+            lengths[count] = pending_lengths[pending_next];
+        }
+        if (pending_next == pending_lengths.size()) {
+            pending_lengths.clear();
+            pending_next = 0;
+        }
+        return count;
+    }
+
+    // receiveBatch() with GRO once the peer sends coalesced datagrams. Each message gets enough consecutive buffers
+    // for the largest coalesced datagram, and the kernel scatters the datagram across them, so with segments the size
+    // of a buffer (DATA packets) every segment already starts its own buffer. The buffers holding segments are then
+    // swapped to the front. A full batch of datagrams that weren't coalesced switches back to receiveDeep().
+    int receiveCoalesced(iovec* buffers, ssize_t* lengths, size_t n) {
+        size_t size = buffers[0].iov_len;
+        size_t per_msg = std::min(n, groBuffers(size));
+        size_t m = std::min(n / per_msg, (size_t) RECV_BATCH_SIZE);
+        mmsghdr msgs[RECV_BATCH_SIZE];
+        sockaddr_in addrs[RECV_BATCH_SIZE];
+        char control[RECV_BATCH_SIZE][CMSG_SPACE(sizeof(int))];
+        std::memset(msgs, 0, m * sizeof(mmsghdr));
+        for (size_t j = 0; j < m; j++) {
+            msgs[j].msg_hdr.msg_name = &addrs[j];
+            msgs[j].msg_hdr.msg_namelen = sizeof(addrs[j]);
+            msgs[j].msg_hdr.msg_iov = &buffers[j * per_msg];
+            msgs[j].msg_hdr.msg_iovlen = per_msg;
+            msgs[j].msg_hdr.msg_control = control[j];
+            msgs[j].msg_hdr.msg_controllen = sizeof(control[j]);
+        }
+        int received = recvmmsg(sockfd, msgs, m, MSG_DONTWAIT, nullptr);
+        if (received <= 0) {
+            return -1;
+        }
+        size_t count = 0;
+        bool coalesced = false;
+        for (int j = 0; j < received; j++) {
+            size_t len = msgs[j].msg_len;
+            size_t segment = groSegment(msgs[j].msg_hdr, len);
+            iovec* first = &buffers[j * per_msg];
+            if (segment > size || (segment == 0 && len > 0)) {
+                continue;   // Larger than a buffer, so it was cut short like recvmmsg() would have
+            }
+            size_t segments = (len == 0) ? 1 : (len + segment - 1) / segment;
+            if (segment < size && segments > 1) {
+                unscatter(first, segments, segment, len);
+                copied += len - segment;
+            }
+            coalesced = coalesced || segments > 1;
+            for (size_t s = 0; s < segments; s++) {
+                std::swap(buffers[count], first[s]);
+                lengths[count++] = std::min(segment, len - s * segment);
+            }
+        }
+        receiver_addr = addrs[received - 1];
+        if (!coalesced && (size_t) received == m) {
+            coalesced_layout = false;
+        }
+        if (count == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+        return count;
+    }
+
+    // Segments smaller than the buffers were scattered back to back, move each one to the start of its own buffer.
+    // Back to front, so no segment is overwritten before it has moved.
+    static void unscatter(iovec* buffers, size_t segments, size_t segment, size_t len) {
+        size_t size = buffers[0].iov_len;
+        std::vector<char> tmp(segment);
+        for (size_t s = segments; s-- > 1; ) {
+            size_t offset = s * segment;
+            size_t length = std::min(segment, len - offset);
+            for (size_t copied = 0; copied < length; ) {
+                size_t pos = offset + copied;
+                size_t chunk = std::min(length - copied, size - pos % size);
+                std::memcpy(&tmp[copied], (char*) buffers[pos / size].iov_base + pos % size, chunk);
+                copied += chunk;
+            }
+            std::memcpy(buffers[s].iov_base, tmp.data(), length);
+        }
+    }
+#endif
 };
 
-class FaultyUDPStreamReceiver : public UDPStreamReceiver {
+template<typename ReceiverType>
+class FaultyStreamReceiver : public ReceiverType {
     // This class is intended for testing purposes only to simulate low channel quality
 public:
-    FaultyUDPStreamReceiver(int receiver_port, float error_rate, bool data_only=false, int seed=-1) 
-            : UDPStreamReceiver(receiver_port), data_only(data_only), error_rate(error_rate) {
+    FaultyStreamReceiver(int receiver_port, float error_rate, bool data_only=false, int seed=-1, int bits=1)
+            : ReceiverType(receiver_port), data_only(data_only), error_rate(error_rate), bits(std::max(bits, 1)) {
         if (seed == -1) {
             std::random_device rd;
-            std::mt19937 gen(rd());
+            gen.seed(rd());
         } else {
-            std::mt19937 gen(seed);
+            gen.seed(seed);
         }
-        std::uniform_real_distribution<float> dis(0.0f, 1.0f);
     };
 
 
     ssize_t receive(void* buffer, size_t len) override {
-        ssize_t r = UDPStreamReceiver::receive(buffer, len);
-        if (data_only && len <= HEADER_SIZE) {
-            return r;
-        }
-        if (dis(gen) < error_rate) {
-            char* addr = (char*)buffer + HEADER_SIZE + 1;
-            *addr = *addr ^ 0b0001000;  // flip a random bit
+        ssize_t r = ReceiverType::receive(buffer, len);
+        corrupt(buffer, len, r);
+        return r;
+    }
+
+    int receiveBatch(iovec* buffers, ssize_t* lengths, size_t n) override {
+        int r = ReceiverType::receiveBatch(buffers, lengths, n);
+        for (int i = 0; i < r; i++) {
+            corrupt(buffers[i].iov_base, buffers[i].iov_len, lengths[i]);
         }
         return r;
     }
 
 private:
-    bool data_only;     // Only flip bits in transmissions len > HEADER_SIZE
-    float error_rate;   // Flip a bit in this proportion of transmissions
-    std::uniform_real_distribution<float> dis;
+    // As for a single receive(), data_only looks at the size of the buffer, not of what arrived in it,
+    // so a batch is corrupted exactly like the same datagrams received one by one
+    void corrupt(void* buffer, size_t capacity, ssize_t len) {
+        if (len < 0 || (data_only && capacity <= HEADER_SIZE)) {
+            return;
+        }
+        if (dis(gen) < error_rate) {
+            if (bits == 1) {
+                char* addr = (char*)buffer + HEADER_SIZE + 1;
+                *addr = *addr ^ 0b0001000;  // flip a bit
+                return;
+            }
+            // Flip bits anywhere after the header. Two in the same column of 16 bit words, one set and
+            // one cleared, cancel out in the header checksum, only a CRC catches those.
+            std::uniform_int_distribution<ssize_t> pos(HEADER_SIZE * 8, std::max<ssize_t>(len, HEADER_SIZE + 2) * 8 - 1);
+            for (int i = 0; i < bits; i++) {
+                ssize_t bit = pos(gen);
+                ((char*)buffer)[bit / 8] ^= 1 << (bit % 8);
+            }
+        }
+    }
+
+    bool data_only;     // Only flip bits when receiving into buffers larger than HEADER_SIZE
+    float error_rate;   // Flip bits in this proportion of transmissions
+    int bits;           // how many bits to flip in each one
+    std::uniform_real_distribution<float> dis{0.0f, 1.0f};
     std::mt19937 gen;
 
-};
\ No newline at end of file
+};
+
+typedef FaultyStreamReceiver<UDPStreamReceiver> FaultyUDPStreamReceiver;
@@ -0,0 +1,207 @@
+#pragma once
+#ifdef __linux__
+#include <cstring>
+#include <algorithm>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+// Minimal io_uring through the raw syscalls, so there is no liburing dependency.
+//
+// The submission and completion rings are shared with the kernel: get() hands out SQEs, submit() publishes
+// them and enters the kernel once for all of them, and completions are read with peek()/advance() without
+// any syscall at all. Only one thread may use a Uring.
+class Uring {
+public:
+    // cq_entries 0 leaves the completion ring at twice the submission ring, as the kernel does by default
+    bool open(unsigned entries, unsigned cq_entries=0) {
+        io_uring_params params = {};
+        if (cq_entries) {
+            params.flags |= IORING_SETUP_CQSIZE;
+            params.cq_entries = cq_entries;
+        }
+        fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+        if (fd < 0) {
+            perror("io_uring_setup failed");
+            return false;
+        }
+        sq_entries = params.sq_entries;
+        sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_len = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) sq_len = cq_len = std::max(sq_len, cq_len);
+
+        sq_ring = mmap(nullptr, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        cq_ring = single ? sq_ring : mmap(nullptr, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        sqes_len = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe*) mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes == MAP_FAILED) {
+            perror("io_uring mmap failed");
+            close();
+            return false;
+        }
+        char* sq = (char*) sq_ring;
+        char* cq = (char*) cq_ring;
+        sq_head = (unsigned*) (sq + params.sq_off.head);
+        sq_tail = (unsigned*) (sq + params.sq_off.tail);
+        sq_mask = *(unsigned*) (sq + params.sq_off.ring_mask);
+        sq_array = (unsigned*) (sq + params.sq_off.array);
+        cq_head = (unsigned*) (cq + params.cq_off.head);
+        cq_tail = (unsigned*) (cq + params.cq_off.tail);
+        cq_mask = *(unsigned*) (cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe*) (cq + params.cq_off.cqes);
+        next_tail = *sq_tail;
+        return true;
+    }
+
+    void close() {
+        if (sqes && sqes != MAP_FAILED) munmap(sqes, sqes_len);
+        if (cq_ring && cq_ring != MAP_FAILED && cq_ring != sq_ring) munmap(cq_ring, cq_len);
+        if (sq_ring && sq_ring != MAP_FAILED) munmap(sq_ring, sq_len);
+        if (fd >= 0) ::close(fd);
+        sqes = nullptr;
+        sq_ring = cq_ring = nullptr;
+        fd = -1;
+    }
+
+    bool isOpen() {
+        return fd >= 0;
+    }
+    // Readable while completions are waiting, so it can sit in an EventPoller in place of a socket
+    int ringFd() {
+        return fd;
+    }
+
+    // A zeroed SQE to fill in, nullptr if the submission ring is full
+    io_uring_sqe* get() {
+        unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (next_tail - head >= sq_entries) return nullptr;
+        unsigned index = next_tail & sq_mask;
+        io_uring_sqe* sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sq_array[index] = index;
+        next_tail++;
+        return sqe;
+    }
+
+    // Hand every SQE from get() to the kernel and, if wait_nr > 0, block until that many completions are
+    // posted. Returns the number submitted, or -1 with errno set.
+    int submit(unsigned wait_nr=0) {
+        unsigned to_submit = next_tail - *sq_tail;
+        __atomic_store_n(sq_tail, next_tail, __ATOMIC_RELEASE);
+        int ret;
+        do {
+            ret = (int) syscall(__NR_io_uring_enter, fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        } while (ret < 0 && errno == EINTR);
+        return ret;
+    }
+
+    // The oldest completion, nullptr if there is none. advance() once done with it.
+    io_uring_cqe* peek() {
+        unsigned head = *cq_head;
+        if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) return nullptr;
+        return &cqes[head & cq_mask];
+    }
+    void advance() {
+        __atomic_store_n(cq_head, *cq_head + 1, __ATOMIC_RELEASE);
+    }
+
+    int registerBufferRing(io_uring_buf_ring* ring, unsigned entries, uint16_t group) {
+        io_uring_buf_reg reg = {};
+        reg.ring_addr = (uint64_t) (uintptr_t) ring;
+        reg.ring_entries = entries;
+        reg.bgid = group;
+        return (int) syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &reg, 1);
+    }
+
+private:
+    int fd = -1;
+    unsigned sq_entries = 0;
+    size_t sq_len = 0, cq_len = 0, sqes_len = 0;
+    void* sq_ring = nullptr;
+    void* cq_ring = nullptr;
+    io_uring_sqe* sqes = nullptr;
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned sq_mask = 0;
+    unsigned next_tail = 0;     // tail after the SQEs handed out by get() but not submitted yet
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+};
+
+
+// A provided buffer ring: `entries` buffers of `size` bytes that the kernel picks from for receives
+// submitted with IOSQE_BUFFER_SELECT. A completion names the buffer it used, which stays ours until recycle().
+class UringBufferRing {
+public:
+    bool open(Uring& uring, unsigned entries, size_t size, uint16_t group) {
+        this->entries = entries;
+        this->size = size;
+        this->group = group;
+        ring_len = entries * sizeof(io_uring_buf);
+        ring = (io_uring_buf_ring*) mmap(nullptr, ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        storage_len = entries * size;
+        storage = (char*) mmap(nullptr, storage_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring == MAP_FAILED || storage == MAP_FAILED) {
+            perror("buffer ring mmap failed");
+            close();
+            return false;
+        }
+        if (uring.registerBufferRing(ring, entries, group) < 0) {
+            perror("IORING_REGISTER_PBUF_RING failed");
+            close();
+            return false;
+        }
+        tail = 0;
+        for (unsigned bid = 0; bid < entries; bid++) {
+            recycle(bid);
+        }
+        publish();
+        return true;
+    }
+
+    void close() {
+        if (ring && ring != MAP_FAILED) munmap(ring, ring_len);
+        if (storage && storage != MAP_FAILED) munmap(storage, storage_len);
+        ring = nullptr;
+        storage = nullptr;
+    }
+
+    uint16_t groupId() {
+        return group;
+    }
+    char* buffer(unsigned bid) {
+        return storage + bid * size;
+    }
+
+    // Give buffer bid back to the kernel, visible after the next publish()
+    void recycle(unsigned bid) {
+        // Indexed by hand: in C++ the header's flexible array member of io_uring_buf_ring doesn't start at offset 0
+        io_uring_buf* buf = reinterpret_cast<io_uring_buf*>(ring) + (tail & (entries - 1));
+        buf->addr = (uint64_t) (uintptr_t) buffer(bid);
+        buf->len = size;
+        buf->bid = bid;
+        tail++;
+    }
+    void publish() {
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+
+private:
+    io_uring_buf_ring* ring = nullptr;
+    char* storage = nullptr;
+    size_t ring_len = 0, storage_len = 0;
+    unsigned entries = 0;   // a power of two
+    size_t size = 0;
+    uint16_t group = 0;
+    uint16_t tail = 0;
+};
+
+#endif
@@ -0,0 +1,237 @@
+#pragma once
+#include "UDPNetworkConnection.hpp"
+#include "Uring.hpp"
+
+// UDP connections driven by io_uring instead of sendmmsg()/recvmmsg(). They slot into StreamSender and
+// StreamReceiver like the plain UDP ones, and fall back to them if the kernel refuses io_uring.
+//
+// Sending: a batch becomes one linked SENDMSG SQE per datagram and a single io_uring_enter(). The link makes
+// a full socket buffer (-EAGAIN) cancel the rest of the batch, so, as with sendmmsg(), what was sent is a prefix.
+//
+// Receiving: one multishot RECVMSG keeps receiving into a ring of provided buffers without being resubmitted,
+// and receiveBatch() only reads completions from shared memory, with no syscall per batch. The connection's
+// EventPoller waits on the ring fd instead of the socket. Payloads are copied out of the provided buffers into
+// the caller's, because the kernel picks a provided buffer before the caller knows where a packet belongs.
+
+#ifdef __linux__
+
+const unsigned URING_ENTRIES = 2 * SEND_BATCH_SIZE;     // submission ring size
+const unsigned URING_RECV_BUFFERS = 1024;               // provided receive buffers, a power of two
+const size_t URING_RECV_BUFFER_SIZE = sizeof(io_uring_recvmsg_out) + sizeof(sockaddr_in) + sizeof(Packet);
+
+class UringUDPStreamSender : public UDPStreamSender {
+public:
+    UringUDPStreamSender(int receiver_port, std::string& receiver_ip) : UDPStreamSender(receiver_port, receiver_ip) {}
+
+    bool open() override {
+        UDPStreamSender::open();
+        if (!uring.open(URING_ENTRIES)) {
+            std::cerr << "io_uring unavailable, sending with sendmmsg" << std::endl;
+        }
+        return true;
+    }
+
+    bool close() override {
+        uring.close();
+        return UDPStreamSender::close();
+    }
+
+    // Only sendmmsg() builds super-datagrams
+    bool enableSegmentation() override {
+        return !uring.isOpen() && UDPStreamSender::enableSegmentation();
+    }
+
+    int sendBatch(iovec* packets, size_t n, const uint64_t* txtimes=nullptr) override {
+        if (!uring.isOpen()) {
+            return UDPStreamSender::sendBatch(packets, n, txtimes);
+        }
+        int total = 0;
+        while (n > 0) {
+            size_t chunk = std::min(n, (size_t) SEND_BATCH_SIZE);
+            std::memset(msgs, 0, chunk * sizeof(msghdr));
+            for (size_t i = 0; i < chunk; i++) {
+                msgs[i].msg_name = &receiver_addr;
+                msgs[i].msg_namelen = sizeof(receiver_addr);
+                msgs[i].msg_iov = &packets[i];
+                msgs[i].msg_iovlen = 1;
+#ifdef SO_TXTIME
+                if (txtimes) {
+                    msgs[i].msg_control = control[i];
+                    msgs[i].msg_controllen = sizeof(control[i]);
+                    cmsghdr* cmsg = CMSG_FIRSTHDR(&msgs[i]);
+                    cmsg->cmsg_level = SOL_SOCKET;
+                    cmsg->cmsg_type = SCM_TXTIME;
+                    cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+                    std::memcpy(CMSG_DATA(cmsg), &txtimes[total + i], sizeof(uint64_t));
+                }
+#endif
+                io_uring_sqe* sqe = uring.get();   // the ring holds two batches, and each one is reaped below
+                sqe->opcode = IORING_OP_SENDMSG;
+                sqe->fd = sockfd;
+                sqe->addr = (uint64_t) (uintptr_t) &msgs[i];
+                sqe->len = 1;
+                sqe->msg_flags = MSG_DONTWAIT;  // -EAGAIN rather than a blocking retry in a kernel worker
+                if (i + 1 < chunk) sqe->flags = IOSQE_IO_LINK;
+            }
+            if (uring.submit(chunk) < 0) {
+                return (total == 0) ? -1 : total;
+            }
+            // UDP sends complete inline, so all chunk completions are there once submit() returns
+            int sent = 0;
+            int error = 0;
+            io_uring_cqe* cqe;
+            for (size_t i = 0; i < chunk && (cqe = uring.peek()) != nullptr; i++) {
+                if (cqe->res >= 0) {
+                    sent++;
+                } else if (error == 0 && cqe->res != -ECANCELED) {
+                    error = -cqe->res;
+                }
+                uring.advance();
+            }
+            total += sent;
+            if ((size_t) sent < chunk) {
+                if (total == 0) {
+                    errno = error;
+                    return -1;
+                }
+                break;  // Socket buffer full, caller decides what to do with the rest
+            }
+            packets += chunk;
+            n -= chunk;
+        }
+        return total;
+    }
+
+private:
+    Uring uring;
+    msghdr msgs[SEND_BATCH_SIZE];
+#ifdef SO_TXTIME
+    char control[SEND_BATCH_SIZE][CMSG_SPACE(sizeof(uint64_t))];
+#endif
+};
+
+
+class UringUDPStreamReceiver : public UDPStreamReceiver {
+public:
+    UringUDPStreamReceiver() {}
+    UringUDPStreamReceiver(int receiver_port) : UDPStreamReceiver(receiver_port) {}
+
+    bool open() override {
+        UDPStreamReceiver::open();
+        if (uring.open(URING_ENTRIES, 2 * URING_RECV_BUFFERS) &&
+                buffers.open(uring, URING_RECV_BUFFERS, URING_RECV_BUFFER_SIZE, 0) && arm()) {
+            poller.close();
+            poller.open(uring.ringFd());
+        } else {
+            std::cerr << "io_uring multishot receive unavailable, receiving with recvmmsg" << std::endl;
+            fallback();
+        }
+        return true;
+    }
+
+    bool close() override {
+        uring.close();      // cancels the multishot receive before its buffers go away
+        buffers.close();
+        return UDPStreamReceiver::close();
+    }
+
+    // A coalesced datagram wouldn't fit a provided buffer
+    bool enableCoalescing(size_t batch, size_t buffer_size) override {
+        return !uring.isOpen() && UDPStreamReceiver::enableCoalescing(batch, buffer_size);
+    }
+
+    ssize_t receive(void* buffer, size_t len) override {
+        if (!uring.isOpen()) {
+            return UDPStreamReceiver::receive(buffer, len);
+        }
+        iovec iov = {buffer, len};
+        ssize_t length;
+        return (receiveBatch(&iov, &length, 1) == 1) ? length : -1;
+    }
+
+    int receiveBatch(iovec* iovs, ssize_t* lengths, size_t n) override {
+        if (!uring.isOpen()) {
+            return UDPStreamReceiver::receiveBatch(iovs, lengths, n);
+        }
+        size_t received = 0;
+        bool rearm = false;
+        bool recycled = false;
+        io_uring_cqe* cqe;
+        while (received < n && (cqe = uring.peek()) != nullptr) {
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            uring.advance();
+            // The kernel ends a multishot receive when it runs out of buffers or on an error
+            if (!(flags & IORING_CQE_F_MORE)) rearm = true;
+            if (res < 0 && res != -ENOBUFS) {
+                // Not a kernel that does multishot recvmsg after all, go back to recvmmsg for good
+                std::cerr << "io_uring recvmsg failed: " << strerror(-res) << ", receiving with recvmmsg" << std::endl;
+                fallback();
+                return (received == 0) ? UDPStreamReceiver::receiveBatch(iovs, lengths, n) : (int) received;
+            }
+            if (res < 0 || !(flags & IORING_CQE_F_BUFFER)) continue;
+
+            // Buffer layout: io_uring_recvmsg_out, the source address (msg_namelen bytes), then the payload
+            unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+            char* buffer = buffers.buffer(bid);
+            io_uring_recvmsg_out* out = reinterpret_cast<io_uring_recvmsg_out*>(buffer);
+            if (out->namelen >= sizeof(sockaddr_in)) {
+                std::memcpy(&receiver_addr, buffer + sizeof(*out), sizeof(sockaddr_in));
+            }
+            size_t length = std::min((size_t) out->payloadlen, iovs[received].iov_len);
+            std::memcpy(iovs[received].iov_base, buffer + sizeof(*out) + sizeof(sockaddr_in), length);
+            copied += length;
+            lengths[received++] = length;
+            buffers.recycle(bid);
+            recycled = true;
+        }
+        if (recycled) buffers.publish();
+        if (rearm) arm();
+        if (received == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+        return received;
+    }
+
+private:
+    Uring uring;
+    UringBufferRing buffers;
+    msghdr recv_msg;        // only sizes the address and control parts of each provided buffer
+
+    void fallback() {
+        if (uring.isOpen()) {
+            poller.close();
+            poller.open(sockfd);
+        }
+        uring.close();
+        buffers.close();
+    }
+
+    bool arm() {
+        std::memset(&recv_msg, 0, sizeof(recv_msg));
+        recv_msg.msg_namelen = sizeof(sockaddr_in);
+        io_uring_sqe* sqe = uring.get();
+        if (!sqe) return false;
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = sockfd;
+        sqe->addr = (uint64_t) (uintptr_t) &recv_msg;
+        sqe->len = 1;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = buffers.groupId();
+        if (uring.submit() < 0) {
+            perror("io_uring multishot recvmsg failed");
+            return false;
+        }
+        return true;
+    }
+};
+
+#else
+
+// io_uring is Linux only, elsewhere these are the plain UDP connections
+typedef UDPStreamSender UringUDPStreamSender;
+typedef UDPStreamReceiver UringUDPStreamReceiver;
+
+#endif
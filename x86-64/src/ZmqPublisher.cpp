@@ -4,7 +4,6 @@
 
 #include <memory>
 #include "StreamReceiver.hpp"
-#include "DataWindow.hpp"
 #include "DummyData.hpp"
 #include "UDPNetworkConnection.hpp"
 #include "cmn.h"
@@ -12,18 +11,19 @@
 #include <zmqpp/zmqpp.hpp>
 
 
-std::unique_ptr<StreamReceiverInterface> receiverFactory(int receiver_port, float perror, bool debug, bool stats, int windowsize) {
+template<typename Policy>
+std::unique_ptr<StreamReceiverInterface> receiverFactory(int receiver_port, float perror, bool stats, int windowsize) {
     std::unique_ptr<StreamReceiverInterface> ptr;
     // set up ZMQ context
     const std::string& endpoint = "tcp://127.0.0.1:5555";
     if (perror == -1) {
-        auto receiver = new StreamReceiver<ZMQDataProcessor, PacketMap<Packet>, UDPStreamReceiver>(
-            ZMQDataProcessor(endpoint), PacketMap<Packet>(), UDPStreamReceiver(receiver_port), debug, windowsize
+        auto receiver = new StreamReceiver<ZMQDataProcessor, UDPStreamReceiver, Policy>(
+            ZMQDataProcessor(endpoint), UDPStreamReceiver(receiver_port), windowsize
         );
         ptr.reset(receiver);
     } else {
-        auto receiver = new StreamReceiver<ZMQDataProcessor, PacketMap<Packet>, FaultyUDPStreamReceiver>(
-            ZMQDataProcessor(endpoint), PacketMap<Packet>(), FaultyUDPStreamReceiver(receiver_port, perror, true, 1), debug, windowsize
+        auto receiver = new StreamReceiver<ZMQDataProcessor, FaultyUDPStreamReceiver, Policy>(
+            ZMQDataProcessor(endpoint), FaultyUDPStreamReceiver(receiver_port, perror, true, 1), windowsize
         );
         ptr.reset(receiver);
     }
@@ -55,6 +55,10 @@ int main(int argc, char* argv[]) {
             i++;
         } else if (arg == "-window") {
             windowsize = std::atoi(argv[i+1]);
+            if (windowsize < 1 || windowsize > MAX_WINDOW_SIZE) {
+                std::cerr << "Bad -window " << argv[i+1] << ", expected 1 to " << MAX_WINDOW_SIZE << " packets" << std::endl;
+                return EXIT_FAILURE;
+            }
             i++;
         } else {
             args.push_back(arg);
@@ -68,7 +72,8 @@ int main(int argc, char* argv[]) {
     int receiver_port = std::atoi(args[0].c_str());
 
 
-    auto receiver = receiverFactory(receiver_port, perror, debug, stats, windowsize);
+    auto receiver = debug ? receiverFactory<DebugPolicy>(receiver_port, perror, stats, windowsize)
+                          : receiverFactory<DefaultPolicy>(receiver_port, perror, stats, windowsize);
     receiver->receiveData();
     receiver->teardown();
 }
\ No newline at end of file